@@ -0,0 +1,626 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "coloring.hpp"
+#include "correlation.hpp"
+#include "histogram.hpp"
+#include "ising_model.hpp"
+#include "onsager.hpp"
+#include "perf_counters.hpp"
+#include "replica.hpp"
+#include "statistics.hpp"
+#include "stream_recorder.hpp"
+#include "telemetry.hpp"
+
+thread_local double g_beta = 0.44;
+field_t g_bond_energy = 1.0;
+
+namespace stdf = std::filesystem;
+
+/**
+ * Usage: ./bench_main [options]
+ *        ./bench_main --onsager [options] (--betas=[b,b,...]) (--tolerance=[energy]:[magnetization]) (--time-limit=[seconds])
+ *        ./bench_main --compare [baseline.json] [candidate.json] (--threshold=[percent])
+ * The options are --out=[file] (JSON, by default to stdout), --filter=[substring of the names],
+ * --max-side=[n] (the largest lattice side, 1024 by default; up to 8192), --threads=[n,n,...] and
+ * --min-time=[seconds per measurement] and --perf (hardware counters per operation, where Linux allows them).
+ * Every kernel is measured on square lattices from 3x3 up to the largest side, and the threaded ones at every
+ * thread count; a result is the best of three batches, in nanoseconds per operation (per spin, per node, per
+ * line or per call, see the kernel). The compare mode exits with a failure if a benchmark got slower than the
+ * threshold (5% by default) or is missing from the candidate.
+ * The Onsager mode is a time-to-accuracy benchmark instead: every engine sweeps periodic lattices (32x32 up to
+ * --max-side, 128 by default) at several beta around beta_c from the ordered configuration, and the wall time
+ * until the running averages of E/N and |M| are within the tolerances of the exact solution is tabulated.
+ */
+namespace {
+
+constexpr node_t k_sides[] = { 3, 64, 256, 1024, 4096, 8192 };
+
+volatile double g_sink{};
+
+struct Options {
+    std::string out{};
+    std::string filter{};
+    node_t max_side = 1024;
+    std::vector<unsigned> thread_cts{};
+    double min_time = 0.2;
+    bool perf = false;
+};
+
+struct Result {
+    std::string name;
+    std::string kernel;
+    node_t side;
+    unsigned thread_ct;
+    uint64_t call_ct;
+    double ns_per_op;
+    // the counts over the measured batches, of op_ct operations.
+    PerfSample counters;
+    uint64_t op_ct;
+};
+
+class Harness {
+public:
+    explicit Harness(Options const& options)
+        : m_options(options) {
+        if (options.perf) {
+            m_counters.emplace();
+            if (!m_counters->available()) {
+                std::cerr << "Hardware counters unavailable: " << m_counters->error() << '\n';
+            }
+        }
+    }
+
+    /**
+     * @brief Measure a kernel unless the filter excludes it.
+     * @param op_ct The count of operations a call performs.
+     * @param f Called repeatedly; the first call is a warm-up.
+     */
+    template<typename F>
+    void run(std::string const& kernel, node_t side, unsigned thread_ct, uint64_t op_ct, F&& f) {
+        auto const name = name_of(kernel, side, thread_ct);
+        if (name.find(m_options.filter) == std::string::npos) {
+            return;
+        }
+        using clock = std::chrono::steady_clock;
+        f();
+        // grow the batch until it lasts a third of the measuring time, then keep the best of three.
+        uint64_t call_ct = 1;
+        auto best = std::numeric_limits<double>::infinity();
+        PerfSample counters{};
+        for (int batch = 0; batch < 3;) {
+            auto const before = m_counters ? m_counters->read() : PerfSample{};
+            auto const start = clock::now();
+            for (uint64_t i = 0; i < call_ct; ++i) {
+                f();
+            }
+            auto const seconds = std::chrono::duration<double>(clock::now() - start).count();
+            if (seconds < m_options.min_time / 3 && batch == 0 && call_ct < (uint64_t{ 1 } << 40)) {
+                call_ct *= 2;
+                continue;
+            }
+            if (m_counters) {
+                counters += m_counters->read() - before;
+            }
+            best = std::min(best, seconds * 1e9 / static_cast<double>(call_ct * op_ct));
+            ++batch;
+        }
+        m_results.push_back({ name, kernel, side, thread_ct, call_ct, best, counters, 3 * call_ct * op_ct });
+        std::cerr << std::setw(40) << std::left << name << std::setw(12) << best << " ns/op" << '\n';
+    }
+
+    /**
+     * @brief Whether any benchmark of a kernel at a size and thread count passes the filter, to skip the setup of
+     * ones that don't.
+     */
+    bool wanted(std::string const& kernel, node_t side, unsigned thread_ct) const {
+        return name_of(kernel, side, thread_ct).find(m_options.filter) != std::string::npos;
+    }
+
+    void write(std::ostream& os) const {
+        os << "{\n  \"context\": { \"hardware_threads\": " << std::thread::hardware_concurrency()
+           << ", \"telemetry\": " << (Telemetry::k_enabled ? "true" : "false")
+           << ", \"min_time\": " << m_options.min_time << " },\n  \"benchmarks\": [\n";
+        for (std::size_t i = 0; i < m_results.size(); ++i) {
+            auto const& r = m_results[i];
+            os << "    { \"name\": \"" << r.name << "\", \"kernel\": \"" << r.kernel << "\", \"side\": " << r.side
+               << ", \"threads\": " << r.thread_ct << ", \"calls\": " << r.call_ct
+               << ", \"ns_per_op\": " << std::setprecision(6) << r.ns_per_op;
+            if (m_counters && m_counters->available()) {
+                auto const per_op = [&r](PerfSample::Event event) {
+                    return static_cast<double>(r.counters.counts[event]) / static_cast<double>(r.op_ct);
+                };
+                os << ", \"ipc\": " << r.counters.ipc()
+                   << ", \"cache_misses_per_op\": " << per_op(PerfSample::k_cache_misses)
+                   << ", \"branch_misses_per_op\": " << per_op(PerfSample::k_branch_misses)
+                   << ", \"dtlb_misses_per_op\": " << per_op(PerfSample::k_dtlb_misses);
+            }
+            os << " }" << (i + 1 < m_results.size() ? "," : "") << '\n';
+        }
+        os << "  ]\n}\n";
+    }
+
+private:
+    static std::string name_of(std::string const& kernel, node_t side, unsigned thread_ct) {
+        return kernel + "/" + std::to_string(side) + "x" + std::to_string(side) + "/t" + std::to_string(thread_ct);
+    }
+
+    Options m_options;
+    std::optional<PerfCounters> m_counters;
+    std::vector<Result> m_results;
+};
+
+/**
+ * @brief Write the spins and bonds files of a side x side lattice in the format of data/.
+ */
+void write_grid_files(node_t side, stdf::path const& spin_file, stdf::path const& bond_file) {
+    std::ofstream spins(spin_file);
+    std::ofstream bonds(bond_file);
+    for (node_t i = 0; i < side * side; ++i) {
+        spins << i + 1 << " 0.0\n";
+        if ((i + 1) % side != 0) {
+            bonds << i + 1 << ' ' << i + 2 << " 1.0\n";
+        }
+        if (i + side < side * side) {
+            bonds << i + 1 << ' ' << i + side + 1 << " 1.0\n";
+        }
+    }
+    if (!spins || !bonds) {
+        throw std::runtime_error("Writing the benchmark input files failed.");
+    }
+}
+
+void bench_side(Harness& harness, Options const& options, node_t side) {
+    auto const n = side * side;
+    auto model = Ising::from_grid(side, 1.0);
+    model.seed(42);
+    model.randomize();
+    std::vector<node_t> nodes(1024);
+    for (auto& node : nodes) {
+        node = static_cast<node_t>(randnum(std::size_t{}, static_cast<std::size_t>(n), model.rng()));
+    }
+
+    // single-spin kernels, per spin.
+    harness.run("delta", side, 1, nodes.size(), [&] {
+        double sum{};
+        for (auto node : nodes) {
+            sum += model.delta(node);
+        }
+        g_sink = sum;
+    });
+    harness.run("flip", side, 1, nodes.size(), [&] {
+        for (auto node : nodes) {
+            model.flip(node);
+        }
+    });
+    harness.run("sweep", side, 1, n, [&] { model.markov_chain_monte_carlo(Ising::pass, 1); });
+    for (auto const thread_ct : options.thread_cts) {
+        if (!harness.wanted("colored_sweep", side, thread_ct)) {
+            continue;
+        }
+        ColoredMetropolis engine(model, thread_ct, 42);
+        harness.run("colored_sweep", side, thread_ct, n, [&] { engine.markov_chain_monte_carlo(Ising::pass, 1); });
+    }
+
+    // construction and parsing, per node or per line.
+    harness.run("from_grid", side, 1, n, [&] { g_sink = Ising::from_grid(side, 1.0).energy(); });
+    auto const parsing = harness.wanted("initialize", side, 1) || std::ranges::any_of(options.thread_cts, [&](unsigned t) {
+        return harness.wanted("read_spin_file", side, t) || harness.wanted("read_bond_file", side, t);
+    });
+    if (parsing) {
+        auto const dir = stdf::temp_directory_path();
+        auto const spin_file = dir / ("ising_bench_spins_" + std::to_string(side) + ".txt");
+        auto const bond_file = dir / ("ising_bench_bonds_" + std::to_string(side) + ".txt");
+        write_grid_files(side, spin_file, bond_file);
+        auto const spins = read_spin_file<field_t>(spin_file.string());
+        auto const bonds = read_bond_file<energy_t>(bond_file.string());
+        for (auto const thread_ct : options.thread_cts) {
+            harness.run("read_spin_file", side, thread_ct, spins.size(), [&] {
+                g_sink = static_cast<double>(load_records<std::pair<node_t, field_t>>(spin_file.string(), thread_ct).size());
+            });
+            harness.run("read_bond_file", side, thread_ct, bonds.size(), [&] {
+                g_sink = static_cast<double>(load_records<std::tuple<node_t, node_t, energy_t>>(bond_file.string(), thread_ct).size());
+            });
+        }
+        harness.run("initialize", side, 1, bonds.size(), [&] {
+            Ising fresh{};
+            fresh.initialize(spins, bonds);
+            g_sink = fresh.energy();
+        });
+        stdf::remove(spin_file);
+        stdf::remove(bond_file);
+    }
+
+    // recorders, per call; the sample-keeping ones are emptied now and then to bound the memory.
+    auto const bounded = [](auto& recorder) {
+        return [&recorder, ct = uint64_t{}](Ising const& self) mutable {
+            recorder(self);
+            if (++ct % 4096 == 0) {
+                recorder.clear();
+            }
+        };
+    };
+    Ising::Recorder<Ising::EnergyRecorder> energy{};
+    Ising::Recorder<Ising::MagnetizationRecorder> magnetization{};
+    Ising::Recorder<Ising::StateRecorder> state{};
+    Ising::Recorder<TelemetryRecorder> telemetry{};
+    harness.run("energy_recorder", side, 1, 1, [&, f = bounded(energy)]() mutable { f(model); });
+    harness.run("magnetization_recorder", side, 1, 1, [&, f = bounded(magnetization)]() mutable { f(model); });
+    harness.run("state_recorder", side, 1, 1, [&, f = bounded(state)]() mutable { f(model); });
+    harness.run("telemetry_recorder", side, 1, 1, [&, f = bounded(telemetry)]() mutable { f(model); });
+    StatisticsRecorder statistics{};
+    harness.run("statistics_recorder", side, 1, 1, [&] { statistics(model); });
+    EnergyHistogram histogram{};
+    harness.run("energy_histogram", side, 1, 1, [&] { histogram(model); });
+    if (harness.wanted("stream_recorder", side, 1)) {
+        auto const file = stdf::temp_directory_path() / ("ising_bench_samples_" + std::to_string(side) + ".bin");
+        {
+            StreamRecorder stream(file.string(), StreamRecorder::k_energy | StreamRecorder::k_magnetization,
+                                  StreamRecorder::Format::k_binary);
+            harness.run("stream_recorder", side, 1, 1, [&] { stream(model); });
+        }
+        stdf::remove(file);
+    }
+    for (auto const thread_ct : options.thread_cts) {
+        if (!harness.wanted("correlation_recorder", side, thread_ct)) {
+            continue;
+        }
+        CorrelationRecorder correlation(side, side, 1, false, thread_ct);
+        harness.run("correlation_recorder", side, thread_ct, 1, [&] { correlation(model); });
+    }
+}
+
+/**
+ * @brief The (name, ns_per_op) pairs of a results file written by Harness::write().
+ */
+std::map<std::string, double> read_results(std::string const& file) {
+    std::ifstream ifs(file);
+    if (!ifs) {
+        throw std::runtime_error("Can't open " + file);
+    }
+    std::map<std::string, double> results{};
+    constexpr std::string_view k_name = "\"name\": \"";
+    constexpr std::string_view k_time = "\"ns_per_op\": ";
+    for (std::string line{}; std::getline(ifs, line);) {
+        auto const name = line.find(k_name);
+        auto const time = line.find(k_time);
+        if (name == std::string::npos || time == std::string::npos) {
+            continue;
+        }
+        auto const begin = name + k_name.size();
+        auto const end = line.find('"', begin);
+        double value{};
+        std::from_chars(line.data() + time + k_time.size(), line.data() + line.size(), value);
+        results[line.substr(begin, end - begin)] = value;
+    }
+    return results;
+}
+
+int compare(std::string const& baseline_file, std::string const& candidate_file, double threshold) {
+    auto const baseline = read_results(baseline_file);
+    auto const candidate = read_results(candidate_file);
+    int regression_ct{};
+    std::cout << std::setw(40) << std::left << "benchmark" << std::setw(14) << "baseline" << std::setw(14) << "candidate"
+              << "change" << '\n';
+    for (auto const& [name, after] : candidate) {
+        auto const it = baseline.find(name);
+        if (it == baseline.end() || it->second <= 0) {
+            continue;
+        }
+        auto const change = (after / it->second - 1) * 100;
+        auto const regressed = change > threshold;
+        regression_ct += regressed;
+        std::cout << std::setw(40) << std::left << name << std::setw(14) << it->second << std::setw(14) << after
+                  << std::showpos << std::setprecision(3) << change << '%' << std::noshowpos << std::setprecision(6)
+                  << (regressed ? "  REGRESSION" : "") << '\n';
+    }
+    // a benchmark that didn't run, e.g. because it crashed, can't be told apart from one that regressed.
+    int missing_ct{};
+    for (auto const& [name, before] : baseline) {
+        if (!candidate.contains(name)) {
+            ++missing_ct;
+            std::cout << std::setw(40) << std::left << name << std::setw(14) << before << std::setw(14) << "-"
+                      << "MISSING" << '\n';
+        }
+    }
+    std::cout << regression_ct << " regression(s) above " << threshold << "%." << '\n';
+    if (missing_ct > 0) {
+        std::cout << missing_ct << " benchmark(s) of the baseline missing from the candidate." << '\n';
+    }
+    return regression_ct > 0 || missing_ct > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+constexpr node_t k_onsager_sides[] = { 32, 64, 128, 256, 512 };
+
+struct OnsagerOptions {
+    std::vector<double> betas{ 0.38, 0.42, 0.46, 0.50 };
+    double energy_tolerance = 0.01;
+    double magnetization_tolerance = 0.01;
+    double time_limit = 10.0;
+};
+
+struct Accuracy {
+    std::string engine;
+    node_t side;
+    unsigned thread_ct;
+    double beta;
+    bool converged;
+    double seconds;
+    uint64_t sweep_ct;
+    double energy;
+    double abs_magnetization;
+};
+
+/**
+ * @brief Sweep until the averages of E/N and |M|, over all but the first fifth of the sweeps as burn-in, are
+ * within the tolerances of the exact values, or the time limit.
+ * |M| is only checked above beta_c: below it the exact value is 0 but a finite lattice keeps <|M|> of order
+ * L^(-7/8), so it would never converge.
+ * @param run Called as run(sweep_ct, sample) to perform sweeps, calling sample(e, m) with E/N and |M| after each.
+ */
+template<typename F>
+Accuracy time_to_accuracy(double beta, OnsagerOptions const& options, F&& run) {
+    auto const exact_energy = onsager_energy(beta);
+    auto const exact_magnetization = onsager_magnetization(beta);
+    auto const check_magnetization = beta > onsager_critical_beta();
+    constexpr std::size_t k_min_sweeps = 100;
+
+    g_beta = beta;
+    std::vector<std::pair<double, double>> samples{};
+    auto const sample = [&samples](double e, double m) { samples.emplace_back(e, m); };
+    auto const start = std::chrono::steady_clock::now();
+    Accuracy result{};
+    while (true) {
+        run(std::max<std::size_t>(10, samples.size() / 16), sample);
+        auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto const first = samples.size() / 5;
+        double energy{}, magnetization{};
+        for (auto i = first; i < samples.size(); ++i) {
+            energy += samples[i].first;
+            magnetization += samples[i].second;
+        }
+        energy /= static_cast<double>(samples.size() - first);
+        magnetization /= static_cast<double>(samples.size() - first);
+        auto const converged = samples.size() >= k_min_sweeps
+                            && std::abs(energy - exact_energy) <= options.energy_tolerance
+                            && (!check_magnetization || std::abs(magnetization - exact_magnetization) <= options.magnetization_tolerance);
+        if (converged || seconds >= options.time_limit) {
+            result.converged = converged;
+            result.seconds = seconds;
+            result.sweep_ct = samples.size();
+            result.energy = energy;
+            result.abs_magnetization = magnetization;
+            return result;
+        }
+    }
+}
+
+int run_onsager(Options const& options, OnsagerOptions const& onsager) {
+    std::vector<Accuracy> results{};
+    auto const report = [&results](Accuracy accuracy, std::string engine, node_t side, unsigned thread_ct, double beta) {
+        accuracy.engine = std::move(engine);
+        accuracy.side = side;
+        accuracy.thread_ct = thread_ct;
+        accuracy.beta = beta;
+        std::cout << std::setw(12) << std::left << accuracy.engine << std::setw(7) << side << std::setw(9) << thread_ct
+                  << std::setw(8) << beta << std::setw(12) << (accuracy.converged ? std::to_string(accuracy.seconds) : "timeout")
+                  << std::setw(10) << accuracy.sweep_ct << std::setw(12) << accuracy.energy << std::setw(12) << onsager_energy(beta)
+                  << std::setw(12) << accuracy.abs_magnetization << onsager_magnetization(beta) << '\n';
+        results.push_back(std::move(accuracy));
+    };
+    std::cout << "Time to E/N within " << onsager.energy_tolerance << " and |M| within " << onsager.magnetization_tolerance
+              << " of Onsager's solution (|M| above beta_c = " << onsager_critical_beta() << " only)." << '\n'
+              << std::setw(12) << std::left << "engine" << std::setw(7) << "side" << std::setw(9) << "threads"
+              << std::setw(8) << "beta" << std::setw(12) << "seconds" << std::setw(10) << "sweeps" << std::setw(12) << "E/N"
+              << std::setw(12) << "exact" << std::setw(12) << "|M|" << "exact" << '\n';
+
+    for (auto const side : k_onsager_sides) {
+        if (side > options.max_side) {
+            continue;
+        }
+        auto const n = static_cast<double>(side) * side;
+        auto const ordered = [side] {
+            auto model = Ising::from_grid(side, 1.0, Ordering::k_none, true);
+            model.seed(42);
+            std::vector<spin_t> up(model.size(), SpinTraits<spin_t>::from_value(1));
+            model.assign_spins(0, up);
+            model.recompute();
+            return model;
+        };
+        for (auto const beta : onsager.betas) {
+            auto model = ordered();
+            report(time_to_accuracy(beta, onsager, [&](std::size_t sweep_ct, auto&& sample) {
+                model.markov_chain_monte_carlo([&](Ising const& self) {
+                    sample(self.energy() / n, std::abs(self.magnetization()));
+                }, static_cast<int>(sweep_ct));
+            }), "metropolis", side, 1, beta);
+
+            for (auto const thread_ct : options.thread_cts) {
+                auto colored_model = ordered();
+                ColoredMetropolis engine(colored_model, thread_ct, 42);
+                report(time_to_accuracy(beta, onsager, [&](std::size_t sweep_ct, auto&& sample) {
+                    engine.markov_chain_monte_carlo([&](Ising const& self) {
+                        sample(self.energy() / n, std::abs(self.magnetization()));
+                    }, static_cast<int>(sweep_ct));
+                }), "colored", side, thread_ct, beta);
+            }
+
+            // the replicas are independent chains, so a sweep gives 4 samples; their mean is one.
+            using ReplicaBatch = BasicReplicaBatch<spin_t, energy_t, field_t, 4>;
+            auto replica_model = ordered();
+            ReplicaBatch batch(replica_model, 42);
+            batch.assign(replica_model);
+            report(time_to_accuracy(beta, onsager, [&](std::size_t sweep_ct, auto&& sample) {
+                batch.markov_chain_monte_carlo([&](ReplicaBatch const& self) {
+                    double energy{}, magnetization{};
+                    for (std::size_t r = 0; r < ReplicaBatch::replica_count(); ++r) {
+                        energy += self.energy(r) / n;
+                        magnetization += std::abs(self.magnetization(r));
+                    }
+                    sample(energy / ReplicaBatch::replica_count(), magnetization / ReplicaBatch::replica_count());
+                }, static_cast<int>(sweep_ct));
+            }), "replica4", side, 1, beta);
+        }
+    }
+
+    if (!options.out.empty()) {
+        std::ofstream ofs(options.out);
+        ofs << "{\n  \"context\": { \"hardware_threads\": " << std::thread::hardware_concurrency()
+            << ", \"energy_tolerance\": " << onsager.energy_tolerance
+            << ", \"magnetization_tolerance\": " << onsager.magnetization_tolerance
+            << ", \"time_limit\": " << onsager.time_limit << " },\n  \"onsager\": [\n";
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            auto const& r = results[i];
+            ofs << "    { \"engine\": \"" << r.engine << "\", \"side\": " << r.side << ", \"threads\": " << r.thread_ct
+                << ", \"beta\": " << r.beta << ", \"converged\": " << (r.converged ? "true" : "false")
+                << ", \"seconds\": " << r.seconds << ", \"sweeps\": " << r.sweep_ct << ", \"energy\": " << r.energy
+                << ", \"abs_magnetization\": " << r.abs_magnetization << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+        }
+        ofs << "  ]\n}\n";
+        if (!ofs) {
+            throw std::runtime_error("Writing " + options.out + " failed.");
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Parse a comma separated list, skipping what doesn't parse.
+ */
+template<typename T>
+std::vector<T> parse_list(std::string_view value) {
+    std::vector<T> result{};
+    while (!value.empty()) {
+        T item{};
+        auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), item);
+        if (ec == std::errc{}) {
+            result.push_back(item);
+        }
+        value.remove_prefix(std::min(value.size(), static_cast<std::size_t>(end - value.data()) + 1));
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) try {
+    Options options{};
+    std::vector<std::string_view> positional{};
+    OnsagerOptions onsager{};
+    bool compare_mode = false;
+    bool onsager_mode = false;
+    bool max_side_set = false;
+    double threshold = 5.0;
+    for (int i = 1; i < argc; ++i) {
+        auto const arg = std::string_view(argv[i]);
+        auto const value_of = [arg](std::string_view prefix) { return arg.substr(prefix.size()); };
+        if (arg == "--compare") {
+            compare_mode = true;
+        }
+        else if (arg == "--perf") {
+            options.perf = true;
+        }
+        else if (arg == "--onsager") {
+            onsager_mode = true;
+        }
+        else if (arg.starts_with("--betas=")) {
+            onsager.betas = parse_list<double>(value_of("--betas="));
+        }
+        else if (arg.starts_with("--tolerance=")) {
+            auto const value = value_of("--tolerance=");
+            auto const colon = std::min(value.find(':'), value.size());
+            std::from_chars(value.data(), value.data() + colon, onsager.energy_tolerance);
+            onsager.magnetization_tolerance = onsager.energy_tolerance;
+            if (colon < value.size()) {
+                std::from_chars(value.data() + colon + 1, value.data() + value.size(), onsager.magnetization_tolerance);
+            }
+        }
+        else if (arg.starts_with("--time-limit=")) {
+            auto const value = value_of("--time-limit=");
+            std::from_chars(value.data(), value.data() + value.size(), onsager.time_limit);
+        }
+        else if (arg.starts_with("--threshold=")) {
+            auto const value = value_of("--threshold=");
+            std::from_chars(value.data(), value.data() + value.size(), threshold);
+        }
+        else if (arg.starts_with("--out=")) {
+            options.out = value_of("--out=");
+        }
+        else if (arg.starts_with("--filter=")) {
+            options.filter = value_of("--filter=");
+        }
+        else if (arg.starts_with("--max-side=")) {
+            auto const value = value_of("--max-side=");
+            std::from_chars(value.data(), value.data() + value.size(), options.max_side);
+            max_side_set = true;
+        }
+        else if (arg.starts_with("--min-time=")) {
+            auto const value = value_of("--min-time=");
+            std::from_chars(value.data(), value.data() + value.size(), options.min_time);
+        }
+        else if (arg.starts_with("--threads=")) {
+            options.thread_cts = parse_list<unsigned>(value_of("--threads="));
+            std::erase(options.thread_cts, 0u);
+        }
+        else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (compare_mode) {
+        if (positional.size() != 2) {
+            std::cerr << "Usage: ./bench_main --compare [baseline.json] [candidate.json] (--threshold=[percent])" << '\n';
+            return EXIT_FAILURE;
+        }
+        return compare(std::string(positional[0]), std::string(positional[1]), threshold);
+    }
+
+    if (options.thread_cts.empty()) {
+        options.thread_cts = { 1, std::max(1u, std::thread::hardware_concurrency()) };
+        options.thread_cts.erase(std::unique(options.thread_cts.begin(), options.thread_cts.end()), options.thread_cts.end());
+    }
+    if (onsager_mode) {
+        if (!max_side_set) {
+            options.max_side = 128;
+        }
+        return run_onsager(options, onsager);
+    }
+    Harness harness(options);
+    for (auto const side : k_sides) {
+        if (side <= options.max_side) {
+            bench_side(harness, options, side);
+        }
+    }
+    if (options.out.empty()) {
+        harness.write(std::cout);
+    }
+    else {
+        std::ofstream ofs(options.out);
+        harness.write(ofs);
+        if (!ofs) {
+            throw std::runtime_error("Writing " + options.out + " failed.");
+        }
+    }
+    return EXIT_SUCCESS;
+}
+catch (std::string_view filename) {
+    std::cerr << "Error opening file " << filename << '\n';
+    return EXIT_FAILURE;
+}
+catch (std::exception const& e) {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,439 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "loader.hpp"
+#include "spin.hpp"
+#include "trace.hpp"
+
+/**
+ * @brief The header of one record of a checkpoint file.
+ * A checkpoint file is a full record, holding every spin, followed by incremental records holding only the blocks
+ * of spins (see BasicIsing::k_block_size) written since the record before. Every record also holds the energy,
+ * spin sum, sweep count, random engine state and recorder accumulators, so the last one is a complete state.
+ * A record is checked with its own checksum, so a record cut short by a crash is ignored and the state of the
+ * record before it is restored.
+ */
+struct CheckpointRecordHeader {
+    static constexpr char k_magic[8] = { 'I', 'S', 'I', 'N', 'G', 'C', 'K', 'P' };
+    static constexpr uint32_t k_version = 1;
+    static constexpr uint32_t k_full = 0;
+    static constexpr uint32_t k_incremental = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t payload_size;
+    // FNV-1a of the payload.
+    uint64_t payload_checksum;
+
+    static uint64_t checksum(std::string_view payload) noexcept {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (auto const ch : payload) {
+            hash = (hash ^ static_cast<unsigned char>(ch)) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+};
+
+/**
+ * @brief A checkpoint that can't be restored into the given model.
+ */
+class CheckpointError : public std::runtime_error {
+public:
+    CheckpointError(std::string_view file, std::string_view reason)
+        : std::runtime_error(std::string(file) + ": " + std::string(reason)) {}
+};
+
+namespace detail {
+
+template<typename T>
+void put(std::string& out, T const& value) {
+    out.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool get(std::string_view& in, T& value) noexcept {
+    if (in.size() < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+}
+
+/**
+ * @brief Save every recorder that has accumulators (a save() member) into one blob, in argument order.
+ */
+template<typename... Rs>
+std::string save_recorders(Rs const&... recorders) {
+    std::ostringstream oss{};
+    [[maybe_unused]] auto const save = [&oss](auto const& recorder) {
+        if constexpr (requires { recorder.save(oss); }) {
+            recorder.save(oss);
+        }
+    };
+    (save(recorders), ...);
+    return std::move(oss).str();
+}
+
+template<typename... Rs>
+bool load_recorders(std::string_view blob, Rs&... recorders) {
+    std::istringstream iss{ std::string(blob) };
+    [[maybe_unused]] auto const load = [&iss](auto& recorder) {
+        if constexpr (requires { recorder.load(iss); }) {
+            recorder.load(iss);
+        }
+    };
+    (load(recorders), ...);
+    return !iss.fail();
+}
+
+} // namespace detail
+
+/**
+ * @brief Writes checkpoints of a model in the background.
+ * save() copies the blocks of spins written since the last save (all of them the first time) and hands them to
+ * a writer thread, so a sweep loop calling it pays for the copy but never waits on the disk. If the writer falls
+ * behind, the snapshots waiting for it are merged, so at most one is ever queued.
+ * Incremental records are appended to the file; every full_every records (and on the first save) a full record
+ * replaces the file instead, through a temporary file and a rename, so the file never grows without bound and is
+ * never left without a complete state.
+ * One checkpointer per model: saving clears the model's dirty blocks.
+ */
+class Checkpointer {
+public:
+    /**
+     * @param file The checkpoint file; it is replaced on the first save.
+     * @param full_every Write a full record after this many incremental ones.
+     */
+    explicit Checkpointer(std::string file, unsigned full_every = 32)
+        : m_file(std::move(file)), m_full_every(full_every),
+          m_writer([this](std::stop_token token) { this->run(token); }) {}
+
+    Checkpointer(Checkpointer const&) = delete;
+    Checkpointer& operator =(Checkpointer const&) = delete;
+
+    /**
+     * @brief Write whatever is still queued before stopping the writer.
+     */
+    ~Checkpointer() {
+        try {
+            this->flush();
+        }
+        catch (...) {
+            // nothing to report to from a destructor.
+        }
+    }
+
+    std::string const& file() const noexcept {
+        return m_file;
+    }
+
+    /**
+     * @brief Snapshot the model and the recorders' accumulators and queue them for writing.
+     * @param model A BasicIsing; its dirty blocks are cleared.
+     * @param recorders Recorders to save along; those without accumulators are skipped.
+     */
+    template<typename Model, typename... Rs>
+    void save(Model& model, Rs const&... recorders) {
+        using SpinT = typename decltype(model.spins())::value_type;
+        TraceScope trace("checkpoint snapshot");
+        {
+            std::scoped_lock lock(m_mutex);
+            this->rethrow();
+        }
+        Snapshot snapshot{};
+        auto const spins = model.spins();
+        // a model rebuilt in place keeps its address but not its graph, so the graph and size are compared too.
+        snapshot.full = m_model != &model || m_graph != model.targets().data() || m_node_ct != spins.size()
+                     || m_record_ct % (m_full_every + 1) == 0;
+        snapshot.node_count = spins.size();
+        snapshot.entry_count = model.targets().size();
+        snapshot.spin_size = sizeof(SpinT);
+        snapshot.block_size = Model::k_block_size;
+        snapshot.sweep_ct = model.sweep_count();
+        snapshot.energy = model.energy();
+        snapshot.sum = model.spin_sum();
+        snapshot.rng = model.rng().state();
+        for (std::size_t block = 0; block < model.block_count(); ++block) {
+            if (snapshot.full || model.dirty(block)) {
+                auto const part = spins.subspan(block * Model::k_block_size).first(
+                    std::min<std::size_t>(Model::k_block_size, spins.size() - block * Model::k_block_size));
+                snapshot.blocks[block].assign(reinterpret_cast<char const*>(part.data()), part.size_bytes());
+            }
+        }
+        snapshot.recorders = detail::save_recorders(recorders...);
+        model.clear_dirty();
+        m_model = &model;
+        m_graph = model.targets().data();
+        m_node_ct = spins.size();
+        ++m_record_ct;
+
+        {
+            std::scoped_lock lock(m_mutex);
+            if (m_pending && !snapshot.full) {
+                // the queued blocks that weren't written again are still needed.
+                snapshot.full = m_pending->full;
+                snapshot.blocks.merge(m_pending->blocks);
+            }
+            m_pending = std::move(snapshot);
+        }
+        m_ready.notify_all();
+    }
+
+    /**
+     * @brief Wait until every snapshot saved so far is in the file.
+     * @throw The writer's error, if writing failed.
+     */
+    void flush() {
+        TraceScope trace("checkpoint flush");
+        std::unique_lock lock(m_mutex);
+        m_idle.wait(lock, [this] { return !m_pending && !m_busy; });
+        this->rethrow();
+    }
+
+    /**
+     * @brief The count of records written to the file so far.
+     */
+    uint64_t records_written() const {
+        std::scoped_lock lock(m_mutex);
+        return m_written_ct;
+    }
+
+private:
+    struct Snapshot {
+        bool full{};
+        uint64_t node_count{};
+        uint64_t entry_count{};
+        uint32_t spin_size{};
+        uint32_t block_size{};
+        uint64_t sweep_ct{};
+        double energy{};
+        double sum{};
+        std::array<uint64_t, 4> rng{};
+        // block index -> raw spins of the block.
+        std::map<uint64_t, std::string> blocks;
+        std::string recorders;
+    };
+
+    /**
+     * @brief Report a failed write; the blocks of the lost record are gone, so the next record has to be full.
+     * Call with m_mutex held.
+     */
+    void rethrow() {
+        if (m_error) {
+            m_model = nullptr;
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+    void run(std::stop_token token) {
+        Tracer::instance().name_thread("checkpoint writer");
+        while (true) {
+            Snapshot snapshot{};
+            {
+                std::unique_lock lock(m_mutex);
+                m_ready.wait(lock, token, [this] { return m_pending.has_value(); });
+                if (!m_pending) {
+                    return;
+                }
+                snapshot = std::move(*m_pending);
+                m_pending.reset();
+                m_busy = true;
+            }
+            std::exception_ptr error{};
+            try {
+                TraceScope trace("write checkpoint");
+                this->write(snapshot);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::scoped_lock lock(m_mutex);
+                m_busy = false;
+                if (error) {
+                    m_error = error;
+                }
+                else {
+                    ++m_written_ct;
+                }
+            }
+            m_idle.notify_all();
+        }
+    }
+
+    void write(Snapshot const& snapshot) const {
+        std::string payload{};
+        using detail::put;
+        put(payload, snapshot.node_count);
+        put(payload, snapshot.entry_count);
+        put(payload, snapshot.spin_size);
+        put(payload, snapshot.block_size);
+        put(payload, snapshot.sweep_ct);
+        put(payload, snapshot.energy);
+        put(payload, snapshot.sum);
+        put(payload, snapshot.rng);
+        put(payload, static_cast<uint64_t>(snapshot.blocks.size()));
+        for (auto const& [block, bytes] : snapshot.blocks) {
+            put(payload, block);
+            payload += bytes;
+        }
+        put(payload, static_cast<uint64_t>(snapshot.recorders.size()));
+        payload += snapshot.recorders;
+
+        CheckpointRecordHeader header{};
+        std::memcpy(header.magic, CheckpointRecordHeader::k_magic, sizeof(header.magic));
+        header.version = CheckpointRecordHeader::k_version;
+        header.kind = snapshot.full ? CheckpointRecordHeader::k_full : CheckpointRecordHeader::k_incremental;
+        header.payload_size = payload.size();
+        header.payload_checksum = CheckpointRecordHeader::checksum(payload);
+
+        auto const target = snapshot.full ? m_file + ".tmp" : m_file;
+        std::ofstream ofs(target, std::ios::binary | (snapshot.full ? std::ios::trunc : std::ios::app));
+        if (!ofs) {
+            throw CheckpointError(target, "can't be opened for writing");
+        }
+        ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        ofs.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        ofs.close();
+        if (!ofs) {
+            throw CheckpointError(target, "write failed");
+        }
+        if (snapshot.full) {
+            std::filesystem::rename(target, m_file);
+        }
+    }
+
+    std::string m_file;
+    unsigned m_full_every;
+    // the model, graph and size of the last save and the count of records saved; only the saving thread uses them.
+    void const* m_model = nullptr;
+    void const* m_graph = nullptr;
+    std::size_t m_node_ct{};
+    uint64_t m_record_ct{};
+
+    mutable std::mutex m_mutex;
+    std::condition_variable_any m_ready;
+    std::condition_variable m_idle;
+    std::optional<Snapshot> m_pending;
+    bool m_busy = false;
+    uint64_t m_written_ct{};
+    std::exception_ptr m_error;
+    // declared last, so the thread starts after everything it uses is constructed.
+    std::jthread m_writer;
+};
+
+/**
+ * @brief Restore a model and its recorders from a checkpoint file.
+ * The model must have the graph the checkpoint was saved from (same nodes, bonds and internal order), e.g. built
+ * again from the same files; its spins, energy, spin sum, sweep count and random engine state are overwritten, so
+ * the following sweeps continue the saved run exactly. The records are replayed into a copy first, so if any of
+ * them doesn't fit the model, neither the model nor the recorders are changed.
+ * @param recorders The recorders saved along, in the same order; their accumulators are replaced.
+ * @return The sweep count of the restored state.
+ * @throw The file name if it can't be opened, CheckpointError if it holds no complete state for this model.
+ */
+template<typename Model, typename... Rs>
+uint64_t restore_checkpoint(std::string_view file, Model& model, Rs&... recorders) {
+    using SpinT = typename decltype(model.spins())::value_type;
+    auto const mapped = MappedFile(file);
+    auto data = mapped.view();
+
+    // the replayed state, given to the model only once every record checked out.
+    auto const current = model.spins();
+    std::vector<SpinT> spins(current.begin(), current.end());
+    std::string_view last{};
+    bool restored = false;
+    uint64_t sweep_ct{};
+    double energy{}, sum{};
+    std::array<uint64_t, 4> rng{};
+    while (data.size() >= sizeof(CheckpointRecordHeader)) {
+        CheckpointRecordHeader header{};
+        std::memcpy(&header, data.data(), sizeof(header));
+        auto const valid = std::memcmp(header.magic, CheckpointRecordHeader::k_magic, sizeof(header.magic)) == 0
+                        && header.version == CheckpointRecordHeader::k_version
+                        && header.payload_size <= data.size() - sizeof(header);
+        if (!valid) {
+            break;
+        }
+        auto payload = data.substr(sizeof(header), header.payload_size);
+        if (CheckpointRecordHeader::checksum(payload) != header.payload_checksum) {
+            break;
+        }
+        if (!restored && header.kind != CheckpointRecordHeader::k_full) {
+            throw CheckpointError(file, "doesn't start with a full record");
+        }
+        data.remove_prefix(sizeof(header) + header.payload_size);
+
+        using detail::get;
+        uint64_t node_ct{}, entry_ct{}, block_ct{};
+        uint32_t spin_size{}, block_size{};
+        get(payload, node_ct);
+        get(payload, entry_ct);
+        get(payload, spin_size);
+        get(payload, block_size);
+        get(payload, sweep_ct);
+        get(payload, energy);
+        get(payload, sum);
+        get(payload, rng);
+        if (!get(payload, block_ct)) {
+            throw CheckpointError(file, "malformed record");
+        }
+        if (node_ct != static_cast<uint64_t>(model.size()) || entry_ct != model.targets().size()) {
+            throw CheckpointError(file, "saved from a model with another graph");
+        }
+        if (spin_size != sizeof(SpinT) || block_size != static_cast<uint32_t>(Model::k_block_size)) {
+            throw CheckpointError(file, "saved with another spin type or block size");
+        }
+        for (uint64_t b = 0; b < block_ct; ++b) {
+            uint64_t block{};
+            if (!get(payload, block) || block >= model.block_count()) {
+                throw CheckpointError(file, "malformed record");
+            }
+            auto const first = block * block_size;
+            auto const count = std::min<uint64_t>(block_size, node_ct - first);
+            if (payload.size() < count * sizeof(SpinT)) {
+                throw CheckpointError(file, "malformed record");
+            }
+            std::memcpy(spins.data() + first, payload.data(), count * sizeof(SpinT));
+            payload.remove_prefix(count * sizeof(SpinT));
+        }
+        uint64_t recorder_size{};
+        if (!get(payload, recorder_size) || recorder_size > payload.size()) {
+            throw CheckpointError(file, "malformed record");
+        }
+        last = payload.substr(0, recorder_size);
+        restored = true;
+    }
+    if (!restored) {
+        throw CheckpointError(file, "no complete checkpoint");
+    }
+    auto loaded = std::tuple<Rs...>(recorders...);
+    if (!std::apply([last](auto&... copies) { return detail::load_recorders(last, copies...); }, loaded)) {
+        throw CheckpointError(file, "the recorders don't match the saved ones");
+    }
+
+    model.assign_spins(0, spins);
+    model.restore(static_cast<decltype(model.energy())>(energy), sum, sweep_ct);
+    model.rng().state(rng);
+    std::tie(recorders...) = std::move(loaded);
+    return sweep_ct;
+}
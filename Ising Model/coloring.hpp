@@ -0,0 +1,245 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ising_model.hpp"
+#include "pool.hpp"
+
+/**
+ * @brief Greedy distance-1 coloring: every node takes the smallest color not used by its neighbors.
+ * Nodes are visited in decreasing degree (Welsh-Powell), which tends to need fewer colors.
+ * @param n The count of nodes.
+ * @param neighbors A callable mapping a 0-indexed node to a range of (neighbor, coupling) pairs.
+ * @return colors[i] is the color of node i, counted from 0.
+ */
+template<typename NeighborsF>
+std::vector<int> greedy_coloring(node_t n, NeighborsF&& neighbors) {
+    std::vector<node_t> order(n);
+    std::iota(order.begin(), order.end(), node_t{});
+    std::stable_sort(order.begin(), order.end(), [&neighbors](node_t a, node_t b) {
+        return std::ranges::distance(neighbors(a)) > std::ranges::distance(neighbors(b));
+    });
+
+    std::vector<int> colors(n, -1);
+    // used[c] == i marks color c as taken by a neighbor of i.
+    std::vector<node_t> used{};
+    for (auto const i : order) {
+        for (auto const& [j, e] : neighbors(i)) {
+            auto const c = colors[j];
+            if (c >= 0) {
+                if (static_cast<std::size_t>(c) >= used.size()) {
+                    used.resize(c + 1, -1);
+                }
+                used[c] = i;
+            }
+        }
+        int c{};
+        while (static_cast<std::size_t>(c) < used.size() && used[c] == i) {
+            ++c;
+        }
+        colors[i] = c;
+    }
+    return colors;
+}
+
+/**
+ * @brief Parallel Metropolis for arbitrary graphs.
+ * The graph is colored once so that no two neighbors share a color, and the model is reordered so every color
+ * class is a contiguous range of nodes. A sweep updates the classes one after another; within a class no two
+ * nodes interact, so the class is split into chunks updated concurrently on the ThreadPool. Every single-spin update
+ * is an ordinary Metropolis step, so detailed balance holds as in the sequential sweep.
+ * Each chunk draws from its own stream, so a run is reproducible for a given seed and thread count.
+ *
+ * @tparam SpinT Enumeration type of spin; see spin.hpp.
+ * @tparam EnergyT Energy type; usually double.
+ * @tparam FieldT Field type; usually double.
+ */
+template<typename SpinT, typename EnergyT, typename FieldT>
+class BasicColoredMetropolis {
+public:
+    using Model = BasicIsing<SpinT, EnergyT, FieldT>;
+
+    /**
+     * @brief Color the model's graph and lay the color classes out contiguously.
+     * @param model The model to drive; it is reordered (see BasicIsing::reorder) but keeps its node labels.
+     * @param thread_ct The count of chunks a class is split into, at most updated at once; 0 means one per hardware
+     * thread.
+     * @param seed The seed of the first chunk's stream; the others are jumped ahead from it.
+     */
+    explicit BasicColoredMetropolis(Model& model, unsigned thread_ct = 0, uint64_t seed = std::random_device{}())
+        : m_model(&model), m_thread_ct(thread_ct ? thread_ct : std::max(1u, std::thread::hardware_concurrency())) {
+
+        auto const n = model.size();
+        auto const neighbors = [&model](node_t i) { return model.neighbors(i); };
+        auto const colors = greedy_coloring(n, neighbors);
+
+        std::vector<node_t> order(n);
+        std::iota(order.begin(), order.end(), node_t{});
+        std::stable_sort(order.begin(), order.end(), [&colors](node_t a, node_t b) { return colors[a] < colors[b]; });
+        model.reorder(order);
+
+        auto const color_ct = n ? *std::max_element(colors.cbegin(), colors.cend()) + 1 : 0;
+        m_class_offsets.assign(color_ct + 1, 0);
+        for (auto const c : colors) {
+            ++m_class_offsets[c + 1];
+        }
+        std::partial_sum(m_class_offsets.cbegin(), m_class_offsets.cend(), m_class_offsets.begin());
+
+        rng_t rng(seed);
+        m_rngs.reserve(m_thread_ct);
+        for (unsigned t = 0; t < m_thread_ct; ++t) {
+            m_rngs.push_back(rng);
+            rng.jump();
+        }
+    }
+
+    int color_count() const noexcept {
+        return static_cast<int>(m_class_offsets.size()) - 1;
+    }
+
+    unsigned thread_count() const noexcept {
+        return m_thread_ct;
+    }
+
+    /**
+     * @brief The range [begin, end) of nodes having color c.
+     */
+    std::pair<node_t, node_t> color_class(int c) const noexcept {
+        return { m_class_offsets[c], m_class_offsets[c + 1] };
+    }
+
+    /**
+     * @brief The load balance of a class: the largest share of a thread over the average share (1 is perfect).
+     */
+    double load_balance(int c) const noexcept {
+        auto const [begin, end] = this->color_class(c);
+        auto const size = end - begin;
+        if (size == 0) {
+            return 1.0;
+        }
+        auto const largest = (size + m_thread_ct - 1) / m_thread_ct;
+        return largest / (static_cast<double>(size) / m_thread_ct);
+    }
+
+    /**
+     * @brief Print the count of colors, the size of every class and how evenly it splits among the threads.
+     */
+    void report(std::ostream& os = std::cout) const {
+        os << "Colors: " << this->color_count() << ", threads: " << m_thread_ct << '\n';
+        for (int c = 0; c < this->color_count(); ++c) {
+            auto const [begin, end] = this->color_class(c);
+            os << "  class " << std::setw(3) << std::left << c
+               << " nodes: " << std::setw(10) << std::left << end - begin
+               << " balance: " << this->load_balance(c) << '\n';
+        }
+    }
+
+    /**
+     * @brief Stablize the system by performing several sweeps first.
+     */
+    void stablize() {
+        auto const k_stable_sweep_ct = 10;
+        this->markov_chain_monte_carlo(Model::pass, k_stable_sweep_ct);
+    }
+
+    /**
+     * @brief Perform Metropolis sweeps, one color class at a time, each class in parallel on the ThreadPool.
+     * A class is joined before the next starts, which is what keeps neighbors from updating at the same time.
+     * @tparam F A callback type.
+     * @param callback Moniter the model every sweep; it runs on the calling thread between the classes. If it has
+     * stop_requested(), the run ends after the first sweep it returns true for.
+     * @param sweep_limit The count of sweeps.
+     */
+    template<typename F>
+    void markov_chain_monte_carlo(F&& callback, int sweep_limit = 1000) {
+        constexpr bool k_can_stop = requires { { callback.stop_requested() } -> std::convertible_to<bool>; };
+        // g_beta is the calling thread's; the chunks may run on any thread.
+        auto const beta = g_beta;
+        auto& pool = ThreadPool::instance();
+        std::vector<Delta> deltas(m_thread_ct);
+        uint64_t accepted{};
+        uint64_t other_cpu_ns{};
+        // the calling thread's CPU time is in the sweep's mark, so only the other threads count theirs.
+        auto const caller = std::this_thread::get_id();
+
+        // chunk t of class c, whichever thread runs it, draws from stream t, so the run stays reproducible.
+        auto const update = [&, this](int c, std::size_t first, std::size_t last) {
+            TraceScope trace("color class");
+            auto const other = Telemetry::k_enabled && std::this_thread::get_id() != caller;
+            auto const cpu_ns = other ? Telemetry::thread_cpu_ns() : 0;
+            for (auto t = first; t < last; ++t) {
+                auto& rng = m_rngs[t];
+                auto& delta = deltas[t];
+                auto const [begin, end] = this->chunk(c, static_cast<unsigned>(t));
+                for (auto n = begin; n < end; ++n) {
+                    auto const energy = m_model->flip_delta(n);
+                    if (energy <= 0 || std::exp(-beta * energy) > rng.uniform()) {
+                        delta.sum += m_model->flip_uncommitted(n);
+                        delta.energy += energy;
+                        if constexpr (Telemetry::k_enabled) {
+                            ++delta.accepted;
+                        }
+                    }
+                }
+            }
+            if (other) {
+                deltas[first].cpu_ns += Telemetry::thread_cpu_ns() - cpu_ns;
+            }
+        };
+
+        for (int sweep = 0; sweep < sweep_limit; ++sweep) {
+            auto const mark = Telemetry::start();
+            for (int c = 0; c < this->color_count(); ++c) {
+                pool.parallel_for(0, m_thread_ct, 1, [&update, c](std::size_t first, std::size_t last) {
+                    update(c, first, last);
+                });
+                for (auto& d : deltas) {
+                    m_model->commit(d.energy, d.sum);
+                    accepted += d.accepted;
+                    other_cpu_ns += d.cpu_ns;
+                    d = {};
+                }
+            }
+            m_model->telemetry().end_sweep(mark, m_model->size(), std::exchange(accepted, 0), std::exchange(other_cpu_ns, 0));
+            TraceScope callback_trace("callback");
+            callback(*m_model);
+            if constexpr (k_can_stop) {
+                if (callback.stop_requested()) {
+                    break;
+                }
+            }
+        }
+    }
+
+private:
+    struct alignas(64) Delta {
+        EnergyT energy{};
+        double sum{};
+        uint64_t accepted{};
+        // CPU time of the chunks run on threads other than the calling one.
+        uint64_t cpu_ns{};
+    };
+
+    /**
+     * @brief The part of class c updated by thread t.
+     */
+    std::pair<node_t, node_t> chunk(int c, unsigned t) const noexcept {
+        auto const [begin, end] = this->color_class(c);
+        auto const size = static_cast<int64_t>(end - begin);
+        return { static_cast<node_t>(begin + size * t / m_thread_ct), static_cast<node_t>(begin + size * (t + 1) / m_thread_ct) };
+    }
+
+    Model* m_model;
+    unsigned m_thread_ct;
+    std::vector<node_t> m_class_offsets;
+    std::vector<rng_t> m_rngs;
+};
+
+using ColoredMetropolis = BasicColoredMetropolis<spin_t, energy_t, field_t>;
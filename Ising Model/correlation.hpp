@@ -0,0 +1,352 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "pool.hpp"
+#include "spin.hpp"
+#include "trace.hpp"
+
+/**
+ * @brief A complex discrete Fourier transform of a fixed size.
+ * Powers of two use an iterative radix-2 transform with precomputed twiddles; other sizes go through Bluestein's
+ * chirp-z algorithm, which turns the transform into a power-of-two convolution. The plan is read-only, so
+ * several threads may share it, each with its own scratch buffer.
+ */
+class Fft {
+public:
+    using complex_t = std::complex<double>;
+
+    explicit Fft(std::size_t n)
+        : m_n(n), m_size(std::bit_ceil(n)) {
+        if (n == 0) {
+            throw std::invalid_argument("An FFT needs at least one point.");
+        }
+        if (m_size != n) {
+            m_size = std::bit_ceil(2 * n - 1);
+        }
+        m_twiddles.resize(m_size / 2);
+        for (std::size_t k = 0; k < m_size / 2; ++k) {
+            m_twiddles[k] = std::polar(1.0, -2.0 * std::numbers::pi * k / m_size);
+        }
+        if (m_size != n) {
+            // w_k = exp(-i pi k^2 / n); k^2 is taken mod 2n so the angle stays accurate for large k.
+            m_chirp.resize(n);
+            for (std::size_t k = 0; k < n; ++k) {
+                auto const k2 = static_cast<uint64_t>(k) * k % (2 * n);
+                m_chirp[k] = std::polar(1.0, -std::numbers::pi * static_cast<double>(k2) / n);
+            }
+            m_kernel.assign(m_size, {});
+            for (std::size_t k = 0; k < n; ++k) {
+                m_kernel[k] = std::conj(m_chirp[k]);
+                if (k > 0) {
+                    m_kernel[m_size - k] = std::conj(m_chirp[k]);
+                }
+            }
+            this->radix2(m_kernel, false);
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return m_n;
+    }
+
+    /**
+     * @brief X_k = sum_j x_j exp(-2 pi i j k / n), in place.
+     * @param scratch Only used for sizes other than powers of two.
+     */
+    void forward(std::span<complex_t> data, std::vector<complex_t>& scratch) const {
+        this->transform(data, scratch, false);
+    }
+
+    /**
+     * @brief x_j = sum_k X_k exp(+2 pi i j k / n), in place and without the 1/n.
+     */
+    void inverse(std::span<complex_t> data, std::vector<complex_t>& scratch) const {
+        this->transform(data, scratch, true);
+    }
+
+private:
+    void transform(std::span<complex_t> data, std::vector<complex_t>& scratch, bool inverse) const {
+        if (m_size == m_n) {
+            this->radix2(data, inverse);
+            return;
+        }
+        // the inverse is the forward transform conjugated on both sides.
+        scratch.assign(m_size, {});
+        for (std::size_t k = 0; k < m_n; ++k) {
+            scratch[k] = (inverse ? std::conj(data[k]) : data[k]) * m_chirp[k];
+        }
+        this->radix2(scratch, false);
+        for (std::size_t k = 0; k < m_size; ++k) {
+            scratch[k] *= m_kernel[k];
+        }
+        this->radix2(scratch, true);
+        auto const scale = 1.0 / m_size;
+        for (std::size_t k = 0; k < m_n; ++k) {
+            auto const value = scratch[k] * m_chirp[k] * scale;
+            data[k] = inverse ? std::conj(value) : value;
+        }
+    }
+
+    void radix2(std::span<complex_t> data, bool inverse) const {
+        auto const n = data.size();
+        for (std::size_t i = 1, j = 0; i < n; ++i) {
+            auto bit = n >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+                std::swap(data[i], data[j]);
+            }
+        }
+        for (std::size_t half = 1; half < n; half *= 2) {
+            auto const stride = m_size / (2 * half);
+            for (std::size_t start = 0; start < n; start += 2 * half) {
+                for (std::size_t k = 0; k < half; ++k) {
+                    auto const w = inverse ? std::conj(m_twiddles[k * stride]) : m_twiddles[k * stride];
+                    auto const t = w * data[start + k + half];
+                    data[start + k + half] = data[start + k] - t;
+                    data[start + k] += t;
+                }
+            }
+        }
+    }
+
+    std::size_t m_n;
+    // the size of the radix-2 transforms: n itself, or Bluestein's convolution size.
+    std::size_t m_size;
+    std::vector<complex_t> m_twiddles;
+    std::vector<complex_t> m_chirp;
+    // the transformed chirp filter of Bluestein's convolution.
+    std::vector<complex_t> m_kernel;
+};
+
+/**
+ * @brief A recorder of the two-point correlation function G(r) = <s_x s_{x+r}>, the structure factor
+ * S(k) = <|sum_x s_x exp(-i k x)|^2> / N and the second-moment correlation length of a row_ct x col_ct lattice
+ * whose original node r * col_ct + c is the site (r, c), like from_grid.
+ *
+ * Every interval-th call transforms the configuration with a real-to-complex 2D FFT (two real rows packed into
+ * one complex transform, then the columns) and adds its power spectrum to a running sum; G is the inverse
+ * transform of the averaged spectrum, computed on demand, so a measurement costs O(N log N) instead of the
+ * O(N^2) pair loop. Both passes are split among threads.
+ * For a periodic lattice the transform has the lattice's size. For open boundaries the configuration is padded
+ * with zeros to twice the size, which keeps pairs from wrapping around, and G(r) is divided by the count of pairs
+ * at that separation; this takes four times the memory.
+ */
+class CorrelationRecorder {
+public:
+    using complex_t = Fft::complex_t;
+
+    /**
+     * @param interval Measure every interval-th call, e.g. every interval-th sweep.
+     * @param periodic Whether the lattice wraps around.
+     * @param thread_ct The count of parts a transform is split into on the ThreadPool; 0 means one per hardware thread.
+     */
+    CorrelationRecorder(node_t row_ct, node_t col_ct, int interval = 1, bool periodic = false, unsigned thread_ct = 0)
+        : m_row_ct(row_ct), m_col_ct(col_ct), m_periodic(periodic), m_interval(std::max(interval, 1)),
+          m_thread_ct(thread_ct ? thread_ct : std::max(1u, std::thread::hardware_concurrency())),
+          m_rows(periodic ? row_ct : std::bit_ceil(2 * static_cast<std::size_t>(row_ct) - 1)),
+          m_cols(periodic ? col_ct : std::bit_ceil(2 * static_cast<std::size_t>(col_ct) - 1)),
+          m_half_cols(m_cols / 2 + 1), m_row_fft(m_cols), m_col_fft(m_rows),
+          m_power(m_rows * m_half_cols, 0.0) {
+        if (row_ct <= 0 || col_ct <= 0) {
+            throw std::invalid_argument("The lattice needs at least one row and one column.");
+        }
+    }
+
+    template<typename ModelT>
+    void operator ()(ModelT const& self) const {
+        if (m_call_ct++ % m_interval != 0) {
+            return;
+        }
+        TraceScope trace("correlation");
+        if (static_cast<int64_t>(self.size()) != static_cast<int64_t>(m_row_ct) * m_col_ct) {
+            throw std::invalid_argument("The model isn't a lattice of this shape.");
+        }
+        using STraits = SpinTraits<decltype(self.spin(0))>;
+        m_spectrum.assign(m_rows * m_half_cols, {});
+
+        // rows: rows 2p and 2p + 1 go in as the real and imaginary parts of one transform.
+        this->parallel(static_cast<std::size_t>(m_row_ct + 1) / 2, [&](std::size_t begin, std::size_t end) {
+            std::vector<complex_t> line(m_cols), scratch{};
+            for (auto pair = begin; pair < end; ++pair) {
+                auto const r = static_cast<node_t>(2 * pair);
+                std::fill(line.begin(), line.end(), complex_t{});
+                for (node_t c = 0; c < m_col_ct; ++c) {
+                    auto const a = STraits::value_of(self.spin(self.index_of(r * m_col_ct + c)));
+                    auto const b = r + 1 < m_row_ct ? STraits::value_of(self.spin(self.index_of((r + 1) * m_col_ct + c))) : 0;
+                    line[c] = complex_t(a, b);
+                }
+                m_row_fft.forward(line, scratch);
+                for (std::size_t k = 0; k < m_half_cols; ++k) {
+                    auto const z = line[k];
+                    auto const mirror = std::conj(line[(m_cols - k) % m_cols]);
+                    m_spectrum[r * m_half_cols + k] = (z + mirror) * 0.5;
+                    if (r + 1 < m_row_ct) {
+                        m_spectrum[(r + 1) * m_half_cols + k] = (z - mirror) * complex_t(0.0, -0.5);
+                    }
+                }
+            }
+        });
+        // columns, then the power spectrum is added up.
+        this->parallel(m_half_cols, [&](std::size_t begin, std::size_t end) {
+            std::vector<complex_t> line(m_rows), scratch{};
+            for (auto k = begin; k < end; ++k) {
+                for (std::size_t r = 0; r < m_rows; ++r) {
+                    line[r] = m_spectrum[r * m_half_cols + k];
+                }
+                m_col_fft.forward(line, scratch);
+                for (std::size_t r = 0; r < m_rows; ++r) {
+                    m_power[r * m_half_cols + k] += std::norm(line[r]);
+                }
+            }
+        });
+        ++m_sample_ct;
+        m_correlation.clear();
+    }
+
+    uint64_t sample_count() const noexcept {
+        return m_sample_ct;
+    }
+
+    /**
+     * @brief The averaged structure factor at k = 2 pi (kr / rows, kc / cols), where rows and cols are the sizes
+     * of the transform (the lattice's, or the padded ones for open boundaries).
+     */
+    double structure_factor(std::size_t kr, std::size_t kc) const {
+        kr %= m_rows;
+        kc %= m_cols;
+        if (kc >= m_half_cols) {
+            // S(k) = S(-k) for a real configuration.
+            kr = (m_rows - kr) % m_rows;
+            kc = m_cols - kc;
+        }
+        return m_sample_ct ? m_power[kr * m_half_cols + kc] / m_sample_ct / this->site_count() : 0.0;
+    }
+
+    /**
+     * @brief The averaged correlation G(dr, dc) for |dr| < rows and |dc| < cols.
+     */
+    double correlation(node_t dr, node_t dc) const {
+        if (m_correlation.empty()) {
+            this->invert();
+        }
+        auto const r = static_cast<std::size_t>((dr % static_cast<int64_t>(m_rows) + m_rows) % m_rows);
+        auto const c = static_cast<std::size_t>((dc % static_cast<int64_t>(m_cols) + m_cols) % m_cols);
+        auto const pairs = m_periodic ? this->site_count()
+                                      : static_cast<double>(m_row_ct - std::abs(dr)) * (m_col_ct - std::abs(dc));
+        return pairs > 0 ? m_correlation[r * m_cols + c] / pairs : 0.0;
+    }
+
+    /**
+     * @brief G(r) along the axes, averaged over the two directions, for r up to half the shorter side.
+     */
+    std::vector<double> radial_correlation() const {
+        std::vector<double> result{};
+        for (node_t r = 0; r <= std::min(m_row_ct, m_col_ct) / 2; ++r) {
+            result.push_back((this->correlation(r, 0) + this->correlation(0, r)) / 2);
+        }
+        return result;
+    }
+
+    /**
+     * @brief The second-moment correlation length, xi = sqrt(S(0) / S(k_min) - 1) / (2 sin(k_min / 2)), with
+     * k_min the smallest nonzero wave vector along each axis (averaged over the two).
+     */
+    double correlation_length() const {
+        auto const s0 = this->structure_factor(0, 0);
+        auto const along = [s0](double s, std::size_t size) {
+            auto const ratio = s > 0.0 ? s0 / s - 1.0 : 0.0;
+            return ratio > 0.0 ? std::sqrt(ratio) / (2 * std::sin(std::numbers::pi / size)) : 0.0;
+        };
+        return (along(this->structure_factor(0, 1), m_cols) + along(this->structure_factor(1, 0), m_rows)) / 2;
+    }
+
+    void reset() {
+        std::fill(m_power.begin(), m_power.end(), 0.0);
+        m_correlation.clear();
+        m_sample_ct = 0;
+        m_call_ct = 0;
+    }
+
+private:
+    double site_count() const noexcept {
+        return static_cast<double>(m_row_ct) * m_col_ct;
+    }
+
+    /**
+     * @brief Split [0, count) into about one contiguous range per thread and run f on each, on the ThreadPool.
+     */
+    template<typename F>
+    void parallel(std::size_t count, F const& f) const {
+        auto const grain = (count + m_thread_ct - 1) / m_thread_ct;
+        ThreadPool::instance().parallel_for(0, count, grain, [&f](std::size_t begin, std::size_t end) {
+            TraceScope trace("correlation task");
+            f(begin, end);
+        });
+    }
+
+    /**
+     * @brief Transform the summed power spectrum back into the summed correlations, by columns then rows.
+     */
+    void invert() const {
+        std::vector<complex_t> half(m_rows * m_half_cols);
+        this->parallel(m_half_cols, [&](std::size_t begin, std::size_t end) {
+            std::vector<complex_t> line(m_rows), scratch{};
+            for (auto k = begin; k < end; ++k) {
+                for (std::size_t r = 0; r < m_rows; ++r) {
+                    line[r] = m_power[r * m_half_cols + k];
+                }
+                m_col_fft.inverse(line, scratch);
+                for (std::size_t r = 0; r < m_rows; ++r) {
+                    half[r * m_half_cols + k] = line[r];
+                }
+            }
+        });
+        m_correlation.assign(m_rows * m_cols, 0.0);
+        auto const scale = 1.0 / (static_cast<double>(m_rows) * m_cols * std::max<uint64_t>(m_sample_ct, 1));
+        this->parallel(m_rows, [&](std::size_t begin, std::size_t end) {
+            std::vector<complex_t> line(m_cols), scratch{};
+            for (auto r = begin; r < end; ++r) {
+                // every row of the real result has a Hermitian spectrum, which gives the other half.
+                for (std::size_t k = 0; k < m_cols; ++k) {
+                    line[k] = k < m_half_cols ? half[r * m_half_cols + k]
+                                              : std::conj(half[r * m_half_cols + m_cols - k]);
+                }
+                m_row_fft.inverse(line, scratch);
+                for (std::size_t c = 0; c < m_cols; ++c) {
+                    m_correlation[r * m_cols + c] = line[c].real() * scale;
+                }
+            }
+        });
+    }
+
+    node_t m_row_ct;
+    node_t m_col_ct;
+    bool m_periodic;
+    int m_interval;
+    unsigned m_thread_ct;
+    // the size of the transform.
+    std::size_t m_rows;
+    std::size_t m_cols;
+    std::size_t m_half_cols;
+    Fft m_row_fft;
+    Fft m_col_fft;
+    mutable std::vector<complex_t> m_spectrum;
+    // the sum of |F(k)|^2 over the samples, over the non-negative column frequencies.
+    mutable std::vector<double> m_power;
+    // the summed correlations, G times the count of pairs; empty until asked for.
+    mutable std::vector<double> m_correlation;
+    mutable uint64_t m_sample_ct{};
+    mutable uint64_t m_call_ct{};
+};
@@ -0,0 +1,380 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern thread_local double g_beta;
+
+/**
+ * @brief A recorder accumulating the energy histogram of a run at one temperature, together with the
+ * microcanonical sums of the magnetization in every energy bin, and a histogram of the magnetization.
+ * This is what reweighting needs to extrapolate every observable to nearby temperatures (see Reweighting).
+ *
+ * Energy bins have a width w and bin i covers [i w, (i + 1) w), so histograms with widths differing by powers of
+ * two line up. With a fixed width the histogram grows to cover whatever energies come; with an adaptive one
+ * (width 0) the bins start narrow and are merged in pairs whenever they'd exceed max_bins, so the memory is
+ * bounded and the resolution adapts to the spread of the energy.
+ */
+class EnergyHistogram {
+public:
+    struct Bin {
+        uint64_t count{};
+        double energy_sum{};
+        double energy_sq_sum{};
+        double abs_mag_sum{};
+        double mag_sq_sum{};
+        double mag_4_sum{};
+
+        Bin& operator +=(Bin const& other) noexcept {
+            count += other.count;
+            energy_sum += other.energy_sum;
+            energy_sq_sum += other.energy_sq_sum;
+            abs_mag_sum += other.abs_mag_sum;
+            mag_sq_sum += other.mag_sq_sum;
+            mag_4_sum += other.mag_4_sum;
+            return *this;
+        }
+    };
+
+    static constexpr std::size_t k_mag_bins = 64;
+    static constexpr double k_adaptive_start = 1.0 / 1024;
+
+    /**
+     * @param width The width of an energy bin, or 0 for adaptive bins.
+     * @param max_bins The count of bins adaptive bins are kept under.
+     */
+    explicit EnergyHistogram(double beta = g_beta, double width = 0.0, std::size_t max_bins = 1024)
+        : m_beta(beta), m_width(width > 0.0 ? width : k_adaptive_start), m_adaptive(width <= 0.0),
+          m_max_bins(std::max<std::size_t>(max_bins, 2)) {}
+
+    template<typename ModelT>
+    void operator ()(ModelT const& self) const {
+        auto const energy = static_cast<double>(self.energy());
+        auto const m = self.magnetization();
+        m_size = static_cast<double>(self.size());
+
+        auto index = this->index_of(energy);
+        if (m_adaptive) {
+            // widen the bins before growing the range, so an outlying energy, e.g. while equilibrating, doesn't
+            // allocate a huge range only to merge it down again.
+            while (!m_bins.empty() && this->span_with(index) > m_max_bins) {
+                this->coarsen();
+                index = this->index_of(energy);
+            }
+        }
+        if (m_bins.empty()) {
+            m_first = index;
+            m_bins.resize(1);
+        }
+        else if (index < m_first) {
+            m_bins.insert(m_bins.begin(), static_cast<std::size_t>(m_first - index), Bin{});
+            m_first = index;
+        }
+        else if (index >= m_first + static_cast<int64_t>(m_bins.size())) {
+            m_bins.resize(static_cast<std::size_t>(index - m_first + 1));
+        }
+        auto& bin = m_bins[static_cast<std::size_t>(index - m_first)];
+        auto const m2 = m * m;
+        bin += Bin{ 1, energy, energy * energy, std::abs(m), m2, m2 * m2 };
+
+        auto const mag_bin = std::min(static_cast<std::size_t>((m + 1.0) / 2.0 * k_mag_bins), k_mag_bins - 1);
+        ++m_mag_counts[mag_bin];
+        ++m_count;
+    }
+
+    double beta() const noexcept {
+        return m_beta;
+    }
+
+    double width() const noexcept {
+        return m_width;
+    }
+
+    double size() const noexcept {
+        return m_size;
+    }
+
+    uint64_t count() const noexcept {
+        return m_count;
+    }
+
+    /**
+     * @brief The index of the first energy bin; bin k of bins() covers [(first + k) w, (first + k + 1) w).
+     */
+    int64_t first() const noexcept {
+        return m_first;
+    }
+
+    std::span<Bin const> bins() const noexcept {
+        return m_bins;
+    }
+
+    /**
+     * @brief Counts of the magnetization per spin in k_mag_bins equal bins over [-1, 1].
+     */
+    std::array<uint64_t, k_mag_bins> const& magnetization_counts() const noexcept {
+        return m_mag_counts;
+    }
+
+    /**
+     * @brief A copy with bins of a wider width, which must be this width times a power of two.
+     */
+    EnergyHistogram rebinned(double width) const {
+        auto result = *this;
+        while (result.m_width < width) {
+            result.coarsen();
+        }
+        if (result.m_width != width) {
+            throw std::invalid_argument("The energy bins of the histograms don't line up.");
+        }
+        return result;
+    }
+
+private:
+    int64_t index_of(double energy) const noexcept {
+        return static_cast<int64_t>(std::floor(energy / m_width));
+    }
+
+    /**
+     * @brief The count of bins covering both the current ones and bin index.
+     */
+    std::size_t span_with(int64_t index) const noexcept {
+        auto const last = m_first + static_cast<int64_t>(m_bins.size()) - 1;
+        return static_cast<std::size_t>(std::max(index, last) - std::min(index, m_first) + 1);
+    }
+
+    /**
+     * @brief Double the width, merging bins 2i and 2i + 1.
+     */
+    void coarsen() const {
+        // floor(i / 2), also for negative i.
+        auto const half = [](int64_t i) { return i >= 0 ? i / 2 : (i - 1) / 2; };
+        auto const first = half(m_first);
+        auto const last = half(m_first + static_cast<int64_t>(m_bins.size()) - 1);
+        std::vector<Bin> bins(static_cast<std::size_t>(last - first + 1));
+        for (std::size_t k = 0; k < m_bins.size(); ++k) {
+            bins[static_cast<std::size_t>(half(m_first + static_cast<int64_t>(k)) - first)] += m_bins[k];
+        }
+        m_bins = std::move(bins);
+        m_first = first;
+        m_width *= 2;
+    }
+
+    double m_beta;
+    mutable double m_width;
+    bool m_adaptive;
+    std::size_t m_max_bins;
+    mutable double m_size{};
+    mutable uint64_t m_count{};
+    mutable int64_t m_first{};
+    mutable std::vector<Bin> m_bins;
+    mutable std::array<uint64_t, k_mag_bins> m_mag_counts{};
+};
+
+/**
+ * @brief Thermodynamic averages at one temperature, per spin where it applies.
+ */
+struct Thermodynamics {
+    double beta;
+    double energy;
+    double specific_heat;
+    double abs_magnetization;
+    double susceptibility;
+    double binder_cumulant;
+};
+
+/**
+ * @brief Histogram reweighting: estimate the density of states from the energy histograms of one or several
+ * runs and extrapolate the averages to any temperature.
+ * With one run this is single-histogram reweighting; with several, the runs are combined by the multiple
+ * histogram method (WHAM, Ferrenberg-Swendsen), whose free energies are found by self-consistent iteration.
+ * The estimate is only trustworthy where the runs sampled the relevant energies, i.e. near their temperatures
+ * (see range()).
+ */
+class Reweighting {
+public:
+    /**
+     * @param runs Histograms of runs of the same model; their bin widths must differ by powers of two.
+     * @throw std::invalid_argument if there is nothing to reweight or the bins don't line up.
+     */
+    explicit Reweighting(std::span<EnergyHistogram const> runs) {
+        std::vector<EnergyHistogram const*> used{};
+        for (auto const& run : runs) {
+            if (run.count() > 0) {
+                used.push_back(&run);
+            }
+        }
+        if (used.empty()) {
+            throw std::invalid_argument("No histogram has any sample.");
+        }
+        double width{};
+        for (auto const* run : used) {
+            width = std::max(width, run->width());
+        }
+        m_size = used.front()->size();
+
+        // pool the runs on a common grid: H(b) and the microcanonical sums.
+        std::map<int64_t, EnergyHistogram::Bin> pooled{};
+        for (std::size_t k = 0; k < used.size(); ++k) {
+            auto const run = used[k]->rebinned(width);
+            for (std::size_t b = 0; b < run.bins().size(); ++b) {
+                auto const& bin = run.bins()[b];
+                if (bin.count > 0) {
+                    pooled[run.first() + static_cast<int64_t>(b)] += bin;
+                }
+            }
+            m_betas.push_back(used[k]->beta());
+            m_energy_sd.push_back(0.0);
+        }
+        for (auto const& [index, bin] : pooled) {
+            m_bins.push_back(bin);
+            m_energies.push_back(bin.energy_sum / bin.count);
+        }
+        for (std::size_t k = 0; k < used.size(); ++k) {
+            double sum{}, sq_sum{}, n{};
+            for (auto const& bin : used[k]->bins()) {
+                sum += bin.energy_sum;
+                sq_sum += bin.energy_sq_sum;
+                n += bin.count;
+            }
+            m_energy_sd[k] = std::sqrt(std::max(0.0, sq_sum / n - sum * sum / (n * n)));
+        }
+
+        // ln g(b) = ln H(b) - ln sum_k n_k exp(f_k - beta_k E_b),  f_k = -ln sum_b g(b) exp(-beta_k E_b).
+        std::vector<double> log_n{};
+        for (auto const* run : used) {
+            log_n.push_back(std::log(static_cast<double>(run->count())));
+        }
+        std::vector<double> f(used.size(), 0.0);
+        m_log_dos.resize(m_bins.size());
+        std::vector<double> terms{};
+        for (int iteration = 0; iteration < k_max_iterations; ++iteration) {
+            for (std::size_t b = 0; b < m_bins.size(); ++b) {
+                terms.clear();
+                for (std::size_t k = 0; k < used.size(); ++k) {
+                    terms.push_back(log_n[k] + f[k] - m_betas[k] * m_energies[b]);
+                }
+                m_log_dos[b] = std::log(static_cast<double>(m_bins[b].count)) - log_sum_exp(terms);
+            }
+            double change{};
+            for (std::size_t k = 0; k < used.size(); ++k) {
+                terms.clear();
+                for (std::size_t b = 0; b < m_bins.size(); ++b) {
+                    terms.push_back(m_log_dos[b] - m_betas[k] * m_energies[b]);
+                }
+                auto const next = -log_sum_exp(terms);
+                change = std::max(change, std::abs(next - f[k]));
+                f[k] = next;
+            }
+            // only the differences of the f_k matter.
+            for (auto& fk : f) {
+                fk -= f[0];
+            }
+            if (used.size() == 1 || change < k_tolerance) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief The averages at a temperature.
+     */
+    Thermodynamics at(double beta) const {
+        std::vector<double> log_weights(m_bins.size());
+        for (std::size_t b = 0; b < m_bins.size(); ++b) {
+            log_weights[b] = m_log_dos[b] - beta * m_energies[b];
+        }
+        auto const log_z = log_sum_exp(log_weights);
+        double e{}, e2{}, abs_m{}, m2{}, m4{};
+        for (std::size_t b = 0; b < m_bins.size(); ++b) {
+            auto const& bin = m_bins[b];
+            // the weight of the bin over its count, which turns the bin's sums into its share of the average.
+            auto const w = std::exp(log_weights[b] - log_z) / bin.count;
+            e += w * bin.energy_sum;
+            e2 += w * bin.energy_sq_sum;
+            abs_m += w * bin.abs_mag_sum;
+            m2 += w * bin.mag_sq_sum;
+            m4 += w * bin.mag_4_sum;
+        }
+        return {
+            beta,
+            e / m_size,
+            beta * beta * (e2 - e * e) / m_size,
+            abs_m,
+            beta * m_size * (m2 - abs_m * abs_m),
+            m2 > 0.0 ? 1.0 - m4 / (3.0 * m2 * m2) : 0.0,
+        };
+    }
+
+    /**
+     * @brief The temperatures worth extrapolating to: the span of the runs, widened by 1 / sigma_E of the outer
+     * runs, beyond which the histograms hardly sample the energies that matter.
+     */
+    std::pair<double, double> range() const noexcept {
+        auto const [lo, hi] = std::minmax_element(m_betas.cbegin(), m_betas.cend());
+        auto const reach = [this](auto it) {
+            auto const sd = m_energy_sd[it - m_betas.cbegin()];
+            return sd > 0.0 ? 1.0 / sd : 0.0;
+        };
+        return { std::max(0.0, *lo - reach(lo)), *hi + reach(hi) };
+    }
+
+    std::span<double const> betas() const noexcept {
+        return m_betas;
+    }
+
+private:
+    static constexpr int k_max_iterations = 10000;
+    static constexpr double k_tolerance = 1e-10;
+
+    static double log_sum_exp(std::span<double const> terms) noexcept {
+        auto const max = *std::max_element(terms.begin(), terms.end());
+        if (!std::isfinite(max)) {
+            return max;
+        }
+        double sum{};
+        for (auto const t : terms) {
+            sum += std::exp(t - max);
+        }
+        return max + std::log(sum);
+    }
+
+    double m_size{};
+    std::vector<double> m_betas;
+    std::vector<double> m_energy_sd;
+    std::vector<EnergyHistogram::Bin> m_bins;
+    std::vector<double> m_energies;
+    std::vector<double> m_log_dos;
+};
+
+/**
+ * @brief Draw a histogram of counts as horizontal bars, merging neighboring bins down to at most max_rows rows.
+ * @param lower The lower edge of the first bin, and width the width of a bin.
+ */
+inline void draw_histogram(std::ostream& os, std::span<uint64_t const> counts, double lower, double width,
+                           std::size_t max_rows = 32, std::size_t bar_width = 60) {
+    auto const group = std::max<std::size_t>(1, (counts.size() + max_rows - 1) / max_rows);
+    std::vector<uint64_t> rows{};
+    for (std::size_t k = 0; k < counts.size(); k += group) {
+        uint64_t sum{};
+        for (std::size_t j = k; j < std::min(k + group, counts.size()); ++j) {
+            sum += counts[j];
+        }
+        rows.push_back(sum);
+    }
+    auto const max = rows.empty() ? 0 : *std::max_element(rows.cbegin(), rows.cend());
+    for (std::size_t r = 0; r < rows.size(); ++r) {
+        auto const bar = max ? static_cast<std::size_t>(static_cast<double>(rows[r]) / max * bar_width + 0.5) : 0;
+        os << std::setw(12) << std::right << lower + r * group * width << " | "
+           << std::string(bar, '#') << ' ' << rows[r] << '\n';
+    }
+}
@@ -1,16 +1,26 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <concepts>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <ranges>
+#include <span>
 #include <stdexcept>
 #include <tuple>
+#include <utility>
 #include <vector>
 
+#include "loader.hpp"
+#include "reorder.hpp"
 #include "spin.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
 
 namespace stdv = std::ranges::views;
@@ -20,8 +30,30 @@ namespace stdr = std::ranges;
 /**
  * @brief A constant related with T, the temperature value_of the system.
  * g_beta = 1/(kT), where k is the Boltzmann's constant. We'd prefer to let k = 1 (in some proper unit)
+ * It's thread_local, so models evolved in different threads can each have their own temperature; a thread
+ * starts with the initial value, not the current value of the thread that made it.
  */
-extern double g_beta;
+extern thread_local double g_beta;
+
+/**
+ * @brief Sets g_beta of the calling thread for a scope, e.g. a ThreadPool task, and restores it after, so the
+ * thread's own work goes on at its temperature.
+ */
+class ScopedBeta {
+public:
+    explicit ScopedBeta(double beta) noexcept
+        : m_saved(std::exchange(g_beta, beta)) {}
+
+    ScopedBeta(ScopedBeta const&) = delete;
+    ScopedBeta& operator =(ScopedBeta const&) = delete;
+
+    ~ScopedBeta() {
+        g_beta = m_saved;
+    }
+
+private:
+    double m_saved;
+};
 
 extern energy_t g_bond_energy;
 
@@ -38,8 +70,11 @@ public:
     using STraits = SpinTraits<SpinT>;
     using This = BasicIsing;
 
+    // The recorders only go through the public observers (energy(), state(), magnetization()), so they work on
+    // anything that looks like a model, e.g. a single replica of a ReplicaBatch (see replica.hpp).
     struct Empty {
-        auto operator ()(BasicIsing<SpinT, EnergyT, FieldT> const& self) const noexcept {
+        template<typename ModelT>
+        auto operator ()(ModelT const&) const noexcept {
             // do nothing
         }
         auto operator ()() const {
@@ -48,34 +83,61 @@ public:
     };
 
     struct EnergyRecorder {
-        auto operator ()(BasicIsing<SpinT, EnergyT, FieldT> const& self) const {
-            m_energies.push_back(self.m_energy);
+        template<typename ModelT>
+        auto operator ()(ModelT const& self) const {
+            m_energies.push_back(self.energy());
         }
         auto operator ()() const {
             auto result = std::move(m_energies);
             m_energies.clear();
             return result;
         }
+        std::span<EnergyT const> column() const noexcept {
+            return m_energies;
+        }
+        void clear() noexcept {
+            m_energies.clear();
+        }
+        void save(std::ostream& os) const {
+            write_vector(os, m_energies);
+        }
+        void load(std::istream& is) {
+            read_vector(is, m_energies);
+        }
     private:
         mutable std::vector<EnergyT> m_energies;
     };
 
     struct StateRecorder {
-        auto operator ()(BasicIsing<SpinT, EnergyT, FieldT> const& self) const {
-            m_states.push_back(self.m_state);
+        template<typename ModelT>
+        auto operator ()(ModelT const& self) const {
+            m_states.push_back(self.state());
         }
         auto operator ()() const {
             auto result = std::move(m_states);
             m_states.clear();
             return result;
         }
+        std::span<int64_t const> column() const noexcept {
+            return m_states;
+        }
+        void clear() noexcept {
+            m_states.clear();
+        }
+        void save(std::ostream& os) const {
+            write_vector(os, m_states);
+        }
+        void load(std::istream& is) {
+            read_vector(is, m_states);
+        }
     private:
         mutable std::vector<int64_t> m_states;
     };
 
     struct MagnetizationRecorder {
         using MagnetizationT = double;
-        auto operator ()(BasicIsing<SpinT, EnergyT, FieldT> const& self) const {
+        template<typename ModelT>
+        auto operator ()(ModelT const& self) const {
             m_magnetizations.push_back(self.magnetization());
         }
         auto operator ()() const {
@@ -83,6 +145,18 @@ public:
             m_magnetizations.clear();
             return result;
         }
+        std::span<double const> column() const noexcept {
+            return m_magnetizations;
+        }
+        void clear() noexcept {
+            m_magnetizations.clear();
+        }
+        void save(std::ostream& os) const {
+            write_vector(os, m_magnetizations);
+        }
+        void load(std::istream& is) {
+            read_vector(is, m_magnetizations);
+        }
 
     private:
         mutable std::vector<double> m_magnetizations;
@@ -90,19 +164,47 @@ public:
 
     template<class... Rs>
     struct Recorder : Rs... {
-        auto operator ()(BasicIsing<SpinT, EnergyT, FieldT> const& self) const {
+        template<typename ModelT>
+        auto operator ()(ModelT const& self) const {
             (Rs::operator ()(self), ...);
         }
+        /**
+         * @brief The samples of the recorders keeping one per sweep, as a ColumnView in the order of Rs.
+         * Every recorder keeps its own column, so nothing is copied; the view is valid until the next sample or clear().
+         */
         auto operator ()() const {
-            auto const tup = (Builder(ctie(Rs::operator ()())), ...).tuple();
-            auto result = transpose_t<decltype(tup)>(std::get<0>(tup).size());
-            std::apply(
-                [&result](auto const&... vs) {
-                    for (auto i = 0; i < result.size(); ++i) {
-                        result[i] = ith(i, vs...);
-                    }
-                }, tup);
-            return result;
+            return std::apply([](auto... columns) { return ColumnView(columns...); }, std::tuple_cat(column_of<Rs>()...));
+        }
+        void clear() {
+            ([this] {
+                if constexpr (requires(Rs& r) { r.clear(); }) {
+                    Rs::clear();
+                }
+            }(), ...);
+        }
+        void save(std::ostream& os) const {
+            ([this, &os] {
+                if constexpr (requires(Rs const& r) { r.save(os); }) {
+                    Rs::save(os);
+                }
+            }(), ...);
+        }
+        void load(std::istream& is) {
+            ([this, &is] {
+                if constexpr (requires(Rs& r) { r.load(is); }) {
+                    Rs::load(is);
+                }
+            }(), ...);
+        }
+    private:
+        template<class R>
+        auto column_of() const {
+            if constexpr (requires(R const& r) { r.column(); }) {
+                return std::tuple(R::column());
+            }
+            else {
+                return std::tuple<>{};
+            }
         }
     };
 
@@ -124,8 +226,27 @@ public:
     //    return R{};
     //}
 
-    static This from_grid(node_t ct, EnergyT bond_energy = 0.0) {
-        return from_grid(ct, ct, bond_energy);
+    /**
+     * @brief The count of spins per block of the dirty-block bitmap (see dirty()).
+     */
+    static constexpr node_t k_block_size = 4096;
+
+    /**
+     * @brief The graph arrays in compressed sparse row form: the neighbors of node i are the entries
+     * [offsets[i], offsets[i + 1]) of targets and couplings, and every bond appears once from each of its ends.
+     * The model only keeps spans over them, so the same arrays can as well live in a mapped file (see model_file.hpp).
+     */
+    struct Graph {
+        std::vector<FieldT> fields;
+        std::vector<uint64_t> offsets;
+        std::vector<node_t> targets;
+        std::vector<EnergyT> couplings;
+        // internal index -> original node; empty while the nodes keep their original order.
+        std::vector<node_t> labels;
+    };
+
+    static This from_grid(node_t ct, EnergyT bond_energy = 0.0, Ordering ordering = Ordering::k_none, bool periodic = false) {
+        return from_grid(ct, ct, bond_energy, ordering, periodic);
     }
 
     /**
@@ -133,51 +254,65 @@ public:
      * @param row_ct 
      * @param col_ct 
      * @param bond_energy 
+     * @param ordering How to lay the nodes out in memory; k_hilbert uses the lattice coordinates.
+     * @param periodic Whether the lattice wraps around into a torus, which removes the boundary, e.g. to compare
+     * with the exact infinite-lattice results. A side shorter than 3 doesn't wrap, since it would double its bonds.
      * @return 
     */
-    static This from_grid(node_t row_ct, node_t col_ct, EnergyT bond_energy = 0.0) {
+    static This from_grid(node_t row_ct, node_t col_ct, EnergyT bond_energy = 0.0, Ordering ordering = Ordering::k_none,
+                          bool periodic = false) {
+        TraceScope trace("from_grid");
         auto const total_ct = row_ct * col_ct;
-        std::vector<std::pair<node_t, FieldT>> spins(total_ct);
-        for (node_t i{}; auto& [n, f] : spins) {
-            n = ++i;
-            f = FieldT{};
-        }
-
-        std::vector<std::tuple<node_t, node_t, EnergyT>> bonds{};
+        auto const spins = [total_ct](auto&& sink) {
+            for (node_t i = 1; i <= total_ct; ++i) {
+                sink(i, FieldT{});
+            }
+        };
 
-        auto const right = [col_ct](node_t n) {
+        auto const wrap_cols = periodic && col_ct >= 3;
+        auto const wrap_rows = periodic && row_ct >= 3;
+        auto const right = [col_ct, wrap_cols](node_t n) {
             auto const result = n + 1;
             if (result % col_ct == 0) {
-                return -1;
+                return wrap_cols ? result - col_ct : -1;
             }
             return result;
         };
-        auto const down = [col_ct, total_ct](node_t n) {
+        auto const down = [col_ct, total_ct, wrap_rows](node_t n) {
             auto const result = n + col_ct;
             if (result >= total_ct) {
-                return -1;
+                return wrap_rows ? result - total_ct : -1;
             }
             return result;
         };
 
-        for (node_t i = 0; i < total_ct; ++i) {
-            auto const r = right(i);
-            if (r >= 0) {
-                bonds.emplace_back(i + 1, r + 1, bond_energy);
+        auto const bonds = [=](auto&& sink) {
+            for (node_t i = 0; i < total_ct; ++i) {
+                auto const r = right(i);
+                if (r >= 0) {
+                    sink(i + 1, r + 1, bond_energy);
+                }
+                auto const d = down(i);
+                if (d >= 0) {
+                    sink(i + 1, d + 1, bond_energy);
+                }
             }
-            auto const d = down(i);
-            if (d >= 0) {
-                bonds.emplace_back(i + 1, d + 1, bond_energy);
+        };
+
+        std::vector<std::pair<double, double>> coords{};
+        if (ordering == Ordering::k_hilbert) {
+            coords.reserve(total_ct);
+            for (node_t i = 0; i < total_ct; ++i) {
+                coords.emplace_back(i / col_ct, i % col_ct);
             }
         }
-
-        return { spins, bonds };
+        This result{};
+        result.build(spins, bonds, ordering, coords);
+        return result;
     }
 
     BasicIsing() noexcept
-        : m_valid(false) {}
-
-    BasicIsing(This const& other) = delete;
+        : m_energy(0.0), m_sum(0.0), m_valid(false) {}
 
     BasicIsing(This&& other) = default;
 
@@ -185,10 +320,19 @@ public:
 
     This& operator =(This&& other) = default;
 
-    BasicIsing(std::vector<std::pair<node_t, FieldT>> const& spins, std::vector<std::tuple<node_t, node_t, EnergyT>> const& bonds)
-        : m_spins(spins.size()), m_fields(spins.size()), m_neighbors(spins.size()), m_energy(0.0), m_state(0), m_valid(true) {
+    /**
+     * @brief A copy with spins and a random engine of its own, sharing the read-only graph. Copies are only made
+     * explicitly, since the spins of a model can be large.
+     */
+    This clone() const {
+        return This(*this);
+    }
+
+    BasicIsing(std::vector<std::pair<node_t, FieldT>> const& spins, std::vector<std::tuple<node_t, node_t, EnergyT>> const& bonds,
+               Ordering ordering = Ordering::k_none)
+        : m_energy(0.0), m_sum(0.0), m_valid(true) {
 
-        this->initialize(spins, bonds);
+        this->initialize(spins, bonds, ordering);
     }
 
     /**
@@ -196,53 +340,386 @@ public:
      * Note that the node are specified by 1-indexed integers in accordance with the config files.
      * @param spins The field information of the model.
      * @param bonds The bond information
+     * @param ordering An optional relabeling of the nodes for memory locality; see reorder().
+     * @param coords Node coordinates, needed by Ordering::k_hilbert only.
     */
-    void initialize(std::vector<std::pair<node_t, FieldT>> spins, std::vector<std::tuple<node_t, node_t, EnergyT>> const& bonds) {
-        auto const base = STraits::state_count();
-        
-        // make sure the spins are sorted by node number.
-        std::sort(
-            spins.begin(), spins.end(), 
-            [](auto const& p1, auto const& p2) {
-                return p1.first > p2.first ? false : p1.first < p2.first || p1.second < p2.second;
-            });
+    void initialize(std::vector<std::pair<node_t, FieldT>> const& spins, std::vector<std::tuple<node_t, node_t, EnergyT>> const& bonds,
+                    Ordering ordering = Ordering::k_none, std::vector<std::pair<double, double>> const& coords = {}) {
+        this->build(range_source(spins), range_source(bonds), ordering, coords);
+    }
+
+    /**
+     * @brief Initialize the model in two passes over its sources, so the bonds are never held in memory.
+     * The first pass counts the nodes and the degree of each, the final arrays are allocated, and the second pass
+     * fills them. A source is a callable taking a sink and feeding it every record; it must produce the same
+     * records on both calls. See file_source() and range_source() in loader.hpp, or pass a generator lambda.
+     * Nodes are 1-indexed, and the count of nodes is the largest node number among the spins and bonds.
+     * @param spins A source of (node, field) records.
+     * @param bonds A source of (node, node, energy) records.
+     * @param ordering An optional relabeling of the nodes for memory locality; see reorder().
+     * @param coords Node coordinates, needed by Ordering::k_hilbert only.
+     */
+    template<typename SpinSource, typename BondSource>
+    void build(SpinSource&& spins, BondSource&& bonds,
+               Ordering ordering = Ordering::k_none, std::vector<std::pair<double, double>> const& coords = {}) {
+        TraceScope trace("build");
+        auto graph = std::make_shared<Graph>();
+        auto& offsets = graph->offsets;
+        auto const check = [](node_t i) {
+            if (i < 1) {
+                throw std::invalid_argument("Node numbers start from 1.");
+            }
+        };
 
-        // the count of spins is the largest among their numbers.
-        auto const spin_count = std::accumulate(
-            spins.cbegin(), spins.cend(), node_t{},
-            [](auto max, auto const& pair) { return std::max(max, pair.first); });
+        // first pass: offsets[i] counts the neighbors of node i (1-indexed) for now.
+        node_t spin_count{};
+        spins([&spin_count, &check](node_t i, FieldT) {
+            check(i);
+            spin_count = std::max(spin_count, i);
+        });
+        offsets.assign(spin_count + 1, 0);
+        bonds([&offsets, &check](node_t i, node_t j, EnergyT) {
+            check(i);
+            check(j);
+            auto const max = static_cast<std::size_t>(std::max(i, j));
+            if (max >= offsets.size()) {
+                offsets.resize(max + 1, 0);
+            }
+            ++offsets[i];
+            ++offsets[j];
+        });
+        offsets.shrink_to_fit();
+        auto const n = static_cast<node_t>(offsets.size() - 1);
+        std::partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
 
-        m_spins.resize(spin_count);
-        m_fields.resize(spin_count);
-        m_neighbors.resize(spin_count);
+        // second pass: offsets[i] is the insertion point of node i, and ends up at the end of its neighbors.
+        graph->fields.assign(n, FieldT{});
+        graph->targets.resize(offsets.back());
+        graph->couplings.resize(offsets.back());
+        spins([&graph](node_t i, FieldT h) {
+            graph->fields[i - 1] = h;
+        });
+        bonds([&graph, &offsets](node_t i, node_t j, EnergyT e) {
+            --i; --j;
+            graph->targets[offsets[i]] = j;
+            graph->couplings[offsets[i]++] = e;
+            graph->targets[offsets[j]] = i;
+            graph->couplings[offsets[j]++] = e;
+        });
+        std::shift_right(offsets.begin(), offsets.end(), 1);
+        offsets[0] = 0;
 
+        this->bind(graph);
         // initialize the spins with random direction.
+        m_spins.resize(n);
+        this->randomize();
+
+        if (ordering != Ordering::k_none) {
+            this->reorder(ordering, coords);
+        }
+    }
+
+    /**
+     * @brief Relabel the nodes so that neighbors are close in memory.
+     * Only the internal layout changes: printing and state() keep using the original node numbers, and
+     * label() / index_of() translate between the two.
+     * @param ordering The ordering to compute.
+     * @param coords Node coordinates indexed by the current internal index, needed by Ordering::k_hilbert only.
+     */
+    void reorder(Ordering ordering, std::vector<std::pair<double, double>> const& coords = {}) {
+        auto const neighbors = [this](node_t i) { return this->neighbors(i); };
+        this->reorder(make_order(ordering, this->size(), neighbors, coords));
+    }
+
+    /**
+     * @brief Apply a permutation of the internal layout.
+     * @param order order[k] is the current internal index of the node to be placed at k.
+     */
+    void reorder(std::vector<node_t> const& order) {
+        auto const n = this->size();
+        if (order.size() != static_cast<std::size_t>(n)) {
+            throw std::invalid_argument("The ordering doesn't cover every node.");
+        }
+        std::vector<node_t> position(n);
+        for (node_t k = 0; k < n; ++k) {
+            position[order[k]] = k;
+        }
+
+        std::vector<SpinT> spins(n);
+        auto graph = std::make_shared<Graph>();
+        graph->fields.resize(n);
+        graph->labels.resize(n);
+        graph->offsets.assign(n + 1, 0);
+        graph->targets.reserve(m_targets.size());
+        graph->couplings.reserve(m_couplings.size());
+        std::vector<std::pair<node_t, EnergyT>> adjacent{};
+        for (node_t k = 0; k < n; ++k) {
+            auto const old = order[k];
+            spins[k] = m_spins[old];
+            graph->fields[k] = m_fields[old];
+            graph->labels[k] = this->label(old);
+            adjacent.clear();
+            for (auto [j, e] : this->neighbors(old)) {
+                adjacent.emplace_back(position[j], e);
+            }
+            std::ranges::sort(adjacent, {}, [](auto const& pair) { return pair.first; });
+            for (auto [j, e] : adjacent) {
+                graph->targets.push_back(j);
+                graph->couplings.push_back(e);
+            }
+            graph->offsets[k + 1] = graph->targets.size();
+        }
+
+        m_spins = std::move(spins);
+        this->bind(graph);
+        this->mark_dirty();
+    }
+
+    /**
+     * @brief Build the model over existing graph arrays without copying them, e.g. arrays in a mapped file.
+     * All spins start in the first state of SpinTraits (down for spin_t), so the energy follows from the sums
+     * without a pass over the bonds.
+     * @param storage Whatever owns the arrays; the model keeps it alive.
+     * @param field_sum The sum of all fields.
+     * @param coupling_sum The sum of all bond energies, each bond counted once.
+     */
+    void attach(std::shared_ptr<void const> storage, std::span<FieldT const> fields, std::span<uint64_t const> offsets,
+                std::span<node_t const> targets, std::span<EnergyT const> couplings, std::span<node_t const> labels,
+                FieldT field_sum, EnergyT coupling_sum) {
+        this->bind(std::move(storage), fields, offsets, targets, couplings, labels);
+        auto const spin = STraits::from_value(STraits::values[0]);
+        auto const value = STraits::value_of(spin);
+        m_spins.assign(fields.size(), spin);
+        m_sum = value * static_cast<double>(fields.size());
+        m_energy = value * field_sum - value * value * coupling_sum;
+        this->mark_dirty();
+    }
+
+    /**
+     * @brief Put every node in the same external field, replacing the fields the model was built with, and
+     * recompute the energy. The graph is copied first, since it may be shared with other models or mapped from a file.
+     */
+    void set_field(FieldT h) {
+        auto graph = std::make_shared<Graph>();
+        graph->fields.assign(m_fields.size(), h);
+        graph->offsets.assign(m_offsets.begin(), m_offsets.end());
+        graph->targets.assign(m_targets.begin(), m_targets.end());
+        graph->couplings.assign(m_couplings.begin(), m_couplings.end());
+        graph->labels.assign(m_labels.begin(), m_labels.end());
+        this->bind(graph);
+        this->recompute();
+    }
+
+    /**
+     * @brief Give every spin a random direction and recompute the energy.
+     */
+    void randomize() {
         for (auto& spin : m_spins) {
-            spin = random_spin<SpinT>();
-            m_state *= base;
-            m_state += STraits::index(spin);
-            m_sum += STraits::value_of(spin);
-        }
-        // initialize fields of the spins.
-        for (auto [i, h] : spins) {
-            --i;
-            m_fields[i] = h;
-            m_energy += STraits::value_of(m_spins[i]) * h;
-        }
-        // initialize bonds between the spins.
-        for (auto [i, j, e] : bonds) {
-            --i; --j;
-            m_neighbors[i].emplace_back(j, e);
-            m_neighbors[j].emplace_back(i, e);
-            m_energy -= STraits::value_of(m_spins[i]) * STraits::value_of(m_spins[j]) * e;
+            spin = random_spin<SpinT>(m_rng);
         }
-        m_valid = true;
+        this->recompute();
+        this->mark_dirty();
+    }
+
+    /**
+     * @brief Recompute the energy and magnetization from the spins, in O(nodes + bonds).
+     */
+    void recompute() noexcept {
+        m_energy = EnergyT{};
+        m_sum = 0.0;
+        for (node_t i = 0; i < this->size(); ++i) {
+            auto const value = STraits::value_of(m_spins[i]);
+            m_sum += value;
+            m_energy += value * m_fields[i];
+            // every bond is stored from both ends, so each end takes half of it.
+            for (auto k = m_offsets[i]; k < m_offsets[i + 1]; ++k) {
+                m_energy -= 0.5 * value * STraits::value_of(m_spins[m_targets[k]]) * m_couplings[k];
+            }
+        }
+        std::get<0>(m_delta_cache) = -1;
+    }
+
+    /**
+     * @brief The original (0-indexed) node number of an internal index.
+     */
+    node_t label(node_t n) const noexcept {
+        return m_labels.empty() ? n : m_labels[n];
+    }
+
+    /**
+     * @brief The internal index of an original (0-indexed) node number.
+     */
+    node_t index_of(node_t original) const noexcept {
+        return m_indices.empty() ? original : m_indices[original];
     }
 
     bool valid() const noexcept {
         return m_valid;
     }
 
+    /**
+     * @brief Reseed the random engine driving this model, which makes the following sweeps reproducible.
+     */
+    void seed(uint64_t seed) noexcept {
+        m_rng.seed(seed);
+    }
+
+    rng_t& rng() noexcept {
+        return m_rng;
+    }
+
+    node_t size() const noexcept {
+        return static_cast<node_t>(m_spins.size());
+    }
+
+    SpinT spin(node_t n) const noexcept {
+        return m_spins[n];
+    }
+
+    FieldT field(node_t n) const noexcept {
+        return m_fields[n];
+    }
+
+    /**
+     * @brief The (neighbor, coupling) pairs of a node, both 0-indexed.
+     */
+    auto neighbors(node_t n) const noexcept {
+        return stdv::iota(m_offsets[n], m_offsets[n + 1])
+             | stdv::transform([this](uint64_t k) { return std::pair(m_targets[k], m_couplings[k]); });
+    }
+
+    std::span<FieldT const> fields() const noexcept {
+        return m_fields;
+    }
+
+    std::span<uint64_t const> offsets() const noexcept {
+        return m_offsets;
+    }
+
+    std::span<node_t const> targets() const noexcept {
+        return m_targets;
+    }
+
+    std::span<EnergyT const> couplings() const noexcept {
+        return m_couplings;
+    }
+
+    /**
+     * @brief The original node of every internal index; empty while the nodes keep their original order.
+     */
+    std::span<node_t const> labels() const noexcept {
+        return m_labels;
+    }
+
+    /**
+     * @brief The spins in internal order.
+     */
+    std::span<SpinT const> spins() const noexcept {
+        return m_spins;
+    }
+
+    /**
+     * @brief The bytes a model of a graph takes, e.g. to check a model fits before making it.
+     * @param bond_ct The bonds, each counted once.
+     * @param reordered Whether the nodes are relabeled, which keeps the labels both ways.
+     */
+    static std::size_t memory_bytes(std::size_t node_ct, std::size_t bond_ct, bool reordered = false) noexcept {
+        auto const per_node = sizeof(SpinT) + sizeof(FieldT) + sizeof(uint64_t) + (reordered ? 2 * sizeof(node_t) : 0);
+        auto const per_bond = 2 * (sizeof(node_t) + sizeof(EnergyT));
+        auto const block_ct = (node_ct + k_block_size - 1) / k_block_size;
+        return sizeof(This) + node_ct * per_node + sizeof(uint64_t) + bond_ct * per_bond + (block_ct + 63) / 64 * sizeof(uint64_t);
+    }
+
+    /**
+     * @brief The bytes the model takes, its graph included; copies share the graph.
+     */
+    std::size_t memory_bytes() const noexcept {
+        return sizeof(This) + m_spins.capacity() * sizeof(SpinT) + m_fields.size_bytes() + m_offsets.size_bytes()
+             + m_targets.size_bytes() + m_couplings.size_bytes() + m_labels.size_bytes()
+             + m_indices.capacity() * sizeof(node_t) + m_dirty.capacity() * sizeof(uint64_t);
+    }
+
+    /**
+     * @brief The count of sweeps performed by markov_chain_monte_carlo() so far.
+     */
+    uint64_t sweep_count() const noexcept {
+        return m_sweep_ct;
+    }
+
+    /**
+     * @brief The counters of the sweeps performed by markov_chain_monte_carlo() since the last reset_telemetry().
+     */
+    Telemetry const& telemetry() const noexcept {
+        return m_telemetry;
+    }
+
+    /**
+     * @brief For engines sweeping the model from outside, e.g. BasicColoredMetropolis, to count their sweeps.
+     */
+    Telemetry& telemetry() noexcept {
+        return m_telemetry;
+    }
+
+    void reset_telemetry() noexcept {
+        m_telemetry.reset();
+    }
+
+    /**
+     * @brief The count of blocks of k_block_size spins, the last one possibly shorter.
+     */
+    std::size_t block_count() const noexcept {
+        return (m_spins.size() + k_block_size - 1) / k_block_size;
+    }
+
+    /**
+     * @brief Whether a spin of the block has been written since the last clear_dirty().
+     * Every flip marks its block, which is what makes incremental checkpoints cheap (see checkpoint.hpp).
+     */
+    bool dirty(std::size_t block) const noexcept {
+        return m_dirty[block / 64] >> (block % 64) & 1;
+    }
+
+    void clear_dirty() noexcept {
+        std::ranges::fill(m_dirty, uint64_t{});
+    }
+
+    /**
+     * @brief Mark every block dirty, e.g. after all spins are rewritten.
+     */
+    void mark_dirty() {
+        m_dirty.assign((this->block_count() + 63) / 64, ~uint64_t{});
+    }
+
+    /**
+     * @brief Overwrite the spins starting at an internal index, e.g. from a checkpoint.
+     * The energy and magnetization are left alone: follow with restore() or recompute().
+     */
+    void assign_spins(node_t first, std::span<SpinT const> spins) {
+        if (first < 0 || static_cast<std::size_t>(first) + spins.size() > m_spins.size()) {
+            throw std::out_of_range("The spins don't fit in the model.");
+        }
+        std::ranges::copy(spins, m_spins.begin() + first);
+        for (auto block = first / k_block_size; block * k_block_size < first + static_cast<node_t>(spins.size()); ++block) {
+            this->mark_dirty(block * k_block_size);
+        }
+        std::get<0>(m_delta_cache) = -1;
+    }
+
+    /**
+     * @brief Set the energy, spin sum and sweep count saved along with the spins, so a restored run continues
+     * exactly where it stopped without an O(bonds) recompute().
+     */
+    void restore(EnergyT energy, double sum, uint64_t sweep_ct) noexcept {
+        m_energy = energy;
+        m_sum = sum;
+        m_sweep_ct = sweep_ct;
+        std::get<0>(m_delta_cache) = -1;
+    }
+
+    double spin_sum() const noexcept {
+        return m_sum;
+    }
+
     /**
      * @brief Return the change of energy if certain spin is flipped.
      * Note that this might be illegal for some spin types.
@@ -261,8 +738,7 @@ public:
      * @return The energy difference.
      */
     EnergyT delta(node_t n, SpinT new_spin) noexcept {
-        static auto cache = std::tuple(node_t{ -1 }, SpinT{}, EnergyT{});
-        auto& [cached_node, cached_spin, cached_energy] = cache;
+        auto& [cached_node, cached_spin, cached_energy] = m_delta_cache;
 
         if (cached_node == n && cached_spin == new_spin) {
             return cached_energy;
@@ -272,13 +748,55 @@ public:
 
         auto const spin_delta = STraits::value_of(new_spin) - STraits::value_of(m_spins[n]);
         auto delta = m_fields[n] * spin_delta;
-        for (auto [i, e] : m_neighbors[n]) {
-            delta += STraits::value_of(m_spins[i]) * e * spin_delta;
+        for (auto k = m_offsets[n]; k < m_offsets[n + 1]; ++k) {
+            delta -= STraits::value_of(m_spins[m_targets[k]]) * m_couplings[k] * spin_delta;
         }
         cached_energy = delta;
         return delta;
     }
 
+    /**
+     * @brief The change of energy if certain spin is flipped, without the cache of delta().
+     * It only reads the model, so it is safe to call from several threads as long as no neighbor of n is written.
+     * @param n The node represented by a 0-indexed integer.
+     * @return The energy difference.
+     */
+    EnergyT flip_delta(node_t n) const noexcept {
+        auto const spin_delta = -2 * STraits::value_of(m_spins[n]);
+        auto local = m_fields[n];
+        for (auto k = m_offsets[n]; k < m_offsets[n + 1]; ++k) {
+            local -= STraits::value_of(m_spins[m_targets[k]]) * m_couplings[k];
+        }
+        return spin_delta * local;
+    }
+
+    /**
+     * @brief Flip a spin without updating the energy and magnetization.
+     * Parallel engines flip through this, accumulate the changes per thread, and apply them with commit().
+     * @return The change of the spin value.
+     */
+    double flip_uncommitted(node_t n) noexcept {
+        auto const value = STraits::value_of(m_spins[n]);
+        m_spins[n] = STraits::from_value(-value);
+        // other threads flip spins of the same word of the bitmap; only the first flip of a block writes.
+        auto const block = static_cast<std::size_t>(n / k_block_size);
+        auto const bit = uint64_t{ 1 } << (block % 64);
+        auto word = std::atomic_ref(m_dirty[block / 64]);
+        if (!(word.load(std::memory_order_relaxed) & bit)) {
+            word.fetch_or(bit, std::memory_order_relaxed);
+        }
+        return -2 * value;
+    }
+
+    /**
+     * @brief Apply changes of energy and spin sum gathered by flip_uncommitted().
+     */
+    void commit(EnergyT delta_energy, double delta_sum) noexcept {
+        m_energy += delta_energy;
+        m_sum += delta_sum;
+        std::get<0>(m_delta_cache) = -1;
+    }
+
     void flip(node_t n) {
         this->flip(n, STraits::from_value(-STraits::value_of(m_spins[n])));
     }
@@ -286,20 +804,30 @@ public:
     void flip(node_t n, SpinT new_spin) {
         auto const delta = this->delta(n, new_spin);
         auto const spin_delta = STraits::value_of(new_spin) - STraits::value_of(m_spins[n]);
-        auto const base = STraits::state_count();
 
         m_spins[n] = new_spin;
+        this->mark_dirty(n);
         m_energy += delta;
-        m_state += static_cast<int64_t>(std::pow(base, m_spins.size() - n - 1) * spin_delta);
         m_sum += spin_delta;
+        // the energies around n are stale now.
+        std::get<0>(m_delta_cache) = -1;
     }
 
     EnergyT energy() const noexcept {
         return m_energy;
     }
 
+    /**
+     * @brief The configuration serialized as a base-(state count) number, with the first spin as the most significant digit.
+     * Only meaningful for small models, since it overflows past 63 binary spins.
+     */
     int64_t state() const noexcept {
-        return m_state;
+        auto const base = static_cast<int64_t>(STraits::state_count());
+        int64_t result{};
+        for (node_t n = 0; n < this->size(); ++n) {
+            result = result * base + STraits::index(m_spins[this->index_of(n)]);
+        }
+        return result;
     }
 
     double magnetization() const noexcept {
@@ -310,6 +838,7 @@ public:
      * @brief Stablize the system by performing MCMC several times first.
      */
     void stablize() {
+        TraceScope trace("stablize");
         auto const k_stable_sweep_ct = 10;
         this->markov_chain_monte_carlo(pass, k_stable_sweep_ct);
     }
@@ -319,22 +848,53 @@ public:
      * It basically choose a random spin and flip at some chance during one of multiple sweeps.
      * @tparam F A callback type.
      * @param callback Moniter the model object and do something every sweep, e.g. record the energy of the system.
+     * If it has substep_count() and substep(model, k), like a MeasurementScheduler, each sweep is split into
+     * substep_count() parts and substep() is called after each but the last. If it has stop_requested(), the run
+     * ends after the first sweep it returns true for.
      * @param sweep_limit The count of sweeps.
     */
     template<typename F>
     void markov_chain_monte_carlo(F&& callback, int sweep_limit = 1000) {
+        constexpr bool k_has_substeps = requires { callback.substep_count(); callback.substep(*this, 0u); };
+        constexpr bool k_can_stop = requires { { callback.stop_requested() } -> std::convertible_to<bool>; };
         auto const k_sweep_limit = sweep_limit;
         auto const k_spin_size = m_spins.size();
 
         for (int sweep = 0; sweep < k_sweep_limit; ++sweep) {
-            for (int i = 0; i < k_spin_size; ++i) {
-                auto const spin = randnum(0, k_spin_size);
-                auto const delta = this->delta(spin);
-                if (std::exp(-g_beta * delta) > randnum(0.0, 1.0)) {
-                    this->flip(spin);
+            std::optional<TraceScope> trace(std::in_place, "sweep");
+            auto const mark = Telemetry::start();
+            uint64_t accepted{};
+            unsigned parts = 1;
+            if constexpr (k_has_substeps) {
+                parts = std::max(callback.substep_count(), 1u);
+            }
+            std::size_t i = 0;
+            for (unsigned part = 1; part <= parts; ++part) {
+                for (auto const end = k_spin_size * part / parts; i < end; ++i) {
+                    auto const spin = static_cast<node_t>(randnum(std::size_t{}, k_spin_size, m_rng));
+                    auto const delta = this->delta(spin);
+                    if (std::exp(-g_beta * delta) > m_rng.uniform()) {
+                        this->flip(spin);
+                        if constexpr (Telemetry::k_enabled) {
+                            ++accepted;
+                        }
+                    }
+                }
+                if constexpr (k_has_substeps) {
+                    if (part < parts) {
+                        callback.substep(*this, part);
+                    }
                 }
             }
+            ++m_sweep_ct;
+            m_telemetry.end_sweep(mark, k_spin_size, accepted);
+            trace.emplace("callback");
             callback(*this);
+            if constexpr (k_can_stop) {
+                if (callback.stop_requested()) {
+                    break;
+                }
+            }
         }
     }
 
@@ -345,7 +905,8 @@ public:
         os << "--------------------------------------------------------------" << '\n'
            << "                            Spins                             " << '\n'
            << "--------------------------------------------------------------" << '\n';
-        for (auto spin : ising.m_spins) {
+        for (node_t n = 0; n < ising.size(); ++n) {
+            auto const spin = ising.m_spins[ising.index_of(n)];
             os << ++ct << " : " << std::setw(8) << std::left << STraits::name_of(spin);
             if (ct % 5 == 0) {
                 os << '\n';
@@ -356,7 +917,8 @@ public:
         os << "--------------------------------------------------------------" << '\n'
            << "                            Fields                            " << '\n'
            << "--------------------------------------------------------------" << '\n';
-        for (auto f : ising.m_fields) {
+        for (node_t n = 0; n < ising.size(); ++n) {
+            auto const f = ising.m_fields[ising.index_of(n)];
             os << ++ct << " : " << std::setw(8) << std::left << f;
             if (ct % 5 == 0) {
                 os << '\n';
@@ -368,16 +930,14 @@ public:
            << "                            Bonds                             " << '\n'
            << "--------------------------------------------------------------" << '\n';
         std::vector<std::tuple<node_t, node_t, EnergyT>> bonds;
-        node_t i{};
-        auto const form_bonds = [&i](auto&& v) {
-            ++i;
-            return v | stdv::transform([i = i - 1](auto&& pair) {
-                auto const [min, max] = std::minmax(i, pair.first);
+        auto const form_bonds = [&ising](node_t i) {
+            return ising.neighbors(ising.index_of(i)) | stdv::transform([&ising, i](auto&& pair) {
+                auto const [min, max] = std::minmax(i, ising.label(pair.first));
                 return std::tuple(min, max, pair.second);
             });
         };
-        auto view = ising.m_neighbors | stdv::transform(form_bonds)
-                                      | stdv::join;
+        auto view = stdv::iota(node_t{}, ising.size()) | stdv::transform(form_bonds)
+                                                       | stdv::join;
         node_t last_i = -1, last_j = -1;
         for (auto [i, j, e] : view) {
             if (i != last_i || j != last_j) {
@@ -394,66 +954,73 @@ public:
     }
 
 private:
+    BasicIsing(This const& other) = default;
+
+    void mark_dirty(node_t n) noexcept {
+        auto const block = static_cast<std::size_t>(n / k_block_size);
+        m_dirty[block / 64] |= uint64_t{ 1 } << (block % 64);
+    }
+
+    void bind(std::shared_ptr<Graph const> graph) {
+        this->bind(graph, graph->fields, graph->offsets, graph->targets, graph->couplings, graph->labels);
+    }
+
+    void bind(std::shared_ptr<void const> storage, std::span<FieldT const> fields, std::span<uint64_t const> offsets,
+              std::span<node_t const> targets, std::span<EnergyT const> couplings, std::span<node_t const> labels) {
+        m_storage = std::move(storage);
+        m_fields = fields;
+        m_offsets = offsets;
+        m_targets = targets;
+        m_couplings = couplings;
+        m_labels = labels;
+        m_indices.clear();
+        if (!m_labels.empty()) {
+            m_indices.resize(m_labels.size());
+            for (node_t k = 0; k < static_cast<node_t>(m_labels.size()); ++k) {
+                m_indices[m_labels[k]] = k;
+            }
+        }
+        m_delta_cache = { node_t{ -1 }, SpinT{}, EnergyT{} };
+        m_valid = true;
+    }
+
     std::vector<SpinT> m_spins;
-    std::vector<FieldT> m_fields;
-    std::vector<std::vector<std::pair<node_t, EnergyT>>> m_neighbors;
+    // the graph is read-only and owned by m_storage, either a Graph or a mapped file.
+    std::shared_ptr<void const> m_storage;
+    std::span<FieldT const> m_fields;
+    std::span<uint64_t const> m_offsets;
+    std::span<node_t const> m_targets;
+    std::span<EnergyT const> m_couplings;
+    // internal index -> original node and back; both empty while the nodes keep their original order.
+    std::span<node_t const> m_labels;
+    std::vector<node_t> m_indices;
     EnergyT m_energy;
-    int64_t m_state;
     double m_sum;
+    std::tuple<node_t, SpinT, EnergyT> m_delta_cache{ node_t{ -1 }, SpinT{}, EnergyT{} };
+    rng_t m_rng{ std::random_device{}() };
+    uint64_t m_sweep_ct{};
+    Telemetry m_telemetry;
+    // one bit per block of k_block_size spins, set when a spin of the block changes.
+    std::vector<uint64_t> m_dirty;
     bool m_valid;
 };
 
+/**
+ * @brief Read a spins file: one "node field" pair per line, nodes being 1-indexed.
+ * @throw The file name if it can't be opened, ParseError (with the line number) for a malformed line.
+ */
 template<typename FieldT>
 std::vector<std::pair<node_t, FieldT>> read_spin_file(std::string_view spin_file) {
-    // We need more support for std::string_view !!!!!!!
-    std::ifstream ifs{};
-    // std::string_view is dangerous since it's not null-terminated!
-    ifs.open(std::string(spin_file));
-    if (!ifs) {
-        throw spin_file;
-    }
-
-    node_t node;
-    FieldT field;
-    std::vector<std::pair<node_t, FieldT>> result{};
-
-    while (ifs.good()) {
-        try {
-            ifs >> node >> field;
-        }
-        catch (...) {
-            throw;
-        }
-        result.emplace_back(node, field);
-    }
-
-    return result;
+    return load_records<std::pair<node_t, FieldT>>(spin_file);
 }
 
+/**
+ * @brief Read a bonds file: one "node node energy" triple per line, nodes being 1-indexed.
+ * @throw The file name if it can't be opened, ParseError (with the line number) for a malformed line.
+ */
 template<typename EnergyT>
 std::vector<std::tuple<node_t, node_t, EnergyT>> read_bond_file(std::string_view bond_file) {
-    // We need more support for std::string_view !!!!!!!
-    std::ifstream ifs{};
-    ifs.open(std::string(bond_file));
-    if (!ifs) {
-        throw bond_file;
-    }
-
-    node_t n1, n2;
-    EnergyT energy;
-    std::vector<std::tuple<node_t, node_t, EnergyT>> result{};
-
-    while (ifs.good()) {
-        try {
-            ifs >> n1 >> n2 >> energy;
-        }
-        catch (...) {
-            throw;
-        }
-        result.emplace_back(n1, n2, energy);
-    }
-    
-    return result;
+    return load_records<std::tuple<node_t, node_t, EnergyT>>(bond_file);
 }
 
 template<typename SpinT, typename EnergyT, typename FieldT>
@@ -465,10 +1032,11 @@ std::string to_string(BasicIsing<SpinT, EnergyT, FieldT> const& model) {
 
 
 template<typename SpinT, typename EnergyT, typename FieldT>
-BasicIsing<SpinT, EnergyT, FieldT> make_basic_ising(std::string_view spin_file, std::string_view bond_file) try {
-    auto const spins = read_spin_file<FieldT>(spin_file);
-    auto const bonds = read_bond_file<FieldT>(bond_file);
-    return { spins, bonds };
+BasicIsing<SpinT, EnergyT, FieldT> make_basic_ising(std::string_view spin_file, std::string_view bond_file, Ordering ordering = Ordering::k_none) try {
+    BasicIsing<SpinT, EnergyT, FieldT> model{};
+    model.build(file_source<std::pair<node_t, FieldT>>(spin_file),
+                file_source<std::tuple<node_t, node_t, EnergyT>>(bond_file), ordering);
+    return model;
 }
 catch (std::string_view filename) {
     std::cerr << "Error opening file " << filename << '\n';
@@ -481,4 +1049,6 @@ catch (std::exception const& e) {
 
 using Ising = BasicIsing<spin_t, energy_t, field_t>;
 
-auto const make_ising = make_basic_ising<spin_t, energy_t, field_t>;
\ No newline at end of file
+inline Ising make_ising(std::string_view spin_file, std::string_view bond_file, Ordering ordering = Ordering::k_none) {
+    return make_basic_ising<spin_t, energy_t, field_t>(spin_file, bond_file, ordering);
+}
\ No newline at end of file
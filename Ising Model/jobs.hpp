@@ -0,0 +1,349 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "trace.hpp"
+
+/**
+ * @brief Sweeps run on a worker thread of their own, e.g. an evolve sent to the background in the REPL.
+ * The worker holds the job's lock all the time it runs except between sweeps, where it publishes its progress and
+ * lets in whoever waits to read the model through pause(); a reader so waits at most a sweep, and the sweeps only
+ * pay an atomic load for it. The progress, i.e. the sweeps done and the energy and magnetization per spin of the
+ * last one, can be read any time.
+ * The worker is a thread of its own, not a ThreadPool task, as it holds the lock for the whole run; what the sweeps
+ * do in parallel, e.g. a correlation transform, still goes to the pool.
+ */
+class EvolveJob {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State {
+        k_running,
+        k_done,
+        k_stopped,
+        k_failed,
+    };
+
+    /**
+     * @brief What the job runs, returning whether it succeeded. It writes its messages into the stream, calls
+     * between_sweeps() after every sweep and ends early once a stop is requested through the token.
+     */
+    using Work = std::function<bool(EvolveJob&, std::ostream&, std::stop_token)>;
+
+    /**
+     * @brief Keeps a job between two sweeps while it lives.
+     */
+    class Pause {
+    public:
+        explicit Pause(EvolveJob& job)
+            : m_job(&job) {
+            // counted before the lock is taken, so the worker knows to let go of it.
+            m_job->m_reader_ct.fetch_add(1);
+            m_job->m_mutex.lock();
+        }
+
+        Pause(Pause&& other) noexcept
+            : m_job(std::exchange(other.m_job, nullptr)) {}
+
+        Pause& operator =(Pause&&) = delete;
+
+        ~Pause() {
+            if (m_job) {
+                // still under the lock, so the worker can't miss the notification.
+                m_job->m_reader_ct.fetch_sub(1);
+                m_job->m_mutex.unlock();
+                m_job->m_resume.notify_all();
+            }
+        }
+
+    private:
+        EvolveJob* m_job;
+    };
+
+    /**
+     * @param model What the job works on, to find the jobs of a model.
+     * @param sweep_target The sweeps the job is to run, for the progress.
+     */
+    EvolveJob(int id, std::string command, void const* model, uint64_t sweep_target, Work work)
+        : m_id(id)
+        , m_command(std::move(command))
+        , m_model(model)
+        , m_sweep_target(sweep_target)
+        , m_start(Clock::now())
+        , m_thread([this, work = std::move(work)](std::stop_token token) { this->run(work, token); }) {}
+
+    EvolveJob(EvolveJob const&) = delete;
+    EvolveJob& operator =(EvolveJob const&) = delete;
+
+    int id() const noexcept {
+        return m_id;
+    }
+
+    std::string const& command() const noexcept {
+        return m_command;
+    }
+
+    void const* model() const noexcept {
+        return m_model;
+    }
+
+    State state() const noexcept {
+        return m_state.load(std::memory_order_acquire);
+    }
+
+    bool running() const noexcept {
+        return this->state() == State::k_running;
+    }
+
+    uint64_t sweep_count() const noexcept {
+        return m_sweep_ct.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief The sweeps per second since the job started, up to its end.
+     */
+    double rate() const noexcept {
+        auto const end = this->running() ? Clock::now() : m_end;
+        auto const seconds = std::chrono::duration<double>(end - m_start).count();
+        return seconds > 0 ? static_cast<double>(this->sweep_count()) / seconds : 0.0;
+    }
+
+    /**
+     * @brief The messages of the job; only complete once it ended.
+     */
+    std::string log() const {
+        return this->running() ? std::string{} : m_log.str();
+    }
+
+    Pause pause() {
+        return Pause(*this);
+    }
+
+    /**
+     * @brief Ask the job to end after the current sweep; it goes on until then.
+     */
+    void stop() noexcept {
+        m_thread.request_stop();
+    }
+
+    /**
+     * @brief Wait for the job to end, for at most the given time.
+     * @return Whether it ended.
+     */
+    bool wait_for(Clock::duration time) {
+        std::unique_lock lock(m_end_mutex);
+        return m_ended.wait_for(lock, time, [this] { return !this->running(); });
+    }
+
+    void wait() {
+        std::unique_lock lock(m_end_mutex);
+        m_ended.wait(lock, [this] { return !this->running(); });
+    }
+
+    /**
+     * @brief Called by the work after every sweep, on the job's thread.
+     * @param sweep_ct The sweeps done so far.
+     * @param settle Run before a waiting reader is let in, e.g. to finish measurements still going on other threads
+     * that write what the reader may read.
+     */
+    void between_sweeps(uint64_t sweep_ct, double energy, double magnetization, std::function<void()> const& settle = {}) {
+        m_sweep_ct.store(sweep_ct, std::memory_order_relaxed);
+        m_energy.store(energy, std::memory_order_relaxed);
+        m_magnetization.store(magnetization, std::memory_order_relaxed);
+        if (m_reader_ct.load() > 0) {
+            if (settle) {
+                settle();
+            }
+            m_resume.wait(*m_lock, [this] { return m_reader_ct.load() == 0; });
+        }
+    }
+
+    /**
+     * @brief One line: the state, the sweeps done, the rate, the energy and magnetization per spin, the time taken
+     * and, while running, left.
+     */
+    void report(std::ostream& os) const {
+        constexpr char const* k_state_names[] = { "running", "done", "stopped", "failed" };
+        auto const state = this->state();
+        auto const sweep_ct = this->sweep_count();
+        auto const rate = this->rate();
+        auto const end = state == State::k_running ? Clock::now() : m_end;
+        os << '[' << m_id << "] " << std::setw(8) << std::left << k_state_names[static_cast<int>(state)]
+           << sweep_ct << '/' << m_sweep_target << " sweeps, " << std::setprecision(4) << rate << " sweeps/s, E/N "
+           << m_energy.load(std::memory_order_relaxed) << ", M " << m_magnetization.load(std::memory_order_relaxed)
+           << ", " << std::chrono::duration<double>(end - m_start).count() << " s";
+        if (state == State::k_running && rate > 0 && sweep_ct < m_sweep_target) {
+            os << " (" << static_cast<double>(m_sweep_target - sweep_ct) / rate << " s left)";
+        }
+        os << std::setprecision(6) << "  " << m_command;
+    }
+
+private:
+    void run(Work const& work, std::stop_token token) {
+        Tracer::instance().name_thread("evolve job");
+        std::unique_lock lock(m_mutex);
+        m_lock = &lock;
+        auto state = State::k_failed;
+        try {
+            if (work(*this, m_log, token)) {
+                state = token.stop_requested() ? State::k_stopped : State::k_done;
+            }
+        }
+        catch (std::exception const& e) {
+            m_log << e.what() << '\n';
+        }
+        m_lock = nullptr;
+        lock.unlock();
+        {
+            std::scoped_lock end_lock(m_end_mutex);
+            m_end = Clock::now();
+            m_state.store(state, std::memory_order_release);
+        }
+        m_ended.notify_all();
+    }
+
+    int m_id;
+    std::string m_command;
+    void const* m_model;
+    uint64_t m_sweep_target;
+    Clock::time_point m_start;
+    // written before the state leaves k_running.
+    Clock::time_point m_end{};
+    std::ostringstream m_log;
+
+    std::atomic<State> m_state{ State::k_running };
+    std::atomic<uint64_t> m_sweep_ct{};
+    std::atomic<double> m_energy{};
+    std::atomic<double> m_magnetization{};
+
+    // held by the worker while it runs, except between sweeps for the readers counted.
+    std::mutex m_mutex;
+    std::unique_lock<std::mutex>* m_lock = nullptr;
+    std::condition_variable m_resume;
+    std::atomic<int> m_reader_ct{};
+    std::mutex m_end_mutex;
+    std::condition_variable m_ended;
+
+    // last, so the rest is ready when it starts and it ends before the rest goes.
+    std::jthread m_thread;
+};
+
+/**
+ * @brief The jobs of a session, numbered from 1. Jobs that ended stay listed with their results.
+ */
+class JobTable {
+public:
+    JobTable() = default;
+    JobTable(JobTable const&) = delete;
+    JobTable& operator =(JobTable const&) = delete;
+
+    ~JobTable() {
+        this->stop_all();
+    }
+
+    EvolveJob& start(std::string command, void const* model, uint64_t sweep_target, EvolveJob::Work work) {
+        auto& entry = m_jobs.emplace_back();
+        entry.job = std::make_unique<EvolveJob>(++m_last_id, std::move(command), model, sweep_target, std::move(work));
+        return *entry.job;
+    }
+
+    /**
+     * @brief The job of an id, or nullptr.
+     */
+    EvolveJob* find(int id) const noexcept {
+        auto const it = std::ranges::find_if(m_jobs, [id](Entry const& entry) { return entry.job->id() == id; });
+        return it == m_jobs.end() ? nullptr : it->job.get();
+    }
+
+    /**
+     * @brief The job started last, or nullptr.
+     */
+    EvolveJob* latest() const noexcept {
+        return m_jobs.empty() ? nullptr : m_jobs.back().job.get();
+    }
+
+    /**
+     * @brief The running jobs, of a model or of any for nullptr.
+     */
+    std::vector<EvolveJob*> running(void const* model = nullptr) const {
+        std::vector<EvolveJob*> result{};
+        for (auto const& entry : m_jobs) {
+            if (entry.job->running() && (!model || entry.job->model() == model)) {
+                result.push_back(entry.job.get());
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Keep the jobs running on a model between sweeps, as long as the result lives.
+     */
+    std::vector<EvolveJob::Pause> pause(void const* model) const {
+        std::vector<EvolveJob::Pause> result{};
+        for (auto* job : this->running(model)) {
+            result.push_back(job->pause());
+        }
+        return result;
+    }
+
+    std::vector<EvolveJob const*> jobs() const {
+        std::vector<EvolveJob const*> result{};
+        for (auto const& entry : m_jobs) {
+            result.push_back(entry.job.get());
+        }
+        return result;
+    }
+
+    void stop_all() noexcept {
+        for (auto const& entry : m_jobs) {
+            entry.job->stop();
+        }
+    }
+
+    void wait_all() {
+        for (auto const& entry : m_jobs) {
+            entry.job->wait();
+        }
+    }
+
+    /**
+     * @brief Report the jobs that ended since the last call, with their messages.
+     * @return Whether any of them failed.
+     */
+    bool reap(std::ostream& os) {
+        bool failed = false;
+        for (auto& entry : m_jobs) {
+            if (entry.reported || entry.job->running()) {
+                continue;
+            }
+            entry.job->report(os);
+            os << '\n' << entry.job->log();
+            entry.reported = true;
+            failed |= entry.job->state() == EvolveJob::State::k_failed;
+        }
+        return failed;
+    }
+
+private:
+    struct Entry {
+        std::unique_ptr<EvolveJob> job;
+        bool reported = false;
+    };
+
+    std::vector<Entry> m_jobs;
+    int m_last_id{};
+};
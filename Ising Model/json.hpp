@@ -0,0 +1,514 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/**
+ * @brief Malformed JSON, or a value of another type than asked for.
+ */
+class JsonError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief A JSON value: null, a boolean, a number (kept as a double), a string, an array or an object, whose members
+ * are kept sorted by key. Enough for the requests and results of the simulation server, not a general library.
+ */
+class Json {
+public:
+    using Array = std::vector<Json>;
+    using Object = std::map<std::string, Json, std::less<>>;
+
+    // how deep arrays and objects may nest in parsed text, against stack overflows.
+    static constexpr int k_max_depth = 128;
+    // the largest integers a double holds exactly: 2^53.
+    static constexpr double k_max_integer = 9007199254740992.0;
+
+    Json() noexcept = default;
+
+    Json(std::nullptr_t) noexcept {}
+
+    Json(bool value) noexcept
+        : m_value(value) {}
+
+    template<typename T> requires std::is_arithmetic_v<T>
+    Json(T value) noexcept
+        : m_value(static_cast<double>(value)) {}
+
+    Json(char const* value)
+        : m_value(std::string(value)) {}
+
+    Json(std::string_view value)
+        : m_value(std::string(value)) {}
+
+    Json(std::string value) noexcept
+        : m_value(std::move(value)) {}
+
+    Json(Array value) noexcept
+        : m_value(std::move(value)) {}
+
+    Json(Object value) noexcept
+        : m_value(std::move(value)) {}
+
+    /**
+     * @brief An object of key-value pairs, e.g. Json::object({ { "sweeps", 100 }, { "beta", 0.44 } }).
+     */
+    static Json object(std::initializer_list<std::pair<std::string const, Json>> members = {}) {
+        return Json(Object(members));
+    }
+
+    static Json array(std::initializer_list<Json> elements = {}) {
+        return Json(Array(elements));
+    }
+
+    /**
+     * @throw JsonError with the offset of the first malformed character.
+     */
+    static Json parse(std::string_view text) {
+        Parser parser{ text };
+        auto result = parser.value(0);
+        parser.skip_space();
+        if (parser.pos != text.size()) {
+            parser.fail("trailing characters");
+        }
+        return result;
+    }
+
+    bool is_null() const noexcept {
+        return std::holds_alternative<std::nullptr_t>(m_value);
+    }
+
+    bool is_bool() const noexcept {
+        return std::holds_alternative<bool>(m_value);
+    }
+
+    bool is_number() const noexcept {
+        return std::holds_alternative<double>(m_value);
+    }
+
+    bool is_string() const noexcept {
+        return std::holds_alternative<std::string>(m_value);
+    }
+
+    bool is_array() const noexcept {
+        return std::holds_alternative<Array>(m_value);
+    }
+
+    bool is_object() const noexcept {
+        return std::holds_alternative<Object>(m_value);
+    }
+
+    bool as_bool() const {
+        return this->get<bool>("a boolean");
+    }
+
+    double as_number() const {
+        return this->get<double>("a number");
+    }
+
+    /**
+     * @brief The number as an integer.
+     * @throw JsonError if it isn't a whole number in range.
+     */
+    int64_t as_integer() const {
+        auto const value = this->as_number();
+        if (value != std::floor(value) || std::abs(value) > k_max_integer) {
+            throw JsonError("expected an integer");
+        }
+        return static_cast<int64_t>(value);
+    }
+
+    std::string const& as_string() const {
+        return this->get<std::string>("a string");
+    }
+
+    Array const& as_array() const {
+        return this->get<Array>("an array");
+    }
+
+    Object const& as_object() const {
+        return this->get<Object>("an object");
+    }
+
+    Array& as_array() {
+        return const_cast<Array&>(std::as_const(*this).as_array());
+    }
+
+    Object& as_object() {
+        return const_cast<Object&>(std::as_const(*this).as_object());
+    }
+
+    /**
+     * @brief A member of an object, or nullptr if it has none of the key or isn't an object.
+     */
+    Json const* find(std::string_view key) const {
+        auto const* object = std::get_if<Object>(&m_value);
+        if (!object) {
+            return nullptr;
+        }
+        auto const it = object->find(key);
+        return it == object->end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief A member of an object, made null if there is none.
+     */
+    Json& operator [](std::string_view key) {
+        if (this->is_null()) {
+            m_value = Object{};
+        }
+        auto& object = this->as_object();
+        auto it = object.find(key);
+        if (it == object.end()) {
+            it = object.emplace(std::string(key), Json{}).first;
+        }
+        return it->second;
+    }
+
+    void write(std::ostream& os) const {
+        std::visit([&os](auto const& value) { write_value(os, value); }, m_value);
+    }
+
+    /**
+     * @brief The value as compact JSON on one line.
+     */
+    std::string dump() const {
+        std::ostringstream oss;
+        this->write(oss);
+        return oss.str();
+    }
+
+private:
+    struct Parser {
+        std::string_view text;
+        std::size_t pos = 0;
+
+        [[noreturn]] void fail(std::string_view what) const {
+            throw JsonError(std::string(what) + " at offset " + std::to_string(pos));
+        }
+
+        void skip_space() noexcept {
+            while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+                ++pos;
+            }
+        }
+
+        bool consume(std::string_view word) noexcept {
+            if (text.substr(pos, word.size()) == word) {
+                pos += word.size();
+                return true;
+            }
+            return false;
+        }
+
+        Json value(int depth) {
+            skip_space();
+            if (pos == text.size()) {
+                fail("unexpected end");
+            }
+            switch (text[pos]) {
+            case '{':
+                return object(depth + 1);
+            case '[':
+                return array(depth + 1);
+            case '"':
+                return Json(string());
+            default:
+                break;
+            }
+            if (consume("true")) {
+                return Json(true);
+            }
+            if (consume("false")) {
+                return Json(false);
+            }
+            if (consume("null")) {
+                return Json(nullptr);
+            }
+            return number();
+        }
+
+        Json object(int depth) {
+            if (depth > k_max_depth) {
+                fail("nested too deep");
+            }
+            ++pos;
+            Object result{};
+            skip_space();
+            if (consume("}")) {
+                return Json(std::move(result));
+            }
+            while (true) {
+                skip_space();
+                if (pos == text.size() || text[pos] != '"') {
+                    fail("expected a key");
+                }
+                auto key = string();
+                skip_space();
+                if (!consume(":")) {
+                    fail("expected ':'");
+                }
+                result.insert_or_assign(std::move(key), value(depth));
+                skip_space();
+                if (consume("}")) {
+                    return Json(std::move(result));
+                }
+                if (!consume(",")) {
+                    fail("expected ',' or '}'");
+                }
+            }
+        }
+
+        Json array(int depth) {
+            if (depth > k_max_depth) {
+                fail("nested too deep");
+            }
+            ++pos;
+            Array result{};
+            skip_space();
+            if (consume("]")) {
+                return Json(std::move(result));
+            }
+            while (true) {
+                result.push_back(value(depth));
+                skip_space();
+                if (consume("]")) {
+                    return Json(std::move(result));
+                }
+                if (!consume(",")) {
+                    fail("expected ',' or ']'");
+                }
+            }
+        }
+
+        Json number() {
+            auto const begin = pos;
+            // from_chars takes neither a leading + nor JSON's restrictions, so check the grammar first.
+            consume("-");
+            auto const digits = [this] {
+                auto const start = pos;
+                while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+                    ++pos;
+                }
+                return pos - start;
+            };
+            auto const int_digits = digits();
+            if (int_digits == 0 || (int_digits > 1 && text[pos - int_digits] == '0')) {
+                pos = begin;
+                fail("invalid value");
+            }
+            if (consume(".") && digits() == 0) {
+                fail("expected a digit");
+            }
+            if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+                ++pos;
+                if (!consume("+")) {
+                    consume("-");
+                }
+                if (digits() == 0) {
+                    fail("expected a digit");
+                }
+            }
+            double result{};
+            auto const [ptr, ec] = std::from_chars(text.data() + begin, text.data() + pos, result);
+            if (ec != std::errc{} || ptr != text.data() + pos) {
+                pos = begin;
+                fail("number out of range");
+            }
+            return Json(result);
+        }
+
+        static void append_utf8(std::string& out, uint32_t code) {
+            if (code < 0x80) {
+                out += static_cast<char>(code);
+            }
+            else if (code < 0x800) {
+                out += static_cast<char>(0xC0 | code >> 6);
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000) {
+                out += static_cast<char>(0xE0 | code >> 12);
+                out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else {
+                out += static_cast<char>(0xF0 | code >> 18);
+                out += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+                out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        uint32_t hex4() {
+            uint32_t code{};
+            auto const [ptr, ec] = std::from_chars(text.data() + pos, text.data() + std::min(pos + 4, text.size()), code, 16);
+            if (ec != std::errc{} || ptr != text.data() + pos + 4) {
+                fail("expected 4 hex digits");
+            }
+            pos += 4;
+            return code;
+        }
+
+        std::string string() {
+            ++pos;
+            std::string result{};
+            while (true) {
+                if (pos == text.size()) {
+                    fail("unterminated string");
+                }
+                auto const ch = text[pos++];
+                if (ch == '"') {
+                    return result;
+                }
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    fail("control character in string");
+                }
+                if (ch != '\\') {
+                    result += ch;
+                    continue;
+                }
+                if (pos == text.size()) {
+                    fail("unterminated string");
+                }
+                switch (auto const escape = text[pos++]) {
+                case '"':
+                case '\\':
+                case '/':
+                    result += escape;
+                    break;
+                case 'b':
+                    result += '\b';
+                    break;
+                case 'f':
+                    result += '\f';
+                    break;
+                case 'n':
+                    result += '\n';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case 'u': {
+                    auto code = hex4();
+                    // a high surrogate takes the low one after it; a lone one becomes U+FFFD.
+                    if (code >= 0xD800 && code < 0xDC00 && consume("\\u")) {
+                        auto const low = hex4();
+                        code = low >= 0xDC00 && low < 0xE000 ? 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00) : 0xFFFD;
+                    }
+                    else if (code >= 0xD800 && code < 0xE000) {
+                        code = 0xFFFD;
+                    }
+                    append_utf8(result, code);
+                    break;
+                }
+                default:
+                    --pos;
+                    fail("invalid escape");
+                }
+            }
+        }
+    };
+
+    template<typename T>
+    T const& get(char const* expected) const {
+        if (auto const* value = std::get_if<T>(&m_value)) {
+            return *value;
+        }
+        throw JsonError(std::string("expected ") + expected);
+    }
+
+    static void write_value(std::ostream& os, std::nullptr_t) {
+        os << "null";
+    }
+
+    static void write_value(std::ostream& os, bool value) {
+        os << (value ? "true" : "false");
+    }
+
+    static void write_value(std::ostream& os, double value) {
+        // JSON has no infinities or NaN.
+        if (!std::isfinite(value)) {
+            os << "null";
+            return;
+        }
+        char buffer[32];
+        // whole numbers as integers, e.g. 100000 rather than 1e+05, as readers expect of counts.
+        auto const end = value == std::trunc(value) && std::abs(value) <= k_max_integer
+            ? std::to_chars(buffer, buffer + sizeof(buffer), static_cast<int64_t>(value)).ptr
+            : std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+        os.write(buffer, end - buffer);
+    }
+
+    static void write_value(std::ostream& os, std::string const& value) {
+        constexpr char k_hex[] = "0123456789abcdef";
+        os << '"';
+        for (auto const ch : value) {
+            switch (ch) {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            case '\r':
+                os << "\\r";
+                break;
+            case '\t':
+                os << "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    os << "\\u00" << k_hex[ch >> 4] << k_hex[ch & 0xF];
+                }
+                else {
+                    os << ch;
+                }
+            }
+        }
+        os << '"';
+    }
+
+    static void write_value(std::ostream& os, Array const& value) {
+        os << '[';
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            os << (i ? "," : "");
+            value[i].write(os);
+        }
+        os << ']';
+    }
+
+    static void write_value(std::ostream& os, Object const& value) {
+        os << '{';
+        bool first = true;
+        for (auto const& [key, member] : value) {
+            os << (first ? "" : ",");
+            write_value(os, key);
+            os << ':';
+            member.write(os);
+            first = false;
+        }
+        os << '}';
+    }
+
+    std::variant<std::nullptr_t, bool, double, std::string, Array, Object> m_value;
+};
@@ -0,0 +1,363 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if defined(__APPLE__) || defined(__linux__)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   define ISING_HAS_MMAP 1
+#endif
+
+#include "pool.hpp"
+#include "trace.hpp"
+
+/**
+ * @brief A read-only view of a whole file, memory-mapped where the platform allows it and read into memory otherwise.
+ * Throws the file name (like the rest of the loaders) if the file can't be opened.
+ * Pass sequential = false for data that is accessed at random, like the arrays of a binary model.
+ */
+class MappedFile {
+public:
+    MappedFile() noexcept = default;
+
+    explicit MappedFile(std::string_view file, bool sequential = true) {
+        auto const name = std::string(file);
+#ifdef ISING_HAS_MMAP
+        auto const fd = ::open(name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw file;
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) < 0) {
+            ::close(fd);
+            throw file;
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size > 0) {
+            auto* const data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw file;
+            }
+            ::madvise(data, m_size, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+            m_data = static_cast<char const*>(data);
+            m_mapped = true;
+        }
+        ::close(fd);
+#else
+        (void)sequential;
+        std::ifstream ifs(name, std::ios::binary);
+        if (!ifs) {
+            throw file;
+        }
+        m_buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+#endif
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator =(MappedFile const&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedFile& operator =(MappedFile&& other) noexcept {
+        if (this != &other) {
+            this->release();
+            m_buffer = std::move(other.m_buffer);
+            m_data = other.m_mapped ? other.m_data : m_buffer.data();
+            m_size = other.m_size;
+            m_mapped = other.m_mapped;
+            other.m_data = nullptr;
+            other.m_size = 0;
+            other.m_mapped = false;
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        this->release();
+    }
+
+    char const* data() const noexcept {
+        return m_data;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::string_view view() const noexcept {
+        return { m_data, m_size };
+    }
+
+    /**
+     * @brief Tell the system the first `end` bytes won't be read again, so their pages can be dropped.
+     */
+    void discard(std::size_t end) const noexcept {
+#ifdef ISING_HAS_MMAP
+        auto const page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        if (m_mapped && end >= page) {
+            ::madvise(const_cast<char*>(m_data), end / page * page, MADV_DONTNEED);
+        }
+#else
+        (void)end;
+#endif
+    }
+
+private:
+    void release() noexcept {
+#ifdef ISING_HAS_MMAP
+        if (m_mapped) {
+            ::munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+        m_data = nullptr;
+        m_size = 0;
+        m_mapped = false;
+    }
+
+    std::string m_buffer;
+    char const* m_data = nullptr;
+    std::size_t m_size = 0;
+    bool m_mapped = false;
+};
+
+/**
+ * @brief A line of a text input that doesn't hold the expected record.
+ */
+class ParseError : public std::runtime_error {
+public:
+    ParseError(std::string_view file, std::size_t line, std::string_view text)
+        : std::runtime_error(std::string(file) + ":" + std::to_string(line) + ": malformed line \"" + std::string(text) + "\""),
+          m_line(line) {}
+
+    std::size_t line() const noexcept {
+        return m_line;
+    }
+
+private:
+    std::size_t m_line;
+};
+
+namespace detail {
+
+inline bool is_blank(char ch) noexcept {
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+/**
+ * @brief Parse one whitespace separated value at the front of sv and drop it from sv.
+ */
+template<typename T>
+bool parse_value(std::string_view& sv, T& value) noexcept {
+    auto it = std::find_if_not(sv.begin(), sv.end(), is_blank);
+    // std::from_chars doesn't take an explicit plus sign.
+    if (it != sv.end() && *it == '+') {
+        ++it;
+    }
+    auto const first = sv.data() + (it - sv.begin());
+    auto const last = sv.data() + sv.size();
+    auto const [ptr, ec] = std::from_chars(first, last, value);
+    if (ec != std::errc{} || (ptr != last && !is_blank(*ptr))) {
+        return false;
+    }
+    sv.remove_prefix(ptr - sv.data());
+    return true;
+}
+
+/**
+ * @brief Parse every line of a chunk into records.
+ * Blank lines and lines starting with '#' are skipped; the first malformed line stops the parse.
+ * @return The count of lines in the chunk and, if any, the chunk-relative (0-indexed) number of the malformed line.
+ */
+template<typename Record>
+std::pair<std::size_t, std::size_t> parse_chunk(std::string_view chunk, std::vector<Record>& records) {
+    constexpr auto k_no_error = static_cast<std::size_t>(-1);
+    std::size_t line_no{};
+    while (!chunk.empty()) {
+        auto const end = chunk.find('\n');
+        auto line = chunk.substr(0, end);
+        chunk.remove_prefix(end == std::string_view::npos ? chunk.size() : end + 1);
+
+        auto const first = std::find_if_not(line.begin(), line.end(), is_blank);
+        if (first != line.end() && *first != '#') {
+            Record record{};
+            auto const ok = std::apply([&line](auto&... fields) { return (parse_value(line, fields) && ...); }, record);
+            if (!ok || std::find_if_not(line.begin(), line.end(), is_blank) != line.end()) {
+                return { line_no, line_no };
+            }
+            records.push_back(record);
+        }
+        ++line_no;
+    }
+    return { line_no, k_no_error };
+}
+
+/**
+ * @brief Parse the chunks in parallel on the ThreadPool, a task each, and throw for the first malformed line.
+ * @param first_line The count of lines of the file before the first chunk; it is advanced past the chunks.
+ */
+template<typename Record>
+void parse_chunks(std::string_view file, std::vector<std::string_view> const& chunks,
+                  std::vector<std::vector<Record>>& parts, std::size_t& first_line) {
+    TraceScope trace("parse");
+    parts.resize(chunks.size());
+    std::vector<std::pair<std::size_t, std::size_t>> outcomes(chunks.size());
+    ThreadPool::instance().parallel_for(0, chunks.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (auto c = begin; c < end; ++c) {
+            TraceScope chunk_trace("parse chunk");
+            outcomes[c] = parse_chunk(chunks[c], parts[c]);
+        }
+    });
+
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+        auto const [line_ct, error] = outcomes[c];
+        if (error != static_cast<std::size_t>(-1)) {
+            auto line = chunks[c];
+            for (std::size_t skip = 0; skip < error; ++skip) {
+                line.remove_prefix(line.find('\n') + 1);
+            }
+            line = line.substr(0, line.find('\n'));
+            throw ParseError(file, first_line + error + 1, line);
+        }
+        first_line += line_ct;
+    }
+}
+
+/**
+ * @brief The end of the line holding position pos, past its line break.
+ */
+inline std::size_t line_end(std::string_view text, std::size_t pos) noexcept {
+    auto const end = std::min(text.find('\n', pos), text.size());
+    return end + (end < text.size());
+}
+
+inline unsigned thread_count(unsigned thread_ct) noexcept {
+    return thread_ct ? thread_ct : std::max(1u, std::thread::hardware_concurrency());
+}
+
+} // namespace detail
+
+/**
+ * @brief Parse a text file of whitespace separated records, one per line, in parallel.
+ * The file is memory-mapped and cut into chunks at line boundaries, and each chunk is parsed by its own thread
+ * with std::from_chars. Blank lines and '#' comments are skipped.
+ * @tparam Record A tuple-like type (std::pair, std::tuple) of arithmetic fields.
+ * @param file The path of the file.
+ * @param thread_ct The count of parsing threads; 0 means one per hardware thread.
+ * @return The records in file order.
+ * @throw The file name if the file can't be opened, ParseError for a malformed line.
+ */
+template<typename Record>
+std::vector<Record> load_records(std::string_view file, unsigned thread_ct = 0) {
+    constexpr std::size_t k_min_chunk = 1 << 20;
+    auto const mapped = MappedFile(file);
+    auto const text = mapped.view();
+
+    auto const chunk_ct = std::max<std::size_t>(1, std::min<std::size_t>(detail::thread_count(thread_ct), text.size() / k_min_chunk));
+
+    // cut at the first line break after every even split point.
+    std::vector<std::string_view> chunks{};
+    std::size_t begin{};
+    for (std::size_t c = 1; c <= chunk_ct; ++c) {
+        auto const end = c == chunk_ct ? text.size() : detail::line_end(text, std::max(begin, text.size() * c / chunk_ct));
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+
+    std::vector<std::vector<Record>> parts{};
+    std::size_t first_line{};
+    detail::parse_chunks(file, chunks, parts, first_line);
+
+    if (chunk_ct == 1) {
+        return std::move(parts[0]);
+    }
+    std::size_t total{};
+    for (auto const& part : parts) {
+        total += part.size();
+    }
+    std::vector<Record> result{};
+    result.reserve(total);
+    for (auto& part : parts) {
+        result.insert(result.end(), part.cbegin(), part.cend());
+        std::vector<Record>{}.swap(part);
+    }
+    return result;
+}
+
+/**
+ * @brief Stream the records of a text file to a callback, in file order, without keeping them.
+ * The file is parsed window by window: each window is a few chunks of bounded size parsed in parallel, so the
+ * memory used doesn't grow with the file.
+ * @param f Called with every record.
+ * @param thread_ct The count of parsing threads; 0 means one per hardware thread.
+ * @throw The file name if the file can't be opened, ParseError for a malformed line (nothing after it is streamed).
+ */
+template<typename Record, typename F>
+void for_each_record(std::string_view file, F&& f, unsigned thread_ct = 0) {
+    constexpr std::size_t k_chunk = 4 << 20;
+    auto const mapped = MappedFile(file);
+    auto const text = mapped.view();
+    auto const chunk_ct = detail::thread_count(thread_ct);
+
+    std::vector<std::string_view> chunks{};
+    std::vector<std::vector<Record>> parts{};
+    std::size_t first_line{};
+    for (std::size_t begin{}; begin < text.size();) {
+        chunks.clear();
+        while (chunks.size() < chunk_ct && begin < text.size()) {
+            auto const end = detail::line_end(text, std::min(begin + k_chunk, text.size() - 1));
+            chunks.push_back(text.substr(begin, end - begin));
+            begin = end;
+        }
+        for (auto& part : parts) {
+            part.clear();
+        }
+        detail::parse_chunks(file, chunks, parts, first_line);
+        for (std::size_t c = 0; c < chunks.size(); ++c) {
+            for (auto const& record : parts[c]) {
+                f(record);
+            }
+        }
+        mapped.discard(begin);
+    }
+}
+
+/**
+ * @brief A record source over a text file for the two-pass builders (see BasicIsing::build).
+ * A source is called with a sink and passes every record to it, unpacked; a file source parses the file each time.
+ */
+template<typename Record>
+auto file_source(std::string_view file, unsigned thread_ct = 0) {
+    return [file = std::string(file), thread_ct](auto&& sink) {
+        for_each_record<Record>(file, [&sink](Record const& record) { std::apply(sink, record); }, thread_ct);
+    };
+}
+
+/**
+ * @brief A record source over a range of tuple-like records, e.g. a std::vector<std::pair<node_t, field_t>>.
+ * The range is referenced, not copied.
+ */
+template<typename R>
+auto range_source(R const& range) {
+    return [&range](auto&& sink) {
+        for (auto const& record : range) {
+            std::apply(sink, record);
+        }
+    };
+}
@@ -1,43 +1,93 @@
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <numbers>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
 #include "external-libraries/matplotlibcpp.h"
 #include "repl.hpp"
+#include "server.hpp"
 
 Ising g_model;
 
-double g_beta = 0.1;
+thread_local double g_beta = 0.1;
 field_t g_bond_energy = 1.0;
 
 namespace plt = matplotlibcpp;
 using namespace std::numbers;
 
-struct Test {
-    auto operator ()(auto&& self) const {
-        v.push_back(v.size());
+int main(int argc, char** argv) {
+    // --serve=[socket path|tcp:port|-] [--workers=n]: a JSON-RPC server, on standard input for -.
+    // --threads=n [--pin]: the workers of the shared thread pool, pinned to cores.
+    std::string serve{};
+    unsigned worker_ct = 0;
+    unsigned pool_worker_ct = 0;
+    bool pin = false;
+    // the whole text as a count, or nothing.
+    auto const parse_count = [](std::string_view text) -> std::optional<unsigned> {
+        unsigned value{};
+        auto const [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc{} || ptr != text.data() + text.size()) {
+            return std::nullopt;
+        }
+        return value;
+    };
+    for (; argc > 1 && std::string_view(argv[1]).starts_with("--"); --argc, ++argv) {
+        std::string_view const option = argv[1];
+        if (option.starts_with("--serve=")) {
+            serve = option.substr(8);
+        }
+        else if (option.starts_with("--workers=")) {
+            auto const count = parse_count(option.substr(10));
+            if (!count) {
+                std::cerr << "Expected --workers=[count], got " << option << '\n';
+                return EXIT_FAILURE;
+            }
+            worker_ct = *count;
+        }
+        else if (option.starts_with("--threads=")) {
+            auto const count = parse_count(option.substr(10));
+            if (!count) {
+                std::cerr << "Expected --threads=[count], got " << option << '\n';
+                return EXIT_FAILURE;
+            }
+            pool_worker_ct = *count;
+        }
+        else if (option == "--pin") {
+            pin = true;
+        }
+        else {
+            std::cerr << "Unknown option " << option << '\n';
+            return EXIT_FAILURE;
+        }
     }
-    auto operator ()() const {
-        return v;
+    ThreadPool::configure(pool_worker_ct, pin);
+    if (!serve.empty()) {
+        SimulationServer server(worker_ct);
+        if (serve == "-") {
+            serve_stream(server, std::cin, std::cout);
+            return EXIT_SUCCESS;
+        }
+        return serve_socket(server, serve);
     }
 
-    mutable std::vector<std::size_t> v;
-};
-
-int main() {
-    //repl();
-
-
-
-    g_model.from_grid(3, 3);
-    auto&& s = Ising::record_state;
-    auto&& t = Test{};
-    g_model.markov_chain_monte_carlo(t);
-    auto res = s();
-    for (auto k : t()) {
-        std::cout << k << '\n';
+    // a script file, or commands piped in, run as a batch; a terminal gets the REPL.
+    if (argc > 1) {
+        std::ifstream script(argv[1]);
+        if (!script) {
+            std::cerr << "Error opening file " << argv[1] << '\n';
+            return EXIT_FAILURE;
+        }
+        return run_batch(script);
+    }
+    if (!stdin_is_terminal()) {
+        return run_batch(std::cin);
     }
+    repl();
 
     //auto&& r = Ising::record<Ising::StateRecorder, Ising::EnergyRecorder, Ising::MagnetizationRecorder>;
     //r(g_model);
@@ -71,5 +121,4 @@ int main() {
    //plt::title("Sample figure");
    //plt::legend();
    //plt::save("./basic.png");
-    return 0;
 }
@@ -0,0 +1,267 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ising_model.hpp"
+#include "loader.hpp"
+
+/**
+ * @brief The header of a binary model file.
+ * The file is the header followed by the graph arrays of BasicIsing::Graph, each starting at a 64-byte aligned
+ * offset recorded in the header, in native byte order. The arrays are used in place once the file is mapped.
+ */
+struct ModelFileHeader {
+    static constexpr char k_magic[8] = { 'I', 'S', 'I', 'N', 'G', 'M', 'D', 'L' };
+    static constexpr uint32_t k_version = 1;
+    static constexpr uint32_t k_byte_order = 0x01020304;
+    static constexpr uint32_t k_has_labels = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t energy_size;
+    uint32_t field_size;
+    uint32_t flags;
+    uint64_t node_count;
+    // count of (neighbor, coupling) entries, i.e. twice the count of bonds.
+    uint64_t entry_count;
+    double field_sum;
+    double coupling_sum;
+    uint64_t fields_offset;
+    uint64_t offsets_offset;
+    uint64_t targets_offset;
+    uint64_t couplings_offset;
+    uint64_t labels_offset;
+    uint64_t file_size;
+    // FNV-1a of the header with this field zeroed.
+    uint64_t checksum;
+
+    uint64_t compute_checksum() const noexcept {
+        auto copy = *this;
+        copy.checksum = 0;
+        auto const* const bytes = reinterpret_cast<unsigned char const*>(&copy);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (std::size_t i = 0; i < sizeof(copy); ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+};
+
+/**
+ * @brief A binary model file that can't be used.
+ */
+class ModelFileError : public std::runtime_error {
+public:
+    ModelFileError(std::string_view file, std::string_view reason)
+        : std::runtime_error(std::string(file) + ": " + std::string(reason)) {}
+};
+
+namespace detail {
+
+/**
+ * @brief One array of a mapped model file, checked to lie within the file.
+ */
+template<typename T>
+std::span<T const> mapped_array(MappedFile const& mapped, std::string_view file, uint64_t offset, uint64_t count) {
+    if (offset % alignof(T) != 0 || offset > mapped.size() || count > (mapped.size() - offset) / sizeof(T)) {
+        throw ModelFileError(file, "array out of bounds");
+    }
+    return { reinterpret_cast<T const*>(mapped.data() + offset), count };
+}
+
+} // namespace detail
+
+/**
+ * @brief Write the graph of a model (fields, bonds and node labels, not the spins) as a binary model file.
+ * The internal layout is kept, so a model reordered for locality loads already reordered.
+ */
+template<typename SpinT, typename EnergyT, typename FieldT>
+void save_model(BasicIsing<SpinT, EnergyT, FieldT> const& model, std::string_view file) {
+    constexpr uint64_t k_align = 64;
+    auto const align = [](uint64_t offset) { return (offset + k_align - 1) / k_align * k_align; };
+    auto const fields = model.fields();
+    auto const offsets = model.offsets();
+    auto const targets = model.targets();
+    auto const couplings = model.couplings();
+    auto const labels = model.labels();
+
+    ModelFileHeader header{};
+    std::memcpy(header.magic, ModelFileHeader::k_magic, sizeof(header.magic));
+    header.version = ModelFileHeader::k_version;
+    header.byte_order = ModelFileHeader::k_byte_order;
+    header.node_size = sizeof(node_t);
+    header.energy_size = sizeof(EnergyT);
+    header.field_size = sizeof(FieldT);
+    header.flags = labels.empty() ? 0 : ModelFileHeader::k_has_labels;
+    header.node_count = fields.size();
+    header.entry_count = targets.size();
+    for (auto const h : fields) {
+        header.field_sum += h;
+    }
+    for (auto const e : couplings) {
+        header.coupling_sum += e;
+    }
+    header.coupling_sum /= 2;
+    header.fields_offset = align(sizeof(header));
+    header.offsets_offset = align(header.fields_offset + fields.size_bytes());
+    header.targets_offset = align(header.offsets_offset + offsets.size_bytes());
+    header.couplings_offset = align(header.targets_offset + targets.size_bytes());
+    header.labels_offset = align(header.couplings_offset + couplings.size_bytes());
+    header.file_size = header.labels_offset + labels.size_bytes();
+    header.checksum = header.compute_checksum();
+
+    std::ofstream ofs(std::string(file), std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+        throw file;
+    }
+    auto const write_at = [&ofs](uint64_t offset, auto const span) {
+        static constexpr char k_padding[k_align]{};
+        ofs.write(k_padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(ofs.tellp())));
+        ofs.write(reinterpret_cast<char const*>(span.data()), static_cast<std::streamsize>(span.size_bytes()));
+    };
+    ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    write_at(header.fields_offset, fields);
+    write_at(header.offsets_offset, offsets);
+    write_at(header.targets_offset, targets);
+    write_at(header.couplings_offset, couplings);
+    write_at(header.labels_offset, labels);
+    if (!ofs) {
+        throw ModelFileError(file, "write failed");
+    }
+}
+
+/**
+ * @brief Load a binary model file by mapping it; the model refers to the arrays in the mapping without copying.
+ * Nothing is parsed or rebuilt, and every spin starts in the first state (see BasicIsing::attach), so loading
+ * costs the header checks, one pass over the labels (which the model indexes anyway) and one byte per node; the
+ * bonds aren't read until the first sweep.
+ * @param verify Also check that the offsets never decrease and every bond is to a node, reading every bond.
+ * @throw The file name if it can't be opened, ModelFileError if it is not a valid model file for these types.
+ */
+template<typename SpinT, typename EnergyT, typename FieldT>
+BasicIsing<SpinT, EnergyT, FieldT> load_model(std::string_view file, bool verify = false) {
+    TraceScope trace("load_model");
+    auto mapped = std::make_shared<MappedFile const>(file, false);
+    ModelFileHeader header{};
+    if (mapped->size() < sizeof(header)) {
+        throw ModelFileError(file, "too short for a model file");
+    }
+    std::memcpy(&header, mapped->data(), sizeof(header));
+    if (std::memcmp(header.magic, ModelFileHeader::k_magic, sizeof(header.magic)) != 0) {
+        throw ModelFileError(file, "not a model file");
+    }
+    if (header.checksum != header.compute_checksum()) {
+        throw ModelFileError(file, "header checksum mismatch");
+    }
+    if (header.version != ModelFileHeader::k_version) {
+        throw ModelFileError(file, "unsupported version " + std::to_string(header.version));
+    }
+    if (header.byte_order != ModelFileHeader::k_byte_order) {
+        throw ModelFileError(file, "written with another byte order");
+    }
+    if (header.node_size != sizeof(node_t) || header.energy_size != sizeof(EnergyT) || header.field_size != sizeof(FieldT)) {
+        throw ModelFileError(file, "written with other node, energy or field types");
+    }
+    if (header.file_size > mapped->size()) {
+        throw ModelFileError(file, "truncated");
+    }
+
+    using detail::mapped_array;
+    auto const n = header.node_count;
+    auto const m = header.entry_count;
+    if (n > static_cast<uint64_t>(std::numeric_limits<node_t>::max())) {
+        throw ModelFileError(file, "too many nodes");
+    }
+    auto const offsets = mapped_array<uint64_t>(*mapped, file, header.offsets_offset, n + 1);
+    if (offsets.front() != 0 || offsets.back() != m) {
+        throw ModelFileError(file, "offsets don't match the count of bonds");
+    }
+    auto const targets = mapped_array<node_t>(*mapped, file, header.targets_offset, m);
+    if (verify) {
+        TraceScope verify_trace("verify bonds");
+        for (std::size_t i = 0; i < n; ++i) {
+            if (offsets[i] > offsets[i + 1]) {
+                throw ModelFileError(file, "offsets decrease at node " + std::to_string(i));
+            }
+        }
+        for (auto const target : targets) {
+            if (target < 0 || static_cast<uint64_t>(target) >= n) {
+                throw ModelFileError(file, "bond to node " + std::to_string(target) + " out of range");
+            }
+        }
+    }
+    auto const labels = header.flags & ModelFileHeader::k_has_labels
+                      ? mapped_array<node_t>(*mapped, file, header.labels_offset, n)
+                      : std::span<node_t const>{};
+    if (!labels.empty()) {
+        std::vector<bool> seen(n);
+        for (auto const label : labels) {
+            if (label < 0 || static_cast<uint64_t>(label) >= n || seen[label]) {
+                throw ModelFileError(file, "labels are not a permutation of the nodes");
+            }
+            seen[label] = true;
+        }
+    }
+
+    BasicIsing<SpinT, EnergyT, FieldT> model{};
+    model.attach(mapped,
+                 mapped_array<FieldT>(*mapped, file, header.fields_offset, n),
+                 offsets,
+                 targets,
+                 mapped_array<EnergyT>(*mapped, file, header.couplings_offset, m),
+                 labels,
+                 static_cast<FieldT>(header.field_sum), static_cast<EnergyT>(header.coupling_sum));
+    return model;
+}
+
+/**
+ * @brief Convert a spins file and a bonds file into a binary model file.
+ * @param ordering An optional relabeling to bake into the file; see BasicIsing::reorder.
+ */
+template<typename SpinT, typename EnergyT, typename FieldT>
+void convert_model(std::string_view spin_file, std::string_view bond_file, std::string_view model_file,
+                   Ordering ordering = Ordering::k_none) {
+    BasicIsing<SpinT, EnergyT, FieldT> model{};
+    model.build(file_source<std::pair<node_t, FieldT>>(spin_file),
+                file_source<std::tuple<node_t, node_t, EnergyT>>(bond_file), ordering);
+    save_model(model, model_file);
+}
+
+/**
+ * @brief The bytes the model of a binary model file takes once loaded, from the counts in its header alone, so it
+ * can be checked against a memory limit before loading.
+ * @throw The file name if it can't be opened, ModelFileError if it doesn't start with a valid header.
+ */
+inline std::size_t model_file_bytes(std::string_view file) {
+    std::ifstream ifs(std::string(file), std::ios::binary);
+    if (!ifs) {
+        throw file;
+    }
+    ModelFileHeader header{};
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, ModelFileHeader::k_magic, sizeof(header.magic)) != 0
+        || header.checksum != header.compute_checksum()) {
+        throw ModelFileError(file, "not a model file");
+    }
+    return Ising::memory_bytes(static_cast<std::size_t>(header.node_count), static_cast<std::size_t>(header.entry_count / 2),
+                               (header.flags & ModelFileHeader::k_has_labels) != 0);
+}
+
+inline Ising load_ising(std::string_view file, bool verify = false) {
+    return load_model<spin_t, energy_t, field_t>(file, verify);
+}
+
+inline void convert_ising(std::string_view spin_file, std::string_view bond_file, std::string_view model_file,
+                          Ordering ordering = Ordering::k_none) {
+    convert_model<spin_t, energy_t, field_t>(spin_file, bond_file, model_file, ordering);
+}
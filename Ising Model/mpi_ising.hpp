@@ -0,0 +1,197 @@
+#pragma once
+#include <mpi.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "spin.hpp"
+#include "utility.hpp"
+
+extern thread_local double g_beta;
+
+/**
+ * @brief A from_grid lattice split into horizontal strips, one per MPI rank.
+ * No rank ever holds the whole lattice: each owns a band of rows plus one halo row on each side, holding copies
+ * of the neighbors' boundary rows. A sweep is a checkerboard sweep; between the two half-sweeps the boundary rows
+ * are exchanged, and after each sweep the energy and magnetization are reduced over all ranks, so every rank sees
+ * the global values.
+ * Like from_grid the boundaries are open, every bond has the same energy and the field is uniform.
+ *
+ * @tparam EnergyT Energy type; usually double.
+ */
+template<typename EnergyT>
+class BasicDistributedLattice {
+public:
+    /**
+     * @brief Create this rank's part of a row_ct x col_ct lattice with random spins.
+     * This is a collective call on comm.
+     * @param seed Seed of rank 0; the other ranks jump ahead from it, so a run is reproducible for a given rank count.
+     */
+    BasicDistributedLattice(MPI_Comm comm, node_t row_ct, node_t col_ct, EnergyT bond_energy = 1.0,
+                            EnergyT field = 0.0, uint64_t seed = 0)
+        : m_comm(comm), m_row_ct(row_ct), m_col_ct(col_ct), m_bond_energy(bond_energy), m_field(field), m_rng(seed) {
+
+        MPI_Comm_rank(comm, &m_rank);
+        MPI_Comm_size(comm, &m_rank_ct);
+        m_first_row = split(m_rank);
+        m_local_row_ct = split(m_rank + 1) - m_first_row;
+        m_above = m_rank > 0 ? m_rank - 1 : MPI_PROC_NULL;
+        m_below = m_rank + 1 < m_rank_ct ? m_rank + 1 : MPI_PROC_NULL;
+
+        for (int r = 0; r < m_rank; ++r) {
+            m_rng.jump();
+        }
+        // halo rows of the outermost strips stay 0, which is the same as having no bond there.
+        m_spins.assign(static_cast<std::size_t>(m_local_row_ct + 2) * col_ct, 0);
+        for (node_t r = 1; r <= m_local_row_ct; ++r) {
+            for (node_t c = 0; c < col_ct; ++c) {
+                at(r, c) = m_rng.uniform() < 0.5 ? -1 : 1;
+            }
+        }
+        this->exchange_halos();
+        this->recompute();
+    }
+
+    int rank() const noexcept {
+        return m_rank;
+    }
+
+    int rank_count() const noexcept {
+        return m_rank_ct;
+    }
+
+    node_t local_row_count() const noexcept {
+        return m_local_row_ct;
+    }
+
+    int64_t size() const noexcept {
+        return static_cast<int64_t>(m_row_ct) * m_col_ct;
+    }
+
+    EnergyT energy() const noexcept {
+        return m_energy;
+    }
+
+    double magnetization() const noexcept {
+        return m_sum / this->size();
+    }
+
+    /**
+     * @brief Stablize the system by performing several sweeps first.
+     */
+    void stablize() {
+        auto const k_stable_sweep_ct = 10;
+        this->markov_chain_monte_carlo([](auto const&) {}, k_stable_sweep_ct);
+    }
+
+    /**
+     * @brief Checkerboard Metropolis sweeps over the distributed lattice; a collective call on the communicator.
+     * @tparam F A callback type.
+     * @param callback Moniter the lattice every sweep, on every rank, after the global reduction.
+     * @param sweep_limit The count of sweeps.
+     */
+    template<typename F>
+    void markov_chain_monte_carlo(F&& callback, int sweep_limit = 1000) {
+        auto const beta = static_cast<EnergyT>(g_beta);
+        // the acceptance only depends on the spin and the sum of its (at most 4) neighbors.
+        EnergyT accept[2][9]{};
+        for (int s = 0; s < 2; ++s) {
+            for (int k = 0; k < 9; ++k) {
+                auto const spin = s ? 1 : -1;
+                auto const delta = -2 * spin * (m_field - m_bond_energy * (k - 4));
+                accept[s][k] = delta <= 0 ? 2.0 : std::exp(-beta * delta);
+            }
+        }
+
+        for (int sweep = 0; sweep < sweep_limit; ++sweep) {
+            double local[2]{};
+            for (int parity = 0; parity < 2; ++parity) {
+                for (node_t r = 1; r <= m_local_row_ct; ++r) {
+                    auto* const row = &at(r, 0);
+                    auto const* const up = row - m_col_ct;
+                    auto const* const down = row + m_col_ct;
+                    for (node_t c = (m_first_row + r - 1 + parity) % 2; c < m_col_ct; c += 2) {
+                        auto const left = c > 0 ? row[c - 1] : 0;
+                        auto const right = c + 1 < m_col_ct ? row[c + 1] : 0;
+                        auto const neighbor_sum = up[c] + down[c] + left + right;
+                        auto const spin = row[c];
+                        if (accept[spin > 0][neighbor_sum + 4] > m_rng.uniform()) {
+                            local[0] += -2 * spin * (m_field - m_bond_energy * neighbor_sum);
+                            local[1] += -2 * spin;
+                            row[c] = static_cast<int8_t>(-spin);
+                        }
+                    }
+                }
+                this->exchange_halos();
+            }
+            double global[2]{};
+            MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, m_comm);
+            m_energy += global[0];
+            m_sum += global[1];
+            callback(*this);
+        }
+    }
+
+private:
+    /**
+     * @brief The first global row of a rank; the remainder rows go to the lowest ranks.
+     */
+    node_t split(int rank) const noexcept {
+        auto const base = m_row_ct / m_rank_ct;
+        auto const extra = m_row_ct % m_rank_ct;
+        return rank * base + std::min<node_t>(rank, extra);
+    }
+
+    int8_t& at(node_t r, node_t c) noexcept {
+        return m_spins[static_cast<std::size_t>(r) * m_col_ct + c];
+    }
+
+    void exchange_halos() {
+        // the first owned row goes up while the halo below is filled from beneath, then the other way round.
+        MPI_Sendrecv(&at(1, 0), m_col_ct, MPI_INT8_T, m_above, 0,
+                     &at(m_local_row_ct + 1, 0), m_col_ct, MPI_INT8_T, m_below, 0, m_comm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(&at(m_local_row_ct, 0), m_col_ct, MPI_INT8_T, m_below, 1,
+                     &at(0, 0), m_col_ct, MPI_INT8_T, m_above, 1, m_comm, MPI_STATUS_IGNORE);
+    }
+
+    /**
+     * @brief Compute the global energy and spin sum from scratch; a collective call.
+     */
+    void recompute() {
+        double local[2]{};
+        for (node_t r = 1; r <= m_local_row_ct; ++r) {
+            for (node_t c = 0; c < m_col_ct; ++c) {
+                auto const spin = at(r, c);
+                local[0] += m_field * spin;
+                local[1] += spin;
+                // count every bond once, from its upper or left end; the halo below is 0 on the last rank.
+                auto const right = c + 1 < m_col_ct ? at(r, c + 1) : 0;
+                local[0] -= m_bond_energy * spin * (right + at(r + 1, c));
+            }
+        }
+        double global[2]{};
+        MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, m_comm);
+        m_energy = global[0];
+        m_sum = global[1];
+    }
+
+    MPI_Comm m_comm;
+    int m_rank{};
+    int m_rank_ct{};
+    int m_above{};
+    int m_below{};
+    node_t m_row_ct;
+    node_t m_col_ct;
+    node_t m_first_row{};
+    node_t m_local_row_ct{};
+    EnergyT m_bond_energy;
+    EnergyT m_field;
+    std::vector<int8_t> m_spins;
+    rng_t m_rng;
+    EnergyT m_energy{};
+    double m_sum{};
+};
+
+using DistributedLattice = BasicDistributedLattice<energy_t>;
@@ -0,0 +1,70 @@
+#include "mpi_ising.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+thread_local double g_beta = 0.4;
+
+/**
+ * Usage: mpirun -np N ./mpi_main [rows] [cols] [sweeps] [beta] (--weak)
+ * With --weak the rows are per rank, so the lattice grows with the rank count (weak scaling).
+ */
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+
+    int rank{}, rank_ct{};
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &rank_ct);
+
+    node_t row_ct = 1024;
+    node_t col_ct = 1024;
+    int sweep_ct = 100;
+    bool weak = false;
+    int position = 0;
+    for (int i = 1; i < argc; ++i) {
+        auto const arg = std::string_view(argv[i]);
+        if (arg == "--weak") {
+            weak = true;
+            continue;
+        }
+        switch (position++) {
+        case 0: row_ct = std::atoi(argv[i]); break;
+        case 1: col_ct = std::atoi(argv[i]); break;
+        case 2: sweep_ct = std::atoi(argv[i]); break;
+        case 3: g_beta = std::atof(argv[i]); break;
+        default: break;
+        }
+    }
+    if (weak) {
+        row_ct *= rank_ct;
+    }
+
+    DistributedLattice lattice(MPI_COMM_WORLD, row_ct, col_ct, 1.0, 0.0, 42);
+    lattice.stablize();
+
+    double abs_mag{};
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto const start = std::chrono::steady_clock::now();
+    lattice.markov_chain_monte_carlo([&abs_mag](auto const& self) { abs_mag += std::abs(self.magnetization()); }, sweep_ct);
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (rank == 0) {
+        auto const updates = static_cast<double>(lattice.size()) * sweep_ct;
+        std::cout << "ranks: " << rank_ct
+                  << " lattice: " << row_ct << "x" << col_ct
+                  << " sweeps: " << sweep_ct
+                  << " beta: " << g_beta << '\n'
+                  << "ms/sweep: " << seconds * 1e3 / sweep_ct
+                  << " ns/update/rank: " << seconds * 1e9 * rank_ct / updates
+                  << " updates/s: " << updates / seconds << '\n'
+                  << "E/N: " << lattice.energy() / lattice.size()
+                  << " <|M|>: " << abs_mag / sweep_ct << '\n';
+    }
+
+    MPI_Finalize();
+    return 0;
+}
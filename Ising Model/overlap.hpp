@@ -0,0 +1,274 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "spin.hpp"
+#include "trace.hpp"
+
+/**
+ * @brief A copy of a model's configuration taken at the end of a sweep, which recorders can read while the model
+ * keeps sweeping. It has the read interface the recorders use; the graph and the node order are read from the model,
+ * which must not be reordered or reattached while snapshots of it are in use.
+ */
+template<typename ModelT>
+class ConfigurationSnapshot {
+public:
+    using spin_type = std::remove_cvref_t<decltype(std::declval<ModelT const&>().spin(0))>;
+    using energy_type = std::remove_cvref_t<decltype(std::declval<ModelT const&>().energy())>;
+
+    /**
+     * @brief Copy the configuration of a model, reusing the storage of the previous copy.
+     */
+    void assign(ModelT const& model) {
+        auto const spins = model.spins();
+        m_spins.assign(spins.begin(), spins.end());
+        m_model = &model;
+        m_energy = model.energy();
+        m_magnetization = model.magnetization();
+        m_sweep_ct = model.sweep_count();
+    }
+
+    node_t size() const noexcept {
+        return static_cast<node_t>(m_spins.size());
+    }
+
+    spin_type spin(node_t n) const noexcept {
+        return m_spins[n];
+    }
+
+    std::span<spin_type const> spins() const noexcept {
+        return m_spins;
+    }
+
+    node_t index_of(node_t original) const noexcept {
+        return m_model->index_of(original);
+    }
+
+    node_t label(node_t n) const noexcept {
+        return m_model->label(n);
+    }
+
+    energy_type energy() const noexcept {
+        return m_energy;
+    }
+
+    double magnetization() const noexcept {
+        return m_magnetization;
+    }
+
+    uint64_t sweep_count() const noexcept {
+        return m_sweep_ct;
+    }
+
+    int64_t state() const noexcept {
+        using STraits = SpinTraits<spin_type>;
+        auto const base = static_cast<int64_t>(STraits::state_count());
+        int64_t result{};
+        for (node_t n = 0; n < this->size(); ++n) {
+            result = result * base + STraits::index(m_spins[this->index_of(n)]);
+        }
+        return result;
+    }
+
+private:
+    std::vector<spin_type> m_spins;
+    ModelT const* m_model = nullptr;
+    energy_type m_energy{};
+    double m_magnetization{};
+    uint64_t m_sweep_ct{};
+};
+
+/**
+ * @brief A callback for markov_chain_monte_carlo() that measures on snapshots in worker threads, so heavy recorders,
+ * e.g. a CorrelationRecorder, overlap the following sweeps instead of blocking them.
+ * Each call copies the configuration into the next of depth rotating buffers and returns; the recorders are dealt
+ * out to the workers, and every worker runs its recorders on every snapshot in sweep order. The samples are thus the
+ * same as with the recorders called in the loop whatever the timing, and nothing touches the model's random engine.
+ * When every buffer still waits for a worker, the call blocks until one is free, so a slow measurement slows the
+ * loop down rather than piling up snapshots.
+ * The workers are threads of their own, not ThreadPool tasks, since they block waiting for snapshots; the recorders
+ * they run may use the pool.
+ * @tparam ModelT The model type; the recorders get a ConfigurationSnapshot<ModelT>.
+ */
+template<typename ModelT>
+class OverlappedMeasurement {
+public:
+    using Snapshot = ConfigurationSnapshot<ModelT>;
+    using Hook = std::function<void(Snapshot const&)>;
+
+    /**
+     * @param thread_ct The count of workers; recorders beyond it share workers.
+     * @param depth The count of snapshot buffers, 2 for double and 3 for triple buffering.
+     */
+    explicit OverlappedMeasurement(unsigned thread_ct = 1, std::size_t depth = 3)
+        : m_slots(std::max<std::size_t>(depth, 2)), m_lanes(std::max(thread_ct, 1u)) {
+        for (auto& lane : m_lanes) {
+            lane.worker = std::jthread([this, &lane](std::stop_token token) { this->run(token, lane); });
+        }
+    }
+
+    OverlappedMeasurement(OverlappedMeasurement const&) = delete;
+    OverlappedMeasurement& operator =(OverlappedMeasurement const&) = delete;
+
+    ~OverlappedMeasurement() {
+        try {
+            this->wait();
+        }
+        catch (...) {
+            // nothing to report to from a destructor.
+        }
+        for (auto& lane : m_lanes) {
+            lane.worker.request_stop();
+        }
+    }
+
+    /**
+     * @brief Measure a recorder on the snapshots. Recorders passed as lvalues are kept by reference; rvalues are
+     * moved in. Only allowed before the first snapshot.
+     * @throw std::logic_error after the first snapshot.
+     */
+    template<typename R>
+    OverlappedMeasurement& add(R&& recorder) {
+        std::scoped_lock lock(m_mutex);
+        if (m_published_ct > 0) {
+            throw std::logic_error("Recorders can't be added once measuring started.");
+        }
+        auto& lane = m_lanes[m_hook_ct++ % m_lanes.size()];
+        if constexpr (std::is_lvalue_reference_v<R>) {
+            lane.hooks.emplace_back(std::ref(recorder));
+        }
+        else {
+            lane.hooks.emplace_back(std::move(recorder));
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Publish a snapshot of the model to the workers, waiting for a free buffer first.
+     * @throw What a recorder threw on an earlier snapshot.
+     */
+    void operator ()(ModelT const& model) {
+        auto& slot = m_slots[m_published_ct % m_slots.size()];
+        {
+            std::unique_lock lock(m_mutex);
+            this->rethrow();
+            if (slot.pending > 0) {
+                TraceScope trace("wait for buffer");
+                ++m_stall_ct;
+                m_free.wait(lock, [&slot] { return slot.pending == 0; });
+            }
+        }
+        // no worker reads the slot until it's published.
+        {
+            TraceScope trace("snapshot");
+            slot.snapshot.assign(model);
+        }
+        {
+            std::scoped_lock lock(m_mutex);
+            slot.pending = m_lanes.size();
+            ++m_published_ct;
+        }
+        m_ready.notify_all();
+    }
+
+    /**
+     * @brief Wait until every published snapshot is measured, e.g. before reading the recorders.
+     * @throw What a recorder threw.
+     */
+    void wait() {
+        std::unique_lock lock(m_mutex);
+        m_free.wait(lock, [this] {
+            return std::ranges::all_of(m_slots, [](Slot const& slot) { return slot.pending == 0; });
+        });
+        this->rethrow();
+    }
+
+    /**
+     * @brief The count of snapshots published so far.
+     */
+    uint64_t snapshot_count() const {
+        std::scoped_lock lock(m_mutex);
+        return m_published_ct;
+    }
+
+    /**
+     * @brief The count of snapshots that had to wait for a free buffer, i.e. the measurements fell behind.
+     */
+    uint64_t stall_count() const {
+        std::scoped_lock lock(m_mutex);
+        return m_stall_ct;
+    }
+
+private:
+    struct Slot {
+        Snapshot snapshot;
+        // the count of workers yet to measure the snapshot.
+        std::size_t pending{};
+    };
+
+    struct Lane {
+        std::vector<Hook> hooks;
+        std::jthread worker;
+    };
+
+    /**
+     * @brief Call with m_mutex held.
+     */
+    void rethrow() {
+        if (m_error) {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+    void run(std::stop_token token, Lane& lane) {
+        Tracer::instance().name_thread("measurement lane");
+        for (uint64_t next = 0;; ++next) {
+            {
+                std::unique_lock lock(m_mutex);
+                if (!m_ready.wait(lock, token, [this, next] { return m_published_ct > next; })) {
+                    return;
+                }
+            }
+            auto& slot = m_slots[next % m_slots.size()];
+            std::exception_ptr error{};
+            try {
+                TraceScope trace("measure");
+                for (auto const& hook : lane.hooks) {
+                    hook(slot.snapshot);
+                }
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::scoped_lock lock(m_mutex);
+                if (error && !m_error) {
+                    m_error = error;
+                }
+                --slot.pending;
+            }
+            m_free.notify_all();
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    mutable std::mutex m_mutex;
+    std::condition_variable_any m_ready;
+    std::condition_variable m_free;
+    uint64_t m_published_ct{};
+    uint64_t m_stall_ct{};
+    std::size_t m_hook_ct{};
+    std::exception_ptr m_error;
+    // declared last, so the workers start after everything they use is constructed.
+    std::vector<Lane> m_lanes;
+};
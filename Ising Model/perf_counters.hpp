@@ -0,0 +1,342 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__linux__)
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#   define ISING_HAS_PERF 1
+#endif
+
+/**
+ * @brief Hardware event counts and the wall time, either cumulative (PerfCounters::read()) or of an interval.
+ */
+struct PerfSample {
+    enum Event { k_cycles, k_instructions, k_cache_references, k_cache_misses, k_branch_misses, k_dtlb_misses, k_event_ct };
+
+    static constexpr char const* k_names[k_event_ct] = {
+        "cycles", "instructions", "cache references", "cache misses", "branch misses", "dTLB misses",
+    };
+
+    std::array<uint64_t, k_event_ct> counts{};
+    uint64_t wall_ns{};
+
+    PerfSample& operator +=(PerfSample const& other) noexcept {
+        for (std::size_t e = 0; e < k_event_ct; ++e) {
+            counts[e] += other.counts[e];
+        }
+        wall_ns += other.wall_ns;
+        return *this;
+    }
+
+    friend PerfSample operator -(PerfSample lhs, PerfSample const& rhs) noexcept {
+        for (std::size_t e = 0; e < k_event_ct; ++e) {
+            lhs.counts[e] -= rhs.counts[e];
+        }
+        lhs.wall_ns -= rhs.wall_ns;
+        return lhs;
+    }
+
+    double ipc() const noexcept {
+        return counts[k_cycles] ? static_cast<double>(counts[k_instructions]) / static_cast<double>(counts[k_cycles]) : 0.0;
+    }
+
+    double cache_miss_rate() const noexcept {
+        return counts[k_cache_references]
+             ? static_cast<double>(counts[k_cache_misses]) / static_cast<double>(counts[k_cache_references]) : 0.0;
+    }
+};
+
+/**
+ * @brief A group of hardware counters of the calling thread, through Linux perf_event_open: cycles, instructions,
+ * last-level cache references and misses, branch misses and dTLB load misses. The events are scheduled together, so ratios like IPC are consistent; when the PMU multiplexes the
+ * counts are scaled by the time the group actually ran. Worker threads aren't counted, since group reads can't
+ * follow inherited counters, so a threaded engine shows only its calling thread's share.
+ * Counters are often unavailable, e.g. on other systems, in containers or with a restrictive
+ * /proc/sys/kernel/perf_event_paranoid; the object is then still usable, reads give only the wall time, and
+ * error() says why. Events the CPU lacks are left out individually (see has()).
+ */
+class PerfCounters {
+public:
+    PerfCounters() {
+        m_fds.fill(-1);
+        m_start = std::chrono::steady_clock::now();
+#ifdef ISING_HAS_PERF
+        constexpr std::pair<uint32_t, uint64_t> k_events[PerfSample::k_event_ct] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+        };
+        for (std::size_t e = 0; e < PerfSample::k_event_ct; ++e) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = k_events[e].first;
+            attr.config = k_events[e].second;
+            attr.disabled = m_leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            auto const fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, m_leader, 0));
+            if (fd < 0) {
+                if (m_error.empty()) {
+                    m_error = std::string(PerfSample::k_names[e]) + ": " + std::strerror(errno);
+                    if (errno == EACCES || errno == EPERM) {
+                        m_error += " (see /proc/sys/kernel/perf_event_paranoid)";
+                    }
+                }
+                continue;
+            }
+            m_fds[e] = fd;
+            ioctl(fd, PERF_EVENT_IOC_ID, &m_ids[e]);
+            if (m_leader < 0) {
+                m_leader = fd;
+            }
+        }
+        if (m_leader < 0) {
+            return;
+        }
+        m_error.clear();
+        ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+        m_error = "hardware counters need Linux perf_event_open";
+#endif
+    }
+
+    PerfCounters(PerfCounters const&) = delete;
+    PerfCounters& operator =(PerfCounters const&) = delete;
+
+    ~PerfCounters() {
+#ifdef ISING_HAS_PERF
+        for (auto const fd : m_fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    bool available() const noexcept {
+        return m_leader >= 0;
+    }
+
+    bool has(PerfSample::Event event) const noexcept {
+        return m_fds[event] >= 0;
+    }
+
+    /**
+     * @brief Why the counters are unavailable; empty if they are.
+     */
+    std::string const& error() const noexcept {
+        return m_error;
+    }
+
+    /**
+     * @brief The counts since construction; a read is a system call, about a microsecond.
+     */
+    PerfSample read() const noexcept {
+        PerfSample sample{};
+        sample.wall_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start).count());
+#ifdef ISING_HAS_PERF
+        if (m_leader < 0) {
+            return sample;
+        }
+        struct {
+            uint64_t nr;
+            uint64_t time_enabled;
+            uint64_t time_running;
+            struct {
+                uint64_t value;
+                uint64_t id;
+            } values[PerfSample::k_event_ct];
+        } data{};
+        if (::read(m_leader, &data, sizeof(data)) <= 0) {
+            return sample;
+        }
+        auto const scale = data.time_running ? static_cast<double>(data.time_enabled) / static_cast<double>(data.time_running) : 1.0;
+        for (uint64_t i = 0; i < data.nr && i < PerfSample::k_event_ct; ++i) {
+            for (std::size_t e = 0; e < PerfSample::k_event_ct; ++e) {
+                if (m_fds[e] >= 0 && m_ids[e] == data.values[i].id) {
+                    sample.counts[e] = static_cast<uint64_t>(static_cast<double>(data.values[i].value) * scale);
+                }
+            }
+        }
+#endif
+        return sample;
+    }
+
+private:
+    int m_leader = -1;
+    std::array<int, PerfSample::k_event_ct> m_fds{};
+    std::array<uint64_t, PerfSample::k_event_ct> m_ids{};
+    std::chrono::steady_clock::time_point m_start;
+    std::string m_error;
+};
+
+/**
+ * @brief Hardware counts attributed to named phases, e.g. "load", "sweep" and "recorders". One counter group runs
+ * all along; switching phases reads it and adds the difference to the phase being left, so the phases don't
+ * overlap and nothing between them is lost. Without counters the phases still get their wall time.
+ */
+class PerfProfile {
+public:
+    struct Phase {
+        PerfSample total;
+        uint64_t count;
+    };
+
+    /**
+     * @brief Switch to a phase, or to none for an empty name.
+     * @return The phase left, to come back to it.
+     */
+    std::string enter(std::string_view phase) {
+        auto const now = m_counters.read();
+        if (!m_current.empty()) {
+            auto& current = m_phases[m_current];
+            current.total += now - m_last;
+        }
+        if (!phase.empty()) {
+            auto it = m_phases.find(phase);
+            if (it == m_phases.end()) {
+                it = m_phases.emplace(std::string(phase), Phase{}).first;
+            }
+            ++it->second.count;
+        }
+        m_last = now;
+        return std::exchange(m_current, std::string(phase));
+    }
+
+    PerfCounters const& counters() const noexcept {
+        return m_counters;
+    }
+
+    std::map<std::string, Phase, std::less<>> const& phases() const noexcept {
+        return m_phases;
+    }
+
+    bool empty() const noexcept {
+        return m_phases.empty();
+    }
+
+    void reset() {
+        m_phases.clear();
+        m_current.clear();
+    }
+
+    /**
+     * @brief Per phase: the times entered, the wall time, and the counts in total and per entry.
+     */
+    void report(std::ostream& os) const {
+        if (!m_counters.available()) {
+            os << "Hardware counters unavailable: " << m_counters.error() << "; wall times only." << '\n';
+        }
+        for (auto const& [name, phase] : m_phases) {
+            auto const per = static_cast<double>(std::max<uint64_t>(phase.count, 1));
+            os << "  " << std::setw(12) << std::left << name << phase.count << " times, "
+               << static_cast<double>(phase.total.wall_ns) * 1e-6 << " ms";
+            if (m_counters.available()) {
+                os << ", IPC " << phase.total.ipc() << ", cache miss rate " << phase.total.cache_miss_rate();
+            }
+            os << '\n';
+            for (std::size_t e = 0; e < PerfSample::k_event_ct; ++e) {
+                if (m_counters.has(static_cast<PerfSample::Event>(e))) {
+                    os << "    " << std::setw(18) << std::left << PerfSample::k_names[e] << std::setw(16) << phase.total.counts[e]
+                       << static_cast<double>(phase.total.counts[e]) / per << " per time" << '\n';
+                }
+            }
+        }
+    }
+
+private:
+    PerfCounters m_counters;
+    std::map<std::string, Phase, std::less<>> m_phases;
+    std::string m_current;
+    PerfSample m_last;
+};
+
+/**
+ * @brief Attribute a scope to a phase of a profile, if any, and return to the previous phase after.
+ */
+class PerfScope {
+public:
+    PerfScope(PerfProfile* profile, std::string_view phase)
+        : m_profile(profile) {
+        if (m_profile) {
+            m_previous = m_profile->enter(phase);
+        }
+    }
+
+    PerfScope(PerfScope const&) = delete;
+    PerfScope& operator =(PerfScope const&) = delete;
+
+    ~PerfScope() {
+        if (m_profile) {
+            m_profile->enter(m_previous);
+        }
+    }
+
+private:
+    PerfProfile* m_profile;
+    std::string m_previous;
+};
+
+/**
+ * @brief Wrap a markov_chain_monte_carlo() callback so a profile attributes the sweeps to "sweep" and the callback
+ * to "recorders"; enter "sweep" before the run and leave it after, e.g. with a PerfScope. "sweep" is then entered
+ * once more than there are sweeps, the last time only to be left. The substeps and stop requests of a
+ * MeasurementScheduler are passed through.
+ */
+template<typename F>
+class ProfiledSweeps {
+public:
+    ProfiledSweeps(PerfProfile& profile, F& callback)
+        : m_profile(&profile), m_callback(&callback) {}
+
+    template<typename ModelT>
+    void operator ()(ModelT const& self) {
+        m_profile->enter("recorders");
+        (*m_callback)(self);
+        m_profile->enter("sweep");
+    }
+
+    unsigned substep_count() const requires requires(F& f) { f.substep_count(); } {
+        return m_callback->substep_count();
+    }
+
+    template<typename ModelT>
+    void substep(ModelT const& self, unsigned k) requires requires(F& f) { f.substep(self, k); } {
+        m_profile->enter("recorders");
+        m_callback->substep(self, k);
+        m_profile->enter("sweep");
+    }
+
+    bool stop_requested() const requires requires(F& f) { f.stop_requested(); } {
+        return m_callback->stop_requested();
+    }
+
+private:
+    PerfProfile* m_profile;
+    F* m_callback;
+};
+
+template<typename F>
+ProfiledSweeps<F> profile_sweeps(PerfProfile& profile, F& callback) {
+    return ProfiledSweeps<F>(profile, callback);
+}
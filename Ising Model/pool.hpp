@@ -0,0 +1,538 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <stop_token>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+#include "trace.hpp"
+
+/**
+ * @brief The process-wide work-stealing scheduler that the parallel parts share, so that nested and concurrent
+ * parallel work (a colored sweep inside a parallel for, measurements inside a job) runs on one set of threads
+ * instead of each spawning its own and oversubscribing the cores.
+ * Every worker has a deque of its own: it pushes the tasks it forks and pops them back in LIFO order, while idle
+ * workers steal the oldest, i.e. the largest pieces of a split, from the other end. Threads outside the pool, e.g.
+ * the main thread or a REPL job, push onto a shared queue instead, and while waiting for their tasks run those of
+ * them not yet taken. A thread waiting for a TaskGroup helps with the work rather than blocking, and only sleeps
+ * once nothing is left it can take. The deques are plain locked ones: a task is at least a chunk of a class of a
+ * sweep, so the lock is noise next to it.
+ * Tasks may run on any thread, so they must not rely on thread-local state, g_beta in particular; one that sets
+ * g_beta restores it before returning (see ScopedBeta), since a waiting thread may run it in the middle of its own
+ * work.
+ */
+class ThreadPool {
+public:
+    // the rounds a thread looks for work, yielding in between, before it sleeps.
+    static constexpr unsigned k_spin_ct = 64;
+
+    /**
+     * @brief The counters of a worker, or of the threads outside the pool together.
+     */
+    struct Stats {
+        // tasks run.
+        uint64_t task_ct;
+        // tasks taken from another thread: from the shared queue or the deque of another worker.
+        uint64_t steal_ct;
+        // rounds that found no task anywhere.
+        uint64_t failed_steal_ct;
+        // times gone to sleep for lack of work, and the time asleep.
+        uint64_t sleep_ct;
+        double idle_seconds;
+    };
+
+    /**
+     * @brief Tasks forked together and joined by wait(). Tasks may fork further tasks into the group.
+     */
+    class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool& pool = ThreadPool::instance()) noexcept
+            : m_pool(&pool) {}
+
+        TaskGroup(TaskGroup const&) = delete;
+        TaskGroup& operator =(TaskGroup const&) = delete;
+
+        ~TaskGroup() {
+            try {
+                this->wait();
+            }
+            catch (...) {
+                // nothing to report to from a destructor; wait() is where errors surface.
+            }
+        }
+
+        /**
+         * @brief Fork a task; it may run on any thread of the pool, or on the one waiting.
+         */
+        template<typename F>
+        void run(F&& f) {
+            m_pending.fetch_add(1, std::memory_order_relaxed);
+            m_pool->push(Task{ std::forward<F>(f), this });
+        }
+
+        /**
+         * @brief Run tasks until those of the group are done.
+         * @throw The first exception a task of the group threw.
+         */
+        void wait() {
+            m_pool->wait(*this);
+            std::scoped_lock lock(m_error_mutex);
+            if (m_error) {
+                std::rethrow_exception(std::exchange(m_error, nullptr));
+            }
+        }
+
+    private:
+        friend class ThreadPool;
+
+        ThreadPool* m_pool;
+        std::atomic<std::size_t> m_pending{};
+        std::mutex m_error_mutex;
+        std::exception_ptr m_error;
+    };
+
+    /**
+     * @param worker_ct The count of workers; 0 for one less than the hardware threads, as the thread waiting for
+     * its tasks works on them too, but at least one.
+     * @param pin Whether to pin the workers to a core each, on Linux; elsewhere it does nothing.
+     */
+    explicit ThreadPool(unsigned worker_ct = 0, bool pin = false)
+        : m_worker_ct(worker_ct ? worker_ct : std::max(std::thread::hardware_concurrency(), 2u) - 1), m_pinned(pin),
+          m_queues(m_worker_ct + 1), m_counters(m_worker_ct + 1), m_reset(Clock::now()) {
+        // made before the workers use it, so it outlives the pool.
+        Tracer::instance();
+        m_workers.reserve(m_worker_ct);
+        for (unsigned w = 0; w < m_worker_ct; ++w) {
+            m_workers.emplace_back([this, w](std::stop_token token) { this->work(w, token); });
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator =(ThreadPool const&) = delete;
+
+    ~ThreadPool() {
+        for (auto& worker : m_workers) {
+            worker.request_stop();
+        }
+    }
+
+    /**
+     * @brief The pool of the process, made on first use as configure() last said.
+     */
+    static ThreadPool& instance() {
+        static ThreadPool pool(s_worker_ct, s_pin);
+        return pool;
+    }
+
+    /**
+     * @brief Size the pool of the process; only has an effect before its first use.
+     */
+    static void configure(unsigned worker_ct, bool pin) noexcept {
+        s_worker_ct = worker_ct;
+        s_pin = pin;
+    }
+
+    unsigned worker_count() const noexcept {
+        return m_worker_ct;
+    }
+
+    /**
+     * @brief How many parts are worth splitting work into: the workers and the thread waiting.
+     */
+    unsigned concurrency() const noexcept {
+        return m_worker_ct + 1;
+    }
+
+    /**
+     * @brief Run f(begin, end) over subranges of [begin, end) of at most grain elements, in parallel. The range is
+     * split in halves lazily: the calling thread keeps the first half and forks the second, so idle workers steal the
+     * largest pieces left and a range nobody steals costs no more than a loop.
+     * @throw The first exception f threw, once all the subranges ended.
+     */
+    template<typename F>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F const& f) {
+        grain = std::max<std::size_t>(grain, 1);
+        if (end - begin <= grain) {
+            if (begin < end) {
+                f(begin, end);
+            }
+            return;
+        }
+        TaskGroup group(*this);
+        this->split(group, begin, end, grain, f);
+        group.wait();
+    }
+
+    /**
+     * @brief parallel_for() with a grain leaving about four pieces per thread, for balance.
+     */
+    template<typename F>
+    void parallel_for(std::size_t begin, std::size_t end, F const& f) {
+        auto const piece_ct = 4 * static_cast<std::size_t>(this->concurrency());
+        this->parallel_for(begin, end, (end - begin + piece_ct - 1) / piece_ct, f);
+    }
+
+    /**
+     * @brief Run f and g in parallel and return when both did.
+     */
+    template<typename F, typename G>
+    void invoke(F&& f, G&& g) {
+        TaskGroup group(*this);
+        group.run(std::forward<G>(g));
+        f();
+        group.wait();
+    }
+
+    /**
+     * @brief The counters of every worker, and last those of the threads outside the pool.
+     */
+    std::vector<Stats> stats() const {
+        auto const now = Clock::now();
+        auto const reset = m_reset.load();
+        std::vector<Stats> result{};
+        for (auto const& counters : m_counters) {
+            auto idle = std::chrono::nanoseconds(counters.idle_ns.load(std::memory_order_relaxed));
+            // a worker asleep right now has slept since then, too.
+            if (auto const since = counters.asleep_since.load(std::memory_order_relaxed); since != Clock::time_point{}) {
+                idle += now - std::max(since, reset);
+            }
+            result.push_back({
+                counters.task_ct.load(std::memory_order_relaxed),
+                counters.steal_ct.load(std::memory_order_relaxed),
+                counters.failed_steal_ct.load(std::memory_order_relaxed),
+                counters.sleep_ct.load(std::memory_order_relaxed),
+                std::chrono::duration<double>(idle).count(),
+            });
+        }
+        return result;
+    }
+
+    void reset_stats() noexcept {
+        for (auto& counters : m_counters) {
+            counters.task_ct = 0;
+            counters.steal_ct = 0;
+            counters.failed_steal_ct = 0;
+            counters.sleep_ct = 0;
+            counters.idle_ns = 0;
+        }
+        m_reset.store(Clock::now());
+    }
+
+    /**
+     * @brief Print the counters of every worker, with the share of the time since the last reset it slept.
+     */
+    void report(std::ostream& os) const {
+        auto const stats = this->stats();
+        auto const seconds = std::chrono::duration<double>(Clock::now() - m_reset.load()).count();
+        os << "Pool: " << m_worker_ct << " workers" << (m_pinned ? ", pinned" : "") << ", " << std::setprecision(4)
+           << seconds << " s since reset" << '\n';
+        os << "  " << std::left << std::setw(10) << "worker" << std::setw(12) << "tasks" << std::setw(12) << "steals"
+           << std::setw(12) << "no work" << std::setw(10) << "sleeps" << "idle" << '\n';
+        Stats total{};
+        for (std::size_t w = 0; w < stats.size(); ++w) {
+            auto const& s = stats[w];
+            os << "  " << std::setw(10) << (w < m_worker_ct ? std::to_string(w) : std::string("outside"))
+               << std::setw(12) << s.task_ct << std::setw(12) << s.steal_ct << std::setw(12) << s.failed_steal_ct
+               << std::setw(10) << s.sleep_ct;
+            if (w < m_worker_ct) {
+                os << (seconds > 0 ? 100 * s.idle_seconds / seconds : 0.0) << '%';
+            }
+            os << '\n';
+            total.task_ct += s.task_ct;
+            total.steal_ct += s.steal_ct;
+        }
+        os << "  " << total.task_ct << " tasks, " << (total.task_ct ? 100.0 * total.steal_ct / total.task_ct : 0.0)
+           << "% stolen" << std::setprecision(6) << std::right << '\n';
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+        std::function<void()> run;
+        TaskGroup* group = nullptr;
+    };
+
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> task_ct{};
+        std::atomic<uint64_t> steal_ct{};
+        std::atomic<uint64_t> failed_steal_ct{};
+        std::atomic<uint64_t> sleep_ct{};
+        std::atomic<uint64_t> idle_ns{};
+        // when the worker went to sleep, or the epoch while it's awake; not kept for the threads outside.
+        std::atomic<Clock::time_point> asleep_since{};
+    };
+
+    /**
+     * @brief The pool a thread works for and its index there.
+     */
+    struct Current {
+        ThreadPool* pool;
+        unsigned index;
+    };
+
+    /**
+     * @brief The worker index of the calling thread, or m_worker_ct outside the pool.
+     */
+    unsigned self() const noexcept {
+        return s_current.pool == this ? s_current.index : m_worker_ct;
+    }
+
+    template<typename F>
+    void split(TaskGroup& group, std::size_t begin, std::size_t end, std::size_t grain, F const& f) {
+        while (end - begin > grain) {
+            auto const middle = begin + (end - begin) / 2;
+            group.run([this, &group, middle, end, grain, &f] { this->split(group, middle, end, grain, f); });
+            end = middle;
+        }
+        f(begin, end);
+    }
+
+    void push(Task task) {
+        auto& queue = m_queues[this->self()];
+        {
+            std::scoped_lock lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        m_queued_ct.fetch_add(1);
+        this->wake();
+    }
+
+    void wake() {
+        // pairs with the sleeper counting itself before it checks for work.
+        if (m_sleeper_ct.load() > 0) {
+            {
+                std::scoped_lock lock(m_sleep_mutex);
+            }
+            m_wake.notify_all();
+        }
+    }
+
+    /**
+     * @brief Take a task: a worker its newest own one, else the oldest shared one, else steals the oldest of
+     * another worker; a thread outside the pool only the newest shared one of the group it waits for, so it isn't
+     * held up by unrelated work.
+     */
+    bool take(unsigned self, Task& task, TaskGroup const* group) {
+        auto const pop = [this, &task](Queue& queue, bool newest, TaskGroup const* of) {
+            std::scoped_lock lock(queue.mutex);
+            auto& tasks = queue.tasks;
+            if (of) {
+                auto const it = std::find_if(tasks.rbegin(), tasks.rend(), [of](Task const& t) { return t.group == of; });
+                if (it == tasks.rend()) {
+                    return false;
+                }
+                task = std::move(*it);
+                tasks.erase(std::next(it).base());
+            }
+            else if (tasks.empty()) {
+                return false;
+            }
+            else if (newest) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            }
+            else {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            m_queued_ct.fetch_sub(1);
+            return true;
+        };
+
+        if (self == m_worker_ct) {
+            return m_queued_ct.load() > 0 && pop(m_queues[m_worker_ct], true, group);
+        }
+        if (m_queued_ct.load() > 0) {
+            if (pop(m_queues[self], true, nullptr)) {
+                return true;
+            }
+            for (unsigned k = 0; k < m_worker_ct; ++k) {
+                // the shared queue first, then the other workers.
+                if (pop(m_queues[k == 0 ? m_worker_ct : (self + k) % m_worker_ct], false, nullptr)) {
+                    m_counters[self].steal_ct.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        m_counters[self].failed_steal_ct.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void execute(Task& task, unsigned self) {
+        auto* group = task.group;
+        try {
+            task.run();
+        }
+        catch (...) {
+            std::scoped_lock lock(group->m_error_mutex);
+            if (!group->m_error) {
+                group->m_error = std::current_exception();
+            }
+        }
+        // what the task holds goes before its group may.
+        task.run = nullptr;
+        m_counters[self].task_ct.fetch_add(1, std::memory_order_relaxed);
+        // the group may be gone once its last task is counted off, so only the pool is touched after.
+        if (group->m_pending.fetch_sub(1) == 1) {
+            this->wake();
+        }
+    }
+
+    void wait(TaskGroup& group) {
+        auto const self = this->self();
+        auto const outside = self == m_worker_ct;
+        unsigned round = 0;
+        while (group.m_pending.load() > 0) {
+            Task task{};
+            if (this->take(self, task, outside ? &group : nullptr)) {
+                this->execute(task, self);
+                round = 0;
+            }
+            else if (++round < k_spin_ct) {
+                std::this_thread::yield();
+            }
+            else {
+                round = 0;
+                this->sleep(self, [this, &group, outside] {
+                    return group.m_pending.load() == 0 || (!outside && m_queued_ct.load() > 0);
+                });
+            }
+        }
+    }
+
+    template<typename P>
+    void sleep(unsigned self, P const& ready, std::stop_token const& token = {}) {
+        auto& counters = m_counters[self];
+        auto const worker = self < m_worker_ct;
+        auto const start = Clock::now();
+        counters.sleep_ct.fetch_add(1, std::memory_order_relaxed);
+        if (worker) {
+            counters.asleep_since.store(start, std::memory_order_relaxed);
+        }
+        {
+            std::unique_lock lock(m_sleep_mutex);
+            ++m_sleeper_ct;
+            m_wake.wait(lock, token, ready);
+            --m_sleeper_ct;
+        }
+        if (worker) {
+            counters.asleep_since.store({}, std::memory_order_relaxed);
+        }
+        // only the part since the last reset counts.
+        auto const idle = Clock::now() - std::max(start, m_reset.load());
+        counters.idle_ns.fetch_add(static_cast<uint64_t>(std::max<int64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count(), 0)), std::memory_order_relaxed);
+    }
+
+    void work(unsigned self, std::stop_token token) {
+        Tracer::instance().name_thread("pool worker");
+        s_current = { this, self };
+#if defined(__linux__)
+        if (m_pinned) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(self % std::max(std::thread::hardware_concurrency(), 1u), &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#endif
+        unsigned round = 0;
+        while (!token.stop_requested()) {
+            Task task{};
+            if (this->take(self, task, nullptr)) {
+                this->execute(task, self);
+                round = 0;
+            }
+            else if (++round < k_spin_ct) {
+                std::this_thread::yield();
+            }
+            else {
+                round = 0;
+                this->sleep(self, [this] { return m_queued_ct.load() > 0; }, token);
+            }
+        }
+    }
+
+    static inline unsigned s_worker_ct = 0;
+    static inline bool s_pin = false;
+    static inline thread_local Current s_current{};
+
+    unsigned m_worker_ct;
+    bool m_pinned;
+    std::vector<Queue> m_queues;
+    std::vector<Counters> m_counters;
+    std::atomic<Clock::time_point> m_reset;
+    // the tasks in all the queues.
+    std::atomic<std::size_t> m_queued_ct{};
+    std::mutex m_sleep_mutex;
+    std::condition_variable_any m_wake;
+    std::atomic<unsigned> m_sleeper_ct{};
+    // last, so the rest is ready when they start and they end before the rest goes.
+    std::vector<std::jthread> m_workers;
+};
+
+using TaskGroup = ThreadPool::TaskGroup;
+
+/**
+ * @brief Run f(k) for every k in [0, count) on thread_ct threads, the calling one and threads of their own named name,
+ * each taking the next k in turn. It is for long pieces of work, e.g. whole simulations, which on the ThreadPool
+ * would hold its workers away from the fork-join tasks, and could be picked up by a thread helping while it waits
+ * for a TaskGroup, leaving it stuck long after its own group is done. What f does in parallel still goes to the pool.
+ * @throw The first exception f threw, once the threads ended; no further k is taken after it.
+ */
+template<typename F>
+void run_on_threads(std::string_view name, std::size_t count, std::size_t thread_ct, F const& f) {
+    std::atomic<std::size_t> next{};
+    std::mutex error_mutex;
+    std::exception_ptr error{};
+    auto const work = [&] {
+        for (std::size_t k; (k = next++) < count;) {
+            try {
+                f(k);
+            }
+            catch (...) {
+                std::scoped_lock lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+    {
+        std::vector<std::jthread> threads{};
+        for (std::size_t t = 1; t < std::min(thread_ct, count); ++t) {
+            threads.emplace_back([&] {
+                Tracer::instance().name_thread(name);
+                work();
+            });
+        }
+        work();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
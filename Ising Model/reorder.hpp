@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "spin.hpp"
+
+/**
+ * @brief Node orderings that improve memory locality of the neighbor lists.
+ * k_bfs: breadth-first order, k_rcm: reverse Cuthill-McKee, k_hilbert: along a Hilbert curve (needs coordinates).
+ */
+enum struct Ordering {
+    k_none, k_bfs, k_rcm, k_hilbert
+};
+
+inline std::optional<Ordering> ordering_of(std::string_view name) noexcept {
+    using enum Ordering;
+    if (name == "none") {
+        return k_none;
+    }
+    else if (name == "bfs") {
+        return k_bfs;
+    }
+    else if (name == "rcm") {
+        return k_rcm;
+    }
+    else if (name == "hilbert") {
+        return k_hilbert;
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Breadth-first order of a graph, one component after another.
+ * @param n The count of nodes.
+ * @param neighbors A callable mapping a 0-indexed node to a range of (neighbor, coupling) pairs.
+ * @param by_degree Visit the neighbors of a node in increasing degree, as Cuthill-McKee does.
+ * @return order[k] is the node placed at position k.
+ */
+template<typename NeighborsF>
+std::vector<node_t> bfs_order(node_t n, NeighborsF&& neighbors, bool by_degree = false) {
+    auto const degree = [&neighbors](node_t i) {
+        return static_cast<node_t>(std::ranges::distance(neighbors(i)));
+    };
+
+    std::vector<node_t> order{};
+    order.reserve(n);
+    std::vector<bool> visited(n, false);
+    std::vector<node_t> adjacent{};
+
+    // with by_degree, every component starts from one of its least connected nodes.
+    std::vector<node_t> roots(n);
+    std::iota(roots.begin(), roots.end(), node_t{});
+    if (by_degree) {
+        std::stable_sort(roots.begin(), roots.end(), [&degree](node_t a, node_t b) { return degree(a) < degree(b); });
+    }
+
+    for (auto const root : roots) {
+        if (visited[root]) {
+            continue;
+        }
+        visited[root] = true;
+        order.push_back(root);
+        for (auto head = order.size() - 1; head < order.size(); ++head) {
+            adjacent.clear();
+            for (auto const& [j, e] : neighbors(order[head])) {
+                if (!visited[j]) {
+                    visited[j] = true;
+                    adjacent.push_back(j);
+                }
+            }
+            if (by_degree) {
+                std::stable_sort(adjacent.begin(), adjacent.end(), [&degree](node_t a, node_t b) { return degree(a) < degree(b); });
+            }
+            order.insert(order.end(), adjacent.cbegin(), adjacent.cend());
+        }
+    }
+    return order;
+}
+
+/**
+ * @brief Reverse Cuthill-McKee order, which keeps the bandwidth of the adjacency matrix small.
+ */
+template<typename NeighborsF>
+std::vector<node_t> rcm_order(node_t n, NeighborsF&& neighbors) {
+    auto order = bfs_order(n, neighbors, true);
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+/**
+ * @brief Position of a cell along the Hilbert curve filling a side x side square (side is a power of 2).
+ */
+inline uint64_t hilbert_index(uint32_t side, uint32_t x, uint32_t y) noexcept {
+    uint64_t d{};
+    for (auto s = side / 2; s > 0; s /= 2) {
+        uint32_t const rx = (x & s) > 0;
+        uint32_t const ry = (y & s) > 0;
+        d += uint64_t{ s } * s * ((3 * rx) ^ ry);
+        // rotate the quadrant so the curve stays continuous.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/**
+ * @brief Order nodes along a Hilbert curve through their 2D coordinates.
+ * @param coords coords[i] is the position of node i; the positions are quantized onto a 2^16 x 2^16 grid.
+ */
+inline std::vector<node_t> hilbert_order(std::vector<std::pair<double, double>> const& coords) {
+    constexpr uint32_t k_side = 1u << 16;
+    if (coords.empty()) {
+        return {};
+    }
+    auto const [min_x, max_x] = std::ranges::minmax(coords | std::views::keys);
+    auto const [min_y, max_y] = std::ranges::minmax(coords | std::views::values);
+    auto const span = std::max({ max_x - min_x, max_y - min_y, 1e-300 });
+    auto const quantize = [span](double v, double min) {
+        return static_cast<uint32_t>(std::min((v - min) / span * (k_side - 1), k_side - 1.0));
+    };
+
+    std::vector<uint64_t> keys(coords.size());
+    for (std::size_t i = 0; i < coords.size(); ++i) {
+        keys[i] = hilbert_index(k_side, quantize(coords[i].first, min_x), quantize(coords[i].second, min_y));
+    }
+    std::vector<node_t> order(coords.size());
+    std::iota(order.begin(), order.end(), node_t{});
+    std::stable_sort(order.begin(), order.end(), [&keys](node_t a, node_t b) { return keys[a] < keys[b]; });
+    return order;
+}
+
+/**
+ * @brief Compute one of the orderings.
+ * @param coords Node coordinates, only used (and required) by k_hilbert.
+ */
+template<typename NeighborsF>
+std::vector<node_t> make_order(Ordering ordering, node_t n, NeighborsF&& neighbors,
+                               std::vector<std::pair<double, double>> const& coords = {}) {
+    using enum Ordering;
+    switch (ordering) {
+    case k_bfs:
+        return bfs_order(n, neighbors);
+    case k_rcm:
+        return rcm_order(n, neighbors);
+    case k_hilbert:
+        if (coords.size() != static_cast<std::size_t>(n)) {
+            throw std::invalid_argument("Hilbert ordering needs the coordinates of every node.");
+        }
+        return hilbert_order(coords);
+    default: {
+        std::vector<node_t> order(n);
+        std::iota(order.begin(), order.end(), node_t{});
+        return order;
+    }
+    }
+}
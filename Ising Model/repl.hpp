@@ -1,43 +1,111 @@
 #pragma once
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
 #   include <unistd.h>
 #elif _WIN32
 #   include <direct.h>
+#   include <io.h>
 #   define chdir _chdir
+#   define popen _popen
+#   define pclose _pclose
 #endif
 
+#include "checkpoint.hpp"
+#include "correlation.hpp"
+#include "histogram.hpp"
 #include "ising_model.hpp"
+#include "jobs.hpp"
+#include "model_file.hpp"
+#include "overlap.hpp"
+#include "perf_counters.hpp"
+#include "pool.hpp"
+#include "scheduler.hpp"
+#include "statistics.hpp"
+#include "stream_recorder.hpp"
+#include "trace.hpp"
 
 namespace stdf = std::filesystem;
 
+constexpr char const* k_all = "*";
+constexpr char const* k_beta = "beta=";
+constexpr char const* k_beta_name = "beta";
+constexpr char const* k_budget = "budget=";
 constexpr char const* k_cat = "cat";
 constexpr char const* k_cd = "cd";
+constexpr char const* k_checkpoint = "checkpoint=";
+constexpr char const* k_convert = "convert";
+constexpr char const* k_correlation = "correlation=";
 constexpr char const* k_dir = "dir";
+constexpr char const* k_drop = "drop";
 constexpr char const* k_echo = "echo";
+constexpr char const* k_end = "end";
+constexpr char const* k_every = "every=";
 constexpr char const* k_evolve = "evolve";
 constexpr char const* k_exit = "exit";
+constexpr char const* k_field = "field";
+constexpr char const* k_for = "for";
 constexpr char const* k_grid = "grid";
 constexpr char const* k_help = "help";
 constexpr char const* k_hist = "hist";
+constexpr char const* k_in = "in";
 constexpr char const* k_init = "init";
+constexpr char const* k_jobs = "jobs";
+constexpr char const* k_load = "load";
 constexpr char const* k_ls = "ls";
+constexpr char const* k_main = "main";
+constexpr char const* k_memory = "memory";
+constexpr char const* k_models = "models";
+constexpr char const* k_order = "order=";
+constexpr char const* k_out = "out=";
+constexpr char const* k_overlap = "overlap";
+constexpr char const* k_parallel = "parallel";
 constexpr char const* k_path = "path";
+constexpr char const* k_perf = "perf";
+constexpr char const* k_periodic = "periodic";
+constexpr char const* k_pool = "pool";
+constexpr char const* k_profile = "profile";
+constexpr char const* k_range = "range=";
 constexpr char const* k_reset = "reset";
+constexpr char const* k_save = "save";
+constexpr char const* k_set = "set";
 constexpr char const* k_show = "show";
+constexpr char const* k_stats = "stats";
+constexpr char const* k_status = "status";
+constexpr char const* k_steps = "steps=";
+constexpr char const* k_stop = "stop";
 constexpr char const* k_time = "time";
+constexpr char const* k_use = "use";
+constexpr char const* k_verify = "verify";
+constexpr char const* k_wait = "wait";
 
 inline void println(std::string_view sv, std::ostream& out = std::cout) {
-    std::cout << sv << '\n';
+    out << sv << '\n';
 }
 
-inline void prompt() {
+inline void prompt(std::string_view marker = "> ") {
     auto const non_quote = [](auto arg) {
         return arg != '"';
     };
@@ -45,23 +113,37 @@ inline void prompt() {
     for (auto ch : path | stdv::filter(non_quote)) {
         std::cout << ch;
     }
-    std::cout << "> ";
+    std::cout << marker;
 }
 
 // TODO
-inline void print_usage() {
+inline void print_usage(std::ostream& os = std::cout) {
 #   define TAB "\t"
 #   define PADDING1 TAB << std::setw(42) << std::left
 #   define PADDING2 std::setw(84) << std::left
 
-    std::cout << "Usage:" << '\n';
-    std::cout << PADDING1 << "help" 
+    os << "Usage:" << '\n';
+    os << PADDING1 << "help" 
               << PADDING2 << "Print the usage." << '\n';
-    std::cout << PADDING1 << "init [spins_file] [bonds_file]" 
+    os << PADDING1 << "init [spins_file] [bonds_file]" 
               << PADDING2 << "Initialize the Ising model from a spins file and bonds file." << '\n';
-    std::cout << PADDING1 << "hist ([output_file])"
-              << PADDING2 << "Draw histogram on the terminal, or stream it to a local file." << '\n';
-    std::cout << PADDING1 << "show [options]"
+    os << PADDING1 << "init [model_file] (--verify)"
+              << PADDING2 << "Initialize the Ising model from a binary model file (all spins down); --verify checks every bond." << '\n';
+    os << PADDING1 << "convert [spins_file] [bonds_file] [model_file]"
+              << PADDING2 << "Convert a spins file and bonds file into a binary model file." << '\n';
+    os << PADDING1 << "grid [row_ct] ([col_ct])"
+              << PADDING2 << "Initialize a lattice Ising model; with --periodic it wraps around into a torus." << '\n'
+              << PADDING1 << "init, convert and grid accept:" << '\n'
+              << TAB PADDING1 << "--order=[none|bfs|rcm|hilbert]"
+              << PADDING2 << "Relabel the nodes internally for memory locality (hilbert needs a grid)." << '\n';
+    os << PADDING1 << "hist ([output_file]) [options]"
+              << PADDING2 << "Draw the histograms of every temperature evolved, and the averages reweighted from them," << '\n'
+              << PADDING1 << ""
+              << PADDING2 << "on the terminal or to a file. Several temperatures are combined (multi-histogram)." << '\n'
+              << PADDING1 << "The options are as follows:" << '\n'
+              << TAB PADDING1 << "--range=[beta]:[beta] (--steps=[n])"
+              << PADDING2 << "The temperatures to reweight to; by default as far as the histograms reach." << '\n';
+    os << PADDING1 << "show [options]"
               << PADDING2 << "Show statistics of the current Ising model." << '\n'
               << PADDING1 << "The options are as follows:" << '\n'
               << TAB PADDING1 << "-e"
@@ -69,15 +151,112 @@ inline void print_usage() {
               << TAB PADDING1 << "-f [n]"
               << PADDING2 << "Flip one of the spins" << '\n'
               << TAB PADDING1 << "-s"
-              << PADDING2 << "Print the serialized configuration" << '\n';
-    std::cout << PADDING1 << "evolve [sweeps]"
-              << PADDING2 << "Let the model evolove certain number of sweeps." << '\n';
+              << PADDING2 << "Print the serialized configuration" << '\n'
+              << TAB PADDING1 << "-g"
+              << PADDING2 << "Print the measured correlation function and correlation length." << '\n'
+              << TAB PADDING1 << "-t"
+              << PADDING2 << "Print the averages over the evolved sweeps, with error bars and autocorrelation times." << '\n';
+    os << PADDING1 << "evolve [sweeps] [options]"
+              << PADDING2 << "Let the model evolove certain number of sweeps." << '\n'
+              << PADDING1 << "The options are as follows:" << '\n'
+              << TAB PADDING1 << "--beta=[beta]"
+              << PADDING2 << "Set beta first; the histograms of hist are kept per beta." << '\n'
+              << TAB PADDING1 << "--correlation=[sweeps|tau]"
+              << PADDING2 << "Measure the correlation function of a grid by FFT every given count of sweeps, or once per 2 tau." << '\n'
+              << TAB PADDING1 << "--overlap"
+              << PADDING2 << "Measure the correlation function on snapshots in a worker thread while the sweeps go on." << '\n'
+              << TAB PADDING1 << "--out=[file] (-e) (-m) (-s)"
+              << PADDING2 << "Stream the energy, magnetization and/or state of every sweep to a file (CSV for .csv)." << '\n'
+              << TAB PADDING1 << "--checkpoint=[file] (--every=[sweeps|seconds s])"
+              << PADDING2 << "Checkpoint the model every 100 (or the given count of) sweeps or seconds, in the background." << '\n'
+              << TAB PADDING1 << "--budget=[time(ms|s|m|h)]"
+              << PADDING2 << "End the run when the wall-clock time is up, e.g. 30s, even if sweeps are left." << '\n'
+              << TAB PADDING1 << "&"
+              << PADDING2 << "Run in the background as a job; show and the other readers wait for the end of a sweep." << '\n';
+    os << PADDING1 << "jobs"
+              << PADDING2 << "List the jobs: their state, sweeps done, sweeps/s, current E/N and M, and time taken." << '\n';
+    os << PADDING1 << "status ([job])"
+              << PADDING2 << "Print the progress of a job, or of every running one." << '\n';
+    os << PADDING1 << "stop ([job])"
+              << PADDING2 << "Stop a job, or every running one, after its current sweep, and wait for it." << '\n';
+    os << PADDING1 << "wait ([job])"
+              << PADDING2 << "Wait for a job, or every running one, to end, with live progress on a terminal." << '\n';
+    os << PADDING1 << "save [checkpoint_file]"
+              << PADDING2 << "Checkpoint the model; saving again to the same file only writes the spins changed since." << '\n';
+    os << PADDING1 << "load [checkpoint_file]"
+              << PADDING2 << "Restore a checkpoint into the current model, which must have the same graph." << '\n';
+    os << PADDING1 << "stats (-r)"
+              << PADDING2 << "Print the acceptance rate, flips/s and time per update of the sweeps so far; -r resets them." << '\n'
+              << PADDING1 << "init, convert, grid and evolve accept:" << '\n'
+              << TAB PADDING1 << "--perf"
+              << PADDING2 << "Count cycles, IPC, cache, branch and TLB misses per phase (Linux perf), shown by stats." << '\n';
+    os << PADDING1 << "profile [on|off|clear]"
+              << PADDING2 << "Trace the commands, model building, sweeps, recorders and worker threads, or stop or clear it." << '\n'
+              << PADDING1 << "profile ([trace_file])"
+              << PADDING2 << "Print the traced scopes as a tree with their times, and write a Chrome/Perfetto trace JSON." << '\n';
+    os << PADDING1 << "pool (-r)"
+              << PADDING2 << "Print the tasks, steals and idle time of every thread of the shared pool; -r resets them." << '\n';
+    os << PADDING1 << "set [beta|field|memory|name] [value]"
+              << PADDING2 << "Set beta, a uniform field on every node, the memory the slots may take (e.g. 8G), or a" << '\n'
+              << PADDING1 << ""
+              << PADDING2 << "variable that $name or ${name} stands for." << '\n';
+    os << PADDING1 << "use ([name])"
+              << PADDING2 << "Work on the model slot of a name, making an empty one if needed; the first one is main." << '\n';
+    os << PADDING1 << "models"
+              << PADDING2 << "Compare the slots: size, memory, beta, sweeps, current and average E/N and |M|, and jobs." << '\n';
+    os << PADDING1 << "drop [name]"
+              << PADDING2 << "Free a slot other than the current one." << '\n'
+              << PADDING1 << "A slot name after init, grid, show, hist, save, load, stats, evolve or set picks the slot, e.g." << '\n'
+              << PADDING1 << "grid a 256 or evolve a 1000 &; * picks every slot with a model, and evolve * runs them all at once." << '\n';
+    os << PADDING1 << "for [name] in [values...] (--parallel(=[n]))"
+              << PADDING2 << "Run the lines up to end once per value, set like set does; --parallel runs them on copies" << '\n'
+              << PADDING1 << "..."
+              << PADDING2 << "of the model, n at a time on threads of their own, printing their output in order and" << '\n'
+              << PADDING1 << "end"
+              << PADDING2 << "keeping their histograms." << '\n';
+    os << PADDING1 << "exit ([status])"
+              << PADDING2 << "Leave the REPL, or stop a script, with an exit status." << '\n'
+              << PADDING1 << "Given a script file, or commands piped in, they run without prompts, stopping at the first error." << '\n';
 
 #   undef PADDING2
 #   undef PADDING1
 #   undef TAB
 }
 
+/**
+ * @brief Draw the energy and magnetization histograms of every run and a table of the averages reweighted from all
+ * of them over a range of beta.
+ * @param range The range of beta, or (0, 0) for the range the histograms reach.
+ */
+inline void print_histograms(std::ostream& os, std::vector<EnergyHistogram> const& histograms,
+                             std::pair<double, double> range, int steps) {
+    for (auto const& h : histograms) {
+        os << "Energy histogram at beta " << h.beta() << ", " << h.count() << " samples, bin width " << h.width() << '\n';
+        std::vector<uint64_t> counts{};
+        for (auto const& bin : h.bins()) {
+            counts.push_back(bin.count);
+        }
+        draw_histogram(os, counts, static_cast<double>(h.first()) * h.width(), h.width());
+        os << "Magnetization histogram at beta " << h.beta() << '\n';
+        auto const& mag = h.magnetization_counts();
+        draw_histogram(os, mag, -1.0, 2.0 / mag.size());
+    }
+
+    Reweighting const reweighting(histograms);
+    if (range.first == 0.0 && range.second == 0.0) {
+        range = reweighting.range();
+    }
+    os << (histograms.size() > 1 ? "Multi-histogram" : "Single-histogram") << " reweighting" << '\n'
+       << std::setw(12) << std::left << "beta" << std::setw(14) << "E/N" << std::setw(14) << "C"
+       << std::setw(14) << "<|M|>" << std::setw(14) << "chi" << "U" << '\n';
+    for (int k = 0; k < steps; ++k) {
+        auto const beta = steps > 1 ? range.first + (range.second - range.first) * k / (steps - 1) : range.first;
+        auto const t = reweighting.at(beta);
+        os << std::setw(12) << std::left << t.beta << std::setw(14) << t.energy << std::setw(14) << t.specific_heat
+           << std::setw(14) << t.abs_magnetization << std::setw(14) << t.susceptibility << t.binder_cumulant << '\n';
+    }
+}
+
 inline void undefined() {
     std::cerr << "\033[1m\033[31mThis function is not yet implemented\033[0m" << '\n';
 }
@@ -87,9 +266,10 @@ inline void undefined() {
  * @brief Try parse and exec the line as a shell command.
  * @param line The line input.
  * @param argv Arguments of the line input.
+ * @param out Where the output of the command goes, along with its errors.
  * @return Whether the line is executed as a shell command.
 */
-inline bool shell_command(std::string_view line, std::vector<std::string_view> const& argv) {
+inline bool shell_command(std::string_view line, std::vector<std::string_view> const& argv, std::ostream& out) {
     auto const match_prefix = [](std::string_view target, std::string_view pattern) {
         if (target.size() < pattern.size()) {
             return false;
@@ -106,262 +286,1614 @@ inline bool shell_command(std::string_view line, std::vector<std::string_view> c
 
     if (is_shell_command) {
         if (argv[0] == k_cd) {
-            int res = chdir(argv[1].data());
+            int res = argv.size() > 1 ? chdir(std::string(argv[1]).c_str()) : -1;
             if (res < 0) {
-                perror("chdir: ");
+                out << "chdir: " << std::strerror(errno) << '\n';
             }
         }
-        else {
-            system(line.data());
+        else if (auto* const pipe = popen((std::string(line) + " 2>&1").c_str(), "r")) {
+            // read back rather than left on the terminal, so it lands in the stream the command's output goes to.
+            char buffer[4096];
+            for (std::size_t size; (size = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0;) {
+                out.write(buffer, static_cast<std::streamsize>(size));
+            }
+            pclose(pipe);
         }
     }
     return is_shell_command;
 }
 
-[[noreturn]]
-inline void repl() {
-    extern Ising g_model;
+/**
+ * @brief Whether the standard input is a terminal, rather than a file or a pipe.
+ */
+inline bool stdin_is_terminal() {
+#if defined(__APPLE__) || defined(__linux__)
+    return isatty(STDIN_FILENO);
+#elif _WIN32
+    return _isatty(_fileno(stdin));
+#else
+    return true;
+#endif
+}
 
-    std::vector<energy_t> energy_record{};
-    std::vector<int64_t> states_record{};
-    std::vector<double> magnetization_record{};
-    
+/**
+ * @brief Whether the standard output is a terminal, which can redraw a progress line.
+ */
+inline bool stdout_is_terminal() {
+#if defined(__APPLE__) || defined(__linux__)
+    return isatty(STDOUT_FILENO);
+#elif _WIN32
+    return _isatty(_fileno(stdout));
+#else
+    return false;
+#endif
+}
 
-    println("REPL started.");
-    std::string line;
-    
-    while (true) {
-        prompt();
-        std::getline(std::cin, line);
-
-        // Trim the line. (we probably need std::ranges::views::trim)
-        auto line_view = line | stdv::drop_while(isspace)
-                              | stdv::reverse
-                              | stdv::drop_while(isspace)
-                              | stdv::reverse;
-        auto line_sv = std::string_view(&*line_view.begin(), stdr::distance(line_view));
-        if (line_sv == "") {
-            continue;
+/**
+ * @brief Parse a time like 30s, 500ms, 5m or 1.5h; a bare number is in seconds.
+ */
+inline std::optional<std::chrono::steady_clock::duration> parse_duration(std::string_view text) {
+    double value{};
+    auto const [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc{} || value < 0) {
+        return std::nullopt;
+    }
+    auto const unit = std::string_view(ptr, text.data() + text.size() - ptr);
+    double scale{};
+    if (unit.empty() || unit == "s") {
+        scale = 1;
+    }
+    else if (unit == "ms") {
+        scale = 1e-3;
+    }
+    else if (unit == "m") {
+        scale = 60;
+    }
+    else if (unit == "h") {
+        scale = 3600;
+    }
+    else {
+        return std::nullopt;
+    }
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(value * scale));
+}
+
+/**
+ * @brief Parse a size like 512M or 8G, in bytes with a K, M or G of 1024.
+ */
+inline std::optional<std::size_t> parse_size(std::string_view text) {
+    double value{};
+    auto const [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc{} || value < 0) {
+        return std::nullopt;
+    }
+    auto const unit = std::string_view(ptr, text.data() + text.size() - ptr);
+    constexpr std::string_view k_units = "KMG";
+    auto scale = 1.0;
+    if (unit.size() == 1 && k_units.find(unit[0]) != std::string_view::npos) {
+        scale = std::exp2(10.0 * static_cast<double>(k_units.find(unit[0]) + 1));
+    }
+    else if (!unit.empty()) {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(value * scale);
+}
+
+inline double mebibytes(std::size_t bytes) noexcept {
+    return static_cast<double>(bytes) / (1 << 20);
+}
+
+/**
+ * @brief At most the bytes the model of a spins file and a bonds file takes, from their count of lines, so it can
+ * be checked against a memory limit before it's built.
+ * @throw The file name if either can't be opened.
+ */
+inline std::size_t text_model_bytes(std::string_view spin_file, std::string_view bond_file, Ordering ordering) {
+    auto const line_count = [](std::string_view file) {
+        auto const mapped = MappedFile(file);
+        auto const text = mapped.view();
+        return static_cast<std::size_t>(stdr::count(text, '\n')) + (!text.empty() && text.back() != '\n');
+    };
+    return Ising::memory_bytes(line_count(spin_file), line_count(bond_file), ordering != Ordering::k_none);
+}
+
+/**
+ * @brief Three quarters of the physical memory, or no limit where it's unknown.
+ */
+inline std::size_t default_memory_limit() {
+#if defined(__APPLE__) || defined(__linux__)
+    auto const pages = sysconf(_SC_PHYS_PAGES);
+    auto const page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && page_size > 0) {
+        return static_cast<std::size_t>(pages) / 4 * 3 * static_cast<std::size_t>(page_size);
+    }
+#endif
+    return std::numeric_limits<std::size_t>::max();
+}
+
+/**
+ * @brief Whether a word can name a slot: a letter, then letters, digits and _.
+ */
+inline bool is_slot_name(std::string_view word) noexcept {
+    return !word.empty() && std::isalpha(static_cast<unsigned char>(word[0]))
+        && stdr::all_of(word, [](char ch) { return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_'; });
+}
+
+/**
+ * @brief A model of a session, what has been measured on it and the beta it's evolved at. Every model has its own
+ * random engine, and its field is part of it.
+ */
+struct ModelSlot {
+    explicit ModelSlot(Ising& model)
+        : model(&model) {}
+
+    explicit ModelSlot(std::unique_ptr<Ising> owned = std::make_unique<Ising>())
+        : model(owned.get()), own_model(std::move(owned)) {}
+
+    Ising* model;
+    // the model when the slot owns it, which model points to; the main slot of the REPL works on g_model.
+    std::unique_ptr<Ising> own_model{};
+    // g_beta while a command runs on the slot.
+    double beta = g_beta;
+    // the averages of every sweep evolved since the model was created.
+    StatisticsRecorder statistics{};
+    // an energy histogram per beta evolved at, for reweighting.
+    std::vector<EnergyHistogram> histograms{};
+    // the shape of the model made by grid, which the correlation recorder needs; (0, 0) for other models.
+    std::pair<node_t, node_t> grid_shape{};
+    bool grid_periodic = false;
+    std::optional<CorrelationRecorder> correlation{};
+    // destroyed with the slot, so whatever is still queued gets written.
+    std::optional<Checkpointer> checkpointer{};
+};
+
+/**
+ * @brief What the commands work on: the models by name, the script variables and where the output goes. The REPL
+ * and a script have one over g_model as the slot main; every parallel iteration of a for loop gets its own over a
+ * copy of the current slot.
+ */
+struct ReplSession {
+    ReplSession(Ising& model, std::ostream& out, std::ostream& err)
+        : out(&out), err(&err) {
+        slots.emplace(k_main, std::make_unique<ModelSlot>(model));
+    }
+
+    ModelSlot& slot() {
+        return *slots.find(current)->second;
+    }
+
+    ModelSlot const& slot() const {
+        return *slots.find(current)->second;
+    }
+
+    /**
+     * @brief The bytes the models of the slots take together.
+     */
+    std::size_t slot_bytes() const noexcept {
+        std::size_t result{};
+        for (auto const& [name, slot] : slots) {
+            result += slot->model->valid() ? slot->model->memory_bytes() : 0;
         }
-        else if (line_sv == k_exit) {
-            std::cout << "Now exit the REPL." << std::endl;
-            std::exit(0);
+        return result;
+    }
+
+    /**
+     * @brief The bytes counted against memory_limit: those of the slots, and in a parallel iteration also those of
+     * the session it was forked from and of the other iterations of the loop.
+     */
+    std::size_t memory_used() const noexcept {
+        if (!forks_used) {
+            return slot_bytes();
         }
-        else if (line_sv == k_help) {
-            print_usage();
-            continue;
+        return parent_used + forks_used->load() - forked_bytes + slot_bytes();
+    }
+
+    /**
+     * @brief Whether a model of the given bytes can be made beside what memory_used() counts. In a parallel
+     * iteration the bytes are taken from the loop's count at once, so two iterations can't both take the last of
+     * the budget; settle_memory() later puts the count right.
+     */
+    bool reserve_memory(std::size_t bytes) {
+        if (!forks_used) {
+            auto const used = slot_bytes();
+            return used <= memory_limit && bytes <= memory_limit - used;
         }
-        else if (line_sv == k_path) {
-            auto const path = stdf::absolute(stdf::current_path());
-            std::cout << path << '\n';
-            continue;
+        auto const own = slot_bytes();
+        auto total = forks_used->load();
+        do {
+            auto const used = parent_used + total - forked_bytes + own;
+            if (used > memory_limit || bytes > memory_limit - used) {
+                return false;
+            }
+        } while (!forks_used->compare_exchange_weak(total, total + bytes));
+        forked_bytes += bytes;
+        return true;
+    }
+
+    /**
+     * @brief In a parallel iteration, make its share of the loop's count the bytes its slots take now.
+     */
+    void settle_memory() noexcept {
+        if (forks_used) {
+            auto const own = slot_bytes();
+            *forks_used += own - forked_bytes;
+            forked_bytes = own;
         }
+    }
+
+    std::map<std::string, std::unique_ptr<ModelSlot>, std::less<>> slots{};
+    // the slot of the commands that don't name one.
+    std::string current = k_main;
+    // the bytes the models of the slots may take together; a model past it isn't made, or dropped once loaded.
+    std::size_t memory_limit = default_memory_limit();
+    // the hardware counters per phase of the commands run with --perf, made by the first one.
+    std::optional<PerfProfile> perf{};
+    // the variables of set and for, which $name and ${name} stand for.
+    std::map<std::string, std::string, std::less<>> variables{};
+    std::ostream* out;
+    std::ostream* err;
+    // the status exit asked for.
+    int exit_code{};
+    // the line of the command that failed.
+    std::size_t error_line{};
+    // an iteration of a parallel for, which mustn't change what the process shares.
+    bool parallel = false;
+    // in a parallel iteration: the bytes the slots of the session it was forked from take, which stay while it runs,
+    // the bytes the iterations of the loop take together, and its own share of them.
+    std::size_t parent_used{};
+    std::atomic<std::size_t>* forks_used = nullptr;
+    std::size_t forked_bytes{};
+    // the background evolves; last, so they are stopped before what they use goes.
+    JobTable jobs{};
+};
+
+/**
+ * @brief How a command ended; a script stops at the first failed one.
+ */
+enum class CommandStatus {
+    k_ok,
+    k_failed,
+    k_exit,
+};
+
+/**
+ * @brief Run one command line against a session.
+ */
+inline CommandStatus execute(ReplSession& session, std::string const& line) {
+    auto& out = *session.out;
+    auto& err = *session.err;
+    auto& perf = session.perf;
+    auto status = CommandStatus::k_ok;
+
+    // Trim the line. (we probably need std::ranges::views::trim)
+    auto line_view = line | stdv::drop_while(isspace)
+                          | stdv::reverse
+                          | stdv::drop_while(isspace)
+                          | stdv::reverse;
+    if (line_view.begin() == line_view.end()) {
+        return CommandStatus::k_ok;
+    }
+    auto line_sv = std::string_view(&*line_view.begin(), stdr::distance(line_view));
+    if (line_sv == k_help) {
+        print_usage(out);
+        return CommandStatus::k_ok;
+    }
+    else if (line_sv == k_path) {
+        auto const path = stdf::absolute(stdf::current_path());
+        out << path << '\n';
+        return CommandStatus::k_ok;
+    }
 
-        // Parse the line. (we need std::ranges::to!)
-        auto words_view = line_view | stdv::split(' ')
-                                    | stdv::transform([](auto&& range) { return std::string_view(&*range.begin(), stdr::distance(range)); })
-                                    | stdv::filter([](auto&& sv) { return sv != ""; });
+    // Parse the line. (we need std::ranges::to!)
+    auto words_view = line_view | stdv::split(' ')
+                                | stdv::transform([](auto&& range) { return std::string_view(&*range.begin(), stdr::distance(range)); })
+                                | stdv::filter([](auto&& sv) { return sv != ""; });
+
+
+    auto options_view = words_view | stdv::filter([](auto&& sv) { return sv.size() >= 2 && sv.substr(0, 2) == "--"; });
+    std::vector<std::string_view> options(options_view.begin(), options_view.end());
+    auto command_view = words_view | stdv::filter([options = std::as_const(options)](auto&& sv) { return stdr::find(options, sv) == options.cend(); });
+    std::vector<std::string_view> command(command_view.begin(), command_view.end());
+
+    // a slot name after a command on a model picks the slot, e.g. evolve a 1000, and grid makes it if needed.
+    auto const on_model = command[0] == k_init || command[0] == k_grid || command[0] == k_hist || command[0] == k_save
+                       || command[0] == k_load || command[0] == k_stats || command[0] == k_show || command[0] == k_evolve
+                       || command[0] == k_set;
+    // * runs the command on every slot with a model in turn; evolve runs them all at once, as jobs, and waits for them
+    // unless sent to the background itself.
+    if (on_model && command.size() > 1 && command[1] == k_all) {
+        auto const offset = static_cast<std::size_t>(command[1].data() - line_sv.data());
+        auto const concurrent = command[0] == k_evolve && command.back() != "&";
+        std::vector<int> started{};
+        for (auto const& [name, slot] : session.slots) {
+            if (!slot->model->valid()) {
+                continue;
+            }
+            auto slot_line = std::string(line_sv.substr(0, offset)) + name + std::string(line_sv.substr(offset + 1));
+            if (concurrent) {
+                slot_line += " &";
+            }
+            else {
+                out << '[' << name << ']' << '\n';
+            }
+            auto const* const latest = session.jobs.latest();
+            if (execute(session, slot_line) != CommandStatus::k_ok) {
+                status = CommandStatus::k_failed;
+            }
+            if (concurrent && session.jobs.latest() != latest) {
+                started.push_back(session.jobs.latest()->id());
+            }
+        }
+        for (auto const id : started) {
+            if (execute(session, std::string(k_wait) + ' ' + std::to_string(id)) != CommandStatus::k_ok) {
+                status = CommandStatus::k_failed;
+            }
+        }
+        return status;
+    }
+    auto slot_it = session.slots.find(session.current);
+    auto fresh_slot = false;
+    if (on_model && command.size() > (command[0] == k_set ? 3u : 1u)) {
+        if (auto const named = session.slots.find(command[1]); named != session.slots.end()) {
+            slot_it = named;
+            command.erase(command.begin() + 1);
+        }
+        else if (command[0] == k_grid && is_slot_name(command[1])) {
+            slot_it = session.slots.emplace(std::string(command[1]), std::make_unique<ModelSlot>()).first;
+            fresh_slot = true;
+            command.erase(command.begin() + 1);
+        }
+    }
+    // g_beta is the slot's beta while the command runs, and the current slot's after. A slot grid made is dropped
+    // again if it failed.
+    struct SlotGuard {
+        ReplSession& session;
+        std::map<std::string, std::unique_ptr<ModelSlot>, std::less<>>::iterator slot;
+        bool fresh;
 
+        ~SlotGuard() {
+            slot->second->beta = g_beta;
+            if (fresh && !slot->second->model->valid()) {
+                session.slots.erase(slot);
+            }
+            g_beta = session.slot().beta;
+        }
+    } const slot_guard{ session, slot_it, fresh_slot };
+    auto& slot = *slot_it->second;
+    g_beta = slot.beta;
 
-        auto options_view = words_view | stdv::filter([](auto&& sv) { return sv.size() >= 2 && sv.substr(0, 2) == "--"; });
-        std::vector<std::string_view> options(options_view.begin(), options_view.end());
+    auto& model = *slot.model;
+    auto& statistics = slot.statistics;
+    auto& histograms = slot.histograms;
+    auto& grid_shape = slot.grid_shape;
+    auto& grid_periodic = slot.grid_periodic;
+    auto& correlation = slot.correlation;
+    auto& checkpointer = slot.checkpointer;
+    // the checkpointer for a file, replacing the current one if it writes another file.
+    auto const checkpointer_of = [&checkpointer](std::string_view file) -> Checkpointer& {
+        if (!checkpointer || checkpointer->file() != file) {
+            checkpointer.reset();
+            checkpointer.emplace(std::string(file));
+        }
+        return *checkpointer;
+    };
+    // whether a model of the given bytes can be made; the one it replaces still counts, as it lives until then.
+    auto const fits_memory = [&session, &err](std::size_t bytes, std::string_view what) {
+        if (session.reserve_memory(bytes)) {
+            return true;
+        }
+        err << "The " << what << " takes about " << mebibytes(bytes) << " MiB, but " << mebibytes(session.memory_used())
+            << " of the " << mebibytes(session.memory_limit) << " MiB allowed are in use. Use drop or set memory first."
+            << '\n';
+        return false;
+    };
 
-        bool record_time = false;
-        auto const now = std::chrono::high_resolution_clock::now;
-        decltype(now()) time{};
-        decltype(now() - now()) delta_time{};
-        for (auto const& opt : options) {
-            auto opt_name = opt.substr(2);
-            if (opt_name == k_time) {
-                record_time = true;
+    bool record_time = false;
+    bool overlap = false;
+    bool periodic = false;
+    bool verify = false;
+    PerfProfile* profile = nullptr;
+    auto ordering = Ordering::k_none;
+    std::string_view checkpoint_file{};
+    std::string_view out_file{};
+    std::pair<double, double> beta_range{};
+    int beta_steps = 21;
+    // -1 to measure once per 2 tau.
+    int correlation_every = 0;
+    int checkpoint_every = 100;
+    int checkpoint_seconds = 0;
+    std::optional<std::chrono::steady_clock::duration> budget{};
+    auto const now = std::chrono::high_resolution_clock::now;
+    decltype(now()) time{};
+    decltype(now() - now()) delta_time{};
+    for (auto const& opt : options) {
+        auto opt_name = opt.substr(2);
+        if (opt_name == k_time) {
+            record_time = true;
+        }
+        else if (opt_name == k_overlap) {
+            overlap = true;
+        }
+        else if (opt_name == k_periodic) {
+            periodic = true;
+        }
+        else if (opt_name == k_verify) {
+            verify = true;
+        }
+        else if (opt_name == k_perf) {
+            if (!perf) {
+                perf.emplace();
+            }
+            profile = &*perf;
+        }
+        else if (opt_name.starts_with(k_order)) {
+            auto const name = opt_name.substr(std::string_view(k_order).size());
+            if (auto const parsed = ordering_of(name)) {
+                ordering = *parsed;
+            }
+            else {
+                out << "Unknown ordering " << name << ", the nodes keep their order." << '\n';
             }
         }
+        else if (opt_name.starts_with(k_beta)) {
+            auto const value = opt_name.substr(std::string_view(k_beta).size());
+            std::from_chars(value.data(), value.data() + value.size(), g_beta);
+        }
+        else if (opt_name.starts_with(k_range)) {
+            auto const value = opt_name.substr(std::string_view(k_range).size());
+            auto const colon = std::min(value.find(':'), value.size());
+            std::from_chars(value.data(), value.data() + colon, beta_range.first);
+            if (colon < value.size()) {
+                std::from_chars(value.data() + colon + 1, value.data() + value.size(), beta_range.second);
+            }
+        }
+        else if (opt_name.starts_with(k_steps)) {
+            auto const value = opt_name.substr(std::string_view(k_steps).size());
+            std::from_chars(value.data(), value.data() + value.size(), beta_steps);
+            beta_steps = std::max(beta_steps, 1);
+        }
+        else if (opt_name.starts_with(k_correlation)) {
+            auto const value = opt_name.substr(std::string_view(k_correlation).size());
+            if (value == "tau") {
+                correlation_every = -1;
+            }
+            else {
+                std::from_chars(value.data(), value.data() + value.size(), correlation_every);
+            }
+        }
+        else if (opt_name.starts_with(k_out)) {
+            out_file = opt_name.substr(std::string_view(k_out).size());
+        }
+        else if (opt_name.starts_with(k_checkpoint)) {
+            checkpoint_file = opt_name.substr(std::string_view(k_checkpoint).size());
+        }
+        else if (opt_name.starts_with(k_budget)) {
+            auto const value = opt_name.substr(std::string_view(k_budget).size());
+            budget = parse_duration(value);
+            if (!budget) {
+                out << "Invalid budget " << value << ", use e.g. 30s, 500ms, 5m or 1h." << '\n';
+                return CommandStatus::k_failed;
+            }
+        }
+        else if (opt_name.starts_with(k_every)) {
+            auto const value = opt_name.substr(std::string_view(k_every).size());
+            if (value.ends_with('s')) {
+                std::from_chars(value.data(), value.data() + value.size() - 1, checkpoint_seconds);
+                checkpoint_seconds = std::max(checkpoint_seconds, 1);
+            }
+            else {
+                std::from_chars(value.data(), value.data() + value.size(), checkpoint_every);
+                checkpoint_every = std::max(checkpoint_every, 1);
+            }
+        }
+    }
 #       define TIME_GUARD_START do {    \
-            if (record_time) {          \
-                time = now();           \
-            }                           \
-        } while (0)
+        if (record_time) {          \
+            time = now();           \
+        }                           \
+    } while (0)
 #       define PRINT_TIME_SPENT do {          \
-            std::cout << "Operation spent: " << std::chrono::duration_cast<std::chrono::milliseconds>(delta_time).count() << "ms" << '\n'; \
-        } while (0)
+        out << "Operation spent: " << std::chrono::duration_cast<std::chrono::milliseconds>(delta_time).count() << "ms" << '\n'; \
+    } while (0)
 #       define TIME_GUARD_STOP do {           \
-            if (record_time) {                \
-                delta_time = now() - time;    \
-            PRINT_TIME_SPENT;                 \
-            }                                 \
-        } while (0)
+        if (record_time) {                \
+            delta_time = now() - time;    \
+        PRINT_TIME_SPENT;                 \
+        }                                 \
+    } while (0)
 
 #       define TIME_GUARD(...) do {           \
-            TIME_GUARD_START;                 \
-            __VA_ARGS__;                      \
-            TIME_GUARD_STOP;                  \
-        } while (0)
-
+        TIME_GUARD_START;                 \
+        __VA_ARGS__;                      \
+        TIME_GUARD_STOP;                  \
+    } while (0)
 
-        auto command_view = words_view | stdv::filter([options = std::as_const(options)](auto&& sv) { return stdr::find(options, sv) == options.cend(); });
-        std::vector<std::string_view> command(command_view.begin(), command_view.end());
 
-        // Do it if it's system commands.
-        if (shell_command(line, command)) {
-            continue;
+    // exit ([status])
+    if (command[0] == k_exit) {
+        if (command.size() > 1) {
+            std::from_chars(command[1].data(), command[1].data() + command[1].size(), session.exit_code);
         }
+        return CommandStatus::k_exit;
+    }
+    // the working directory is the process's, shared by every iteration.
+    if (command[0] == k_cd && session.parallel) {
+        err << "cd can't run in a parallel for, it would change the directory of every iteration." << '\n';
+        return CommandStatus::k_failed;
+    }
+    // Do it if it's system commands.
+    if (shell_command(line, command, out)) {
+        return CommandStatus::k_ok;
+    }
+    // the words typed are only kept, for good, while tracing.
+    TraceScope command_trace(Tracer::enabled() ? Tracer::instance().intern(command[0]) : "command");
 
-        // init [spins_file] [bond_file]
-        if (command[0] == k_init) {
-            if (command.size() != 3) {
-                print_usage();
+    // jobs
+    if (command[0] == k_jobs) {
+        auto const jobs = session.jobs.jobs();
+        if (jobs.empty()) {
+            out << "There's no job yet. Use evolve [sweeps] & to start one." << '\n';
+        }
+        for (auto const* job : jobs) {
+            job->report(out);
+            out << '\n';
+        }
+        return CommandStatus::k_ok;
+    }
+    // pool (-r)
+    else if (command[0] == k_pool) {
+        auto& pool = ThreadPool::instance();
+        if (command.size() == 2 && command[1] == "-r") {
+            pool.reset_stats();
+            return CommandStatus::k_ok;
+        }
+        else if (command.size() > 1) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        pool.report(out);
+        return CommandStatus::k_ok;
+    }
+    // status ([job])
+    // stop ([job])
+    // wait ([job])
+    else if (command[0] == k_status || command[0] == k_stop || command[0] == k_wait) {
+        std::vector<EvolveJob*> targets{};
+        if (command.size() > 1) {
+            int id{};
+            std::from_chars(command[1].data(), command[1].data() + command[1].size(), id);
+            auto* const job = session.jobs.find(id);
+            if (!job) {
+                err << "There's no job " << command[1] << ". Use jobs to list them." << '\n';
+                return CommandStatus::k_failed;
+            }
+            targets.push_back(job);
+        }
+        else {
+            targets = session.jobs.running();
+        }
+        if (command[0] == k_status) {
+            if (targets.empty()) {
+                out << "No job is running." << '\n';
+            }
+            for (auto const* job : targets) {
+                job->report(out);
+                out << '\n' << job->log();
+            }
+            return CommandStatus::k_ok;
+        }
+        if (command[0] == k_stop) {
+            for (auto* job : targets) {
+                job->stop();
+            }
+        }
+        // redraw a progress line while waiting, if it goes to a terminal.
+        auto const live = session.out == &std::cout && stdout_is_terminal();
+        for (auto* job : targets) {
+            if (!live) {
+                job->wait();
                 continue;
             }
-            TIME_GUARD(g_model = make_ising(command[1], command[2]));
-            continue;
+            while (!job->wait_for(std::chrono::milliseconds(250))) {
+                out << '\r';
+                job->report(out);
+                out << "\033[K" << std::flush;
+            }
+            out << '\r' << "\033[K";
+        }
+        return session.jobs.reap(out) ? CommandStatus::k_failed : CommandStatus::k_ok;
+    }
+
+    // use ([name])
+    else if (command[0] == k_use) {
+        if (command.size() == 1) {
+            out << session.current << '\n';
+            return CommandStatus::k_ok;
+        }
+        if (command.size() != 2 || !is_slot_name(command[1])) {
+            err << "A slot name is a letter, then letters, digits and _." << '\n';
+            return CommandStatus::k_failed;
         }
-        // grid [row_ct] ?[col_ct]
-        else if (command[0] == k_grid) {
-            if (command.size() < 2) {
-                print_usage();
+        if (!session.slots.contains(command[1])) {
+            session.slots.emplace(std::string(command[1]), std::make_unique<ModelSlot>());
+        }
+        session.current = command[1];
+        return CommandStatus::k_ok;
+    }
+    // models
+    else if (command[0] == k_models) {
+        out << "  " << std::setw(12) << std::left << "slot" << std::setw(10) << "nodes" << std::setw(10) << "MiB"
+            << std::setw(8) << "beta" << std::setw(10) << "sweeps" << std::setw(10) << "E/N" << std::setw(10) << "|M|"
+            << std::setw(22) << "<E>/N" << std::setw(22) << "<|M|>" << "job" << '\n';
+        for (auto const& [name, entry] : session.slots) {
+            out << (name == session.current ? "* " : "  ") << std::setw(12) << name;
+            auto const& other = *entry->model;
+            if (!other.valid()) {
+                out << "(empty)" << '\n';
                 continue;
             }
-            using enum std::errc;
+            auto const jobs = session.jobs.running(&other);
+            auto const pauses = session.jobs.pause(&other);
+            auto const& stats = entry->statistics;
+            auto const with_error = [](BinningAnalysis const& b) {
+                std::ostringstream oss;
+                oss << std::setprecision(5) << b.mean() << " +- " << std::setprecision(2) << b.error();
+                return oss.str();
+            };
+            out << std::setprecision(5) << std::setw(10) << other.size() << std::setw(10) << mebibytes(other.memory_bytes())
+                << std::setw(8) << (&slot == entry.get() ? g_beta : entry->beta) << std::setw(10) << other.sweep_count()
+                << std::setw(10) << static_cast<double>(other.energy()) / static_cast<double>(other.size())
+                << std::setw(10) << std::abs(other.magnetization())
+                << std::setw(22) << (stats.count() ? with_error(stats.energy()) : "-")
+                << std::setw(22) << (stats.count() ? with_error(stats.abs_magnetization()) : "-")
+                << (jobs.empty() ? "-" : '[' + std::to_string(jobs.front()->id()) + "] running") << std::setprecision(6) << '\n';
+        }
+        out << mebibytes(session.memory_used()) << " MiB of the " << mebibytes(session.memory_limit)
+            << " MiB allowed in use." << '\n';
+        return CommandStatus::k_ok;
+    }
+    // drop [name]
+    else if (command[0] == k_drop) {
+        if (command.size() != 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        auto const it = session.slots.find(command[1]);
+        if (it == session.slots.end()) {
+            err << "There's no slot " << command[1] << ". Use models to list them." << '\n';
+            return CommandStatus::k_failed;
+        }
+        if (it == slot_it) {
+            err << "The current slot can't be dropped. Use another one first." << '\n';
+            return CommandStatus::k_failed;
+        }
+        if (auto const jobs = session.jobs.running(it->second->model); !jobs.empty()) {
+            err << "Job " << jobs.front()->id() << " is evolving the model. Use stop or wait first." << '\n';
+            return CommandStatus::k_failed;
+        }
+        session.slots.erase(it);
+        return CommandStatus::k_ok;
+    }
 
-            node_t row_ct{}, col_ct{};
-            auto const& sv_1 = command[1];
-            auto const [p1, e1] = std::from_chars(sv_1.data(), sv_1.data() + sv_1.size(), row_ct);
+    // a job keeps its model until it ends: nothing else may change it, and reading it waits for the end of a sweep.
+    if (auto const jobs = session.jobs.running(&model); !jobs.empty()) {
+        auto const changes_model = command[0] == k_init || command[0] == k_grid || command[0] == k_evolve
+                                || command[0] == k_load || command[0] == k_save
+                                || (command[0] == k_set && command.size() > 1 && command[1] == k_field);
+        if (changes_model) {
+            err << "Job " << jobs.front()->id() << " is evolving the model. Use stop or wait first." << '\n';
+            return CommandStatus::k_failed;
+        }
+    }
+    auto const pauses = session.jobs.pause(&model);
 
-            if (e1 == invalid_argument) {
-                std::cout << "Invalid node!" << '\n';
-                continue;
+    // init [spins_file] [bond_file]
+    // init [model_file]
+    if (command[0] == k_init) {
+        if (command.size() == 2) {
+            try {
+                if (!fits_memory(model_file_bytes(command[1]), "model")) {
+                    return CommandStatus::k_failed;
+                }
+                PerfScope scope(profile, "load");
+                TIME_GUARD(model = load_ising(command[1], verify));
+                statistics.reset();
+                histograms.clear();
+                grid_shape = {};
+                correlation.reset();
+                checkpointer.reset();
             }
-            else if (e1 == result_out_of_range) {
-                std::cout << "Grid is too big!" << '\n';
-                continue;
+            catch (std::string_view filename) {
+                err << "Error opening file " << filename << '\n';
+                status = CommandStatus::k_failed;
+            }
+            catch (std::exception const& e) {
+                err << e.what() << '\n';
+                status = CommandStatus::k_failed;
+            }
+            return status;
+        }
+        if (command.size() != 3) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        if (ordering == Ordering::k_hilbert) {
+            out << "A bond file carries no coordinates, use --order=rcm or --order=bfs instead." << '\n';
+            return CommandStatus::k_failed;
+        }
+        try {
+            if (!fits_memory(text_model_bytes(command[1], command[2], ordering), "model")) {
+                return CommandStatus::k_failed;
             }
+        }
+        catch (std::string_view filename) {
+            err << "Error opening file " << filename << '\n';
+            return CommandStatus::k_failed;
+        }
+        {
+            PerfScope scope(profile, "load");
+            TIME_GUARD(model = make_ising(command[1], command[2], ordering));
+        }
+        statistics.reset();
+        histograms.clear();
+        grid_shape = {};
+        correlation.reset();
+        checkpointer.reset();
+        return CommandStatus::k_ok;
+    }
+    // convert [spins_file] [bond_file] [model_file]
+    else if (command[0] == k_convert) {
+        if (command.size() != 4) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        if (ordering == Ordering::k_hilbert) {
+            out << "A bond file carries no coordinates, use --order=rcm or --order=bfs instead." << '\n';
+            return CommandStatus::k_failed;
+        }
+        try {
+            PerfScope scope(profile, "convert");
+            TIME_GUARD(convert_ising(command[1], command[2], command[3], ordering));
+        }
+        catch (std::string_view filename) {
+            err << "Error opening file " << filename << '\n';
+            status = CommandStatus::k_failed;
+        }
+        catch (std::exception const& e) {
+            err << e.what() << '\n';
+            status = CommandStatus::k_failed;
+        }
+        return status;
+    }
+    // grid [row_ct] ?[col_ct]
+    else if (command[0] == k_grid) {
+        if (command.size() < 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        using enum std::errc;
 
-            // if column count is not specified, use row count.
-            if (command.size() == 2) {
-                col_ct = row_ct;
+        node_t row_ct{}, col_ct{};
+        auto const& sv_1 = command[1];
+        auto const [p1, e1] = std::from_chars(sv_1.data(), sv_1.data() + sv_1.size(), row_ct);
+
+        if (e1 == invalid_argument) {
+            out << "Invalid node!" << '\n';
+            return CommandStatus::k_failed;
+        }
+        else if (e1 == result_out_of_range) {
+            out << "Grid is too big!" << '\n';
+            return CommandStatus::k_failed;
+        }
+
+        // if column count is not specified, use row count.
+        if (command.size() == 2) {
+            col_ct = row_ct;
+        }
+        else {
+            auto const& sv_2 = command[2];
+            auto const [p2, e2] = std::from_chars(sv_2.data(), sv_2.data() + sv_2.size(), col_ct);
+
+            if (e2 == std::errc::invalid_argument) {
+                out << "Invalid node!" << '\n';
+                return CommandStatus::k_failed;
             }
-            else {
-                auto const& sv_2 = command[2];
-                auto const [p2, e2] = std::from_chars(sv_2.data(), sv_2.data() + sv_2.size(), col_ct);
+            else if (e1 == std::errc::result_out_of_range || e2 == std::errc::result_out_of_range) {
+                out << "Grid is too big!" << '\n';
+                return CommandStatus::k_failed;
+            }
+        }
 
-                if (e2 == std::errc::invalid_argument) {
-                    std::cout << "Invalid node!" << '\n';
-                    continue;
+        auto const node_ct = static_cast<std::size_t>(row_ct) * static_cast<std::size_t>(col_ct);
+        if (!fits_memory(Ising::memory_bytes(node_ct, 2 * node_ct, ordering != Ordering::k_none), "grid")) {
+            return CommandStatus::k_failed;
+        }
+        {
+            PerfScope scope(profile, "grid");
+            TIME_GUARD(model = Ising::from_grid(row_ct, col_ct, g_bond_energy, ordering, periodic));
+        }
+        statistics.reset();
+        histograms.clear();
+        grid_shape = { row_ct, col_ct };
+        grid_periodic = periodic;
+        correlation.reset();
+        checkpointer.reset();
+        return CommandStatus::k_ok;
+    }
+
+    // profile [on|off|clear]
+    // profile [trace_file]
+    else if (command[0] == k_profile) {
+        auto& tracer = Tracer::instance();
+        if (command.size() == 2 && command[1] == "on") {
+            tracer.name_thread("main");
+            tracer.enable(true);
+            return CommandStatus::k_ok;
+        }
+        else if (command.size() == 2 && command[1] == "off") {
+            tracer.enable(false);
+            return CommandStatus::k_ok;
+        }
+        else if (command.size() == 2 && command[1] == "clear") {
+            tracer.clear();
+            return CommandStatus::k_ok;
+        }
+        else if (command.size() > 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        if (!tracer.enabled() && tracer.event_count().first == 0) {
+            out << "Nothing traced yet. Use profile on first." << '\n';
+            return CommandStatus::k_ok;
+        }
+        tracer.report(out);
+        try {
+            if (command.size() == 2) {
+                std::ofstream ofs{ std::string(command[1]) };
+                if (!ofs) {
+                    throw command[1];
                 }
-                else if (e1 == std::errc::result_out_of_range || e2 == std::errc::result_out_of_range) {
-                    std::cout << "Grid is too big!" << '\n';
-                    continue;
+                tracer.write_chrome_trace(ofs);
+                out << "Trace written to " << command[1] << ", open it in ui.perfetto.dev or chrome://tracing." << '\n';
+            }
+        }
+        catch (std::string_view filename) {
+            err << "Error opening file " << filename << '\n';
+            status = CommandStatus::k_failed;
+        }
+        return status;
+    }
+    // set [beta|field|name] [value]
+    else if (command[0] == k_set) {
+        if (command.size() != 3) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        double value{};
+        auto const [ptr, ec] = std::from_chars(command[2].data(), command[2].data() + command[2].size(), value);
+        auto const numeric = ec == std::errc{} && ptr == command[2].data() + command[2].size();
+        if (command[1] == k_field) {
+            if (!numeric) {
+                out << "The field has to be a number." << '\n';
+                return CommandStatus::k_failed;
+            }
+            if (!model.valid()) {
+                err << "There's no model to set the field of. Use init or grid first." << '\n';
+                return CommandStatus::k_failed;
+            }
+            model.set_field(static_cast<field_t>(value));
+        }
+        else if (command[1] == k_beta_name) {
+            if (!numeric) {
+                out << "beta has to be a number." << '\n';
+                return CommandStatus::k_failed;
+            }
+            g_beta = value;
+        }
+        else if (command[1] == k_memory) {
+            if (session.parallel) {
+                out << "set memory can't run in a parallel for, its iterations share the budget of the loop." << '\n';
+                return CommandStatus::k_failed;
+            }
+            auto const bytes = parse_size(command[2]);
+            if (!bytes) {
+                out << "The memory limit has to be a size like 512M or 8G." << '\n';
+                return CommandStatus::k_failed;
+            }
+            session.memory_limit = *bytes;
+        }
+        session.variables[std::string(command[1])] = std::string(command[2]);
+        return CommandStatus::k_ok;
+    }
+
+    // check validity of the global Ising model.
+    if (!model.valid()) {
+        err << "There's no model or the model is invalid right now. Use init to initialize an Ising model" << '\n';
+        return CommandStatus::k_failed;
+    }
+
+    // hist [output_file]
+    if (command[0] == k_hist) {
+        if (command.size() > 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        if (histograms.empty()) {
+            out << "There's no histogram yet. Use evolve to record one." << '\n';
+            return CommandStatus::k_failed;
+        }
+        try {
+            TIME_GUARD_START;
+            if (command.size() == 2) {
+                std::ofstream ofs{ std::string(command[1]) };
+                if (!ofs) {
+                    throw command[1];
                 }
+                print_histograms(ofs, histograms, beta_range, beta_steps);
+            }
+            else {
+                print_histograms(out, histograms, beta_range, beta_steps);
+            }
+            TIME_GUARD_STOP;
+        }
+        catch (std::string_view filename) {
+            err << "Error opening file " << filename << '\n';
+            status = CommandStatus::k_failed;
+        }
+        catch (std::exception const& e) {
+            err << e.what() << '\n';
+            status = CommandStatus::k_failed;
+        }
+    }
+    // save [checkpoint_file]
+    else if (command[0] == k_save) {
+        if (command.size() != 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        try {
+            TIME_GUARD(checkpointer_of(command[1]).save(model, statistics));
+        }
+        catch (std::exception const& e) {
+            err << e.what() << '\n';
+            status = CommandStatus::k_failed;
+        }
+    }
+    // load [checkpoint_file]
+    else if (command[0] == k_load) {
+        if (command.size() != 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        try {
+            // the file may still be being written, and the next save has to start over with a full record.
+            checkpointer.reset();
+            TIME_GUARD(restore_checkpoint(command[1], model, statistics));
+            out << "Restored at sweep " << model.sweep_count() << '\n';
+        }
+        catch (std::string_view filename) {
+            err << "Error opening file " << filename << '\n';
+            status = CommandStatus::k_failed;
+        }
+        catch (std::exception const& e) {
+            err << e.what() << '\n';
+            status = CommandStatus::k_failed;
+        }
+    }
+    // stats [-r]
+    else if (command[0] == k_stats) {
+        out << "Engine telemetry:" << '\n';
+        model.telemetry().report(out);
+        if (perf && !perf->empty()) {
+            out << "Hardware counters of the commands run with --perf:" << '\n';
+            perf->report(out);
+        }
+        if (command.size() > 1 && command[1] == "-r") {
+            model.reset_telemetry();
+            if (perf) {
+                perf->reset();
             }
+        }
+    }
+    // show [options]
+    else if (command[0] == k_show) {
+        bool show_energy = false;
+        bool show_config = false;
+        bool show_state = false;
+        bool show_mag = false;
+        bool show_stats = false;
+        bool show_correlation = false;
 
-            TIME_GUARD(g_model = Ising::from_grid(row_ct, col_ct, g_bond_energy));
-            continue;
+        if (command.size() == 1) {
+            show_energy = show_config = show_state = show_mag = show_stats = true;
+            show_correlation = correlation.has_value();
         }
 
-        // check validity of the global Ising model.
-        if (!g_model.valid()) {
-            std::cerr << "There's no model or the model is invalid right now. Use init to initialize an Ising model" << '\n';
-            continue;
+        TIME_GUARD_START;
+        for (auto const& opt : command | stdv::drop(1)) {
+            auto const opt_name = opt.substr(1);
+            if (opt_name == "e") {
+                show_energy = true;
+            }
+            else if (opt_name == "c") {
+                show_config = true;
+            }
+            else if (opt_name == "s") {
+                show_state = true;
+            }
+            else if (opt_name == "m") {
+                show_mag = true;
+            }
+            else if (opt_name == "t") {
+                show_stats = true;
+            }
+            else if (opt_name == "g") {
+                show_correlation = true;
+            }
         }
 
-        // hist [output_file]
-        if (command[0] == k_hist) {
-            if (command.size() > 3) {
-                print_usage();
-                continue;
+        auto const energy = model.energy();
+        auto const state = model.state();
+        auto const mag = model.magnetization();
+        if (show_config) {
+            out << model << '\n';
+        }
+        if (show_energy) {
+            out << "The energy of this configuration is: " << energy << '\n';
+        }
+        if (show_state) {
+            out << "The state of this configuration is: " << state << '\n';
+        }
+        if (show_mag) {
+            out << "The magnetization of this configuration is: " << mag << '\n';
+            out << "The magnetization squared of this configuration is: " << mag * mag << '\n';
+        }
+        if (show_stats) {
+            statistics.report(out);
+        }
+        if (show_correlation) {
+            if (!correlation || correlation->sample_count() == 0) {
+                out << "There's no correlation measured yet. Use evolve --correlation=[sweeps] on a grid." << '\n';
+            }
+            else {
+                out << "Correlation over " << correlation->sample_count() << " samples, second-moment length: "
+                          << correlation->correlation_length() << '\n';
+                auto const g = correlation->radial_correlation();
+                for (std::size_t r = 0; r < std::min<std::size_t>(g.size(), 16); ++r) {
+                    out << "  G(" << r << ") = " << g[r] << '\n';
+                }
             }
-            undefined();
         }
-        // show [options]
-        else if (command[0] == k_show) {
-            bool show_energy = false;
-            bool show_config = false;
-            bool show_state = false;
-            bool show_mag = false;
+        TIME_GUARD_STOP;
+    }
+    // evolve [sweep_count] [options] (&)
+    else if (command[0] == k_evolve) {
+        if (command.size() < 2) {
+            print_usage(out);
+            return CommandStatus::k_failed;
+        }
+        auto const background = command.back() == "&";
+        if (background && profile) {
+            out << "--perf only counts the thread it runs on, so it can't profile a background run." << '\n';
+            return CommandStatus::k_failed;
+        }
 
-            if (command.size() == 1) {
-                show_energy = show_config = show_state = show_mag = true;
+        unsigned fields{};
+        for (auto const& opt : command | stdv::drop(2)) {
+            auto const opt_name = opt.substr(1);
+            if (opt_name == "e") {
+                fields |= StreamRecorder::k_energy;
+            }
+            else if (opt_name == "s") {
+                fields |= StreamRecorder::k_state;
             }
+            else if (opt_name == "m") {
+                fields |= StreamRecorder::k_magnetization;
+            }
+        }
+        if (fields && out_file.empty()) {
+            out << "-e, -s and -m need --out=[file] to record into." << '\n';
+        }
 
-            TIME_GUARD_START;
-            for (auto const& opt : command | stdv::drop(1)) {
-                auto const opt_name = opt.substr(1);
-                if (opt_name == "e") {
-                    show_energy = true;
+        auto const sweep_count = std::max(std::atoi(command[1].data()), 0);
+        auto histogram = stdr::find(histograms, g_beta, &EnergyHistogram::beta);
+        if (histogram == histograms.end()) {
+            histogram = histograms.insert(histogram, EnergyHistogram(g_beta));
+        }
+        // the run, on this thread or a job's; it keeps copies of what it needs of the line, which a job outlives.
+        auto const run = [&model, &statistics, &correlation, histogram = &*histogram, checkpointer_of, profile,
+                          beta = g_beta, grid_shape, grid_periodic, overlap, correlation_every, checkpoint_every,
+                          checkpoint_seconds, budget, fields, sweep_count, out_file = std::string(out_file),
+                          checkpoint_file = std::string(checkpoint_file)]
+                         (std::ostream& out, std::ostream& err, EvolveJob* job, std::stop_token token) {
+            g_beta = beta;
+            try {
+                model.stablize();
+                std::optional<StreamRecorder> stream{};
+                if (!out_file.empty()) {
+                    auto const stream_fields = fields ? fields : StreamRecorder::k_energy | StreamRecorder::k_magnetization;
+                    stream.emplace(out_file, stream_fields, StreamRecorder::format_of(out_file));
+                }
+                auto* const writer = checkpoint_file.empty() ? nullptr : &checkpointer_of(checkpoint_file);
+                MeasurementScheduler<Ising> scheduler{};
+                std::optional<OverlappedMeasurement<Ising>> overlapped{};
+                scheduler.every(1, statistics).every(1, *histogram);
+                if (correlation_every != 0) {
+                    if (grid_shape.first == 0) {
+                        out << "--correlation needs a model made by grid." << '\n';
+                    }
+                    else {
+                        if (!correlation) {
+                            correlation.emplace(grid_shape.first, grid_shape.second, 1, grid_periodic);
+                        }
+                        std::function<void(Ising const&)> correlator = std::ref(*correlation);
+                        if (overlap) {
+                            overlapped.emplace().add(*correlation);
+                            correlator = std::ref(*overlapped);
+                        }
+                        if (correlation_every > 0) {
+                            scheduler.every(correlation_every, std::move(correlator));
+                        }
+                        else {
+                            scheduler.decorrelated(std::move(correlator));
+                        }
+                    }
+                }
+                if (stream) {
+                    scheduler.every(1, *stream);
+                }
+                if (writer) {
+                    // saving clears the dirty blocks, so it takes the model itself rather than the view the hooks get.
+                    auto const checkpoint = [writer, &model, &statistics](Ising const&) { writer->save(model, statistics); };
+                    if (checkpoint_seconds > 0) {
+                        scheduler.every(std::chrono::seconds(checkpoint_seconds), checkpoint);
+                    }
+                    else {
+                        scheduler.every(checkpoint_every, checkpoint);
+                    }
+                }
+                // a reader let in may read what the overlapped measurements write, so they finish first.
+                std::function<void()> const settle = [&overlapped] {
+                    if (overlapped) {
+                        overlapped->wait();
+                    }
+                };
+                if (job) {
+                    // last, so a reader let in sees the recorders done with the sweep.
+                    scheduler.every(1, [job, &scheduler, &settle](Ising const& self) {
+                        job->between_sweeps(scheduler.sweep_count(),
+                                            static_cast<double>(self.energy()) / static_cast<double>(self.size()),
+                                            self.magnetization(), settle);
+                    });
                 }
-                else if (opt_name == "c") {
-                    show_config = true;
+                scheduler.stop_on(token);
+                if (budget) {
+                    scheduler.budget(*budget);
                 }
-                else if (opt_name == "s") {
-                    show_state = true;
+                if (profile) {
+                    PerfScope scope(profile, "sweep");
+                    model.markov_chain_monte_carlo(profile_sweeps(*profile, scheduler), sweep_count);
                 }
-                else if (opt_name == "m") {
-                    show_mag = true;
+                else {
+                    model.markov_chain_monte_carlo(scheduler, sweep_count);
                 }
+                if (token.stop_requested()) {
+                    out << "Stopped after " << scheduler.sweep_count() << " of " << sweep_count << " sweeps." << '\n';
+                }
+                else if (scheduler.sweep_count() < static_cast<uint64_t>(sweep_count)) {
+                    out << "The budget ran out after " << scheduler.sweep_count() << " of " << sweep_count << " sweeps." << '\n';
+                }
+                if (overlapped) {
+                    overlapped->wait();
+                    out << overlapped->stall_count() << " of " << overlapped->snapshot_count()
+                              << " snapshots waited for the measurement." << '\n';
+                }
+                if (writer) {
+                    writer->save(model, statistics);
+                }
+                if (stream) {
+                    stream->close();
+                    out << stream->sample_count() << " samples written to " << out_file << '\n';
+                }
+                return true;
             }
-
-            auto const energy = g_model.energy();
-            auto const state = g_model.state();
-            auto const mag = g_model.magnetization();
-            if (show_config) {
-                std::cout << g_model << '\n';
+            catch (std::string_view filename) {
+                err << "Error opening file " << filename << '\n';
             }
-            if (show_energy) {
-                std::cout << "The energy of this configuration is: " << energy << '\n';
+            catch (std::exception const& e) {
+                err << e.what() << '\n';
+            }
+            return false;
+        };
+        if (background) {
+            auto const& job = session.jobs.start(std::string(line_sv), &model, static_cast<uint64_t>(sweep_count),
+                [run](EvolveJob& job, std::ostream& log, std::stop_token token) { return run(log, log, &job, token); });
+            out << '[' << job.id() << "] " << line_sv << '\n';
+            return CommandStatus::k_ok;
+        }
+        TIME_GUARD_START;
+        if (!run(out, err, nullptr, {})) {
+            status = CommandStatus::k_failed;
+        }
+        TIME_GUARD_STOP;
+    }
+    else {
+        print_usage(out);
+        status = CommandStatus::k_failed;
+    }
+    return status;
+
+#   undef TIME_GUARD_START
+#   undef TIME_GUARD_STOP
+}
+
+/**
+ * @brief A line of a script, numbered for the errors.
+ */
+struct ScriptLine {
+    std::size_t number;
+    std::string text;
+};
+
+inline std::vector<std::string_view> split_words(std::string_view line) {
+    std::vector<std::string_view> words{};
+    for (auto&& word : line | stdv::split(' ')) {
+        auto const sv = std::string_view(&*word.begin(), stdr::distance(word));
+        if (!sv.empty()) {
+            words.push_back(sv);
+        }
+    }
+    return words;
+}
+
+/**
+ * @brief The count of for loops a script opens minus the count of ends closing them.
+ */
+inline int open_block_count(std::span<ScriptLine const> lines) {
+    int depth{};
+    for (auto const& line : lines) {
+        auto const words = split_words(line.text);
+        if (!words.empty() && words[0] == k_for) {
+            ++depth;
+        }
+        else if (!words.empty() && words[0] == k_end) {
+            --depth;
+        }
+    }
+    return depth;
+}
+
+/**
+ * @brief Replace $name and ${name} by the value of a variable, and $$ by $. $beta is the current beta.
+ * @return The line, or nothing if it uses a variable that isn't set, which is reported.
+ */
+inline std::optional<std::string> substitute(ReplSession const& session, std::string_view line) {
+    auto const is_name = [](char ch) { return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_'; };
+    std::string result{};
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        if (line[i] != '$') {
+            result += line[i];
+            continue;
+        }
+        if (i + 1 < line.size() && line[i + 1] == '$') {
+            result += '$';
+            ++i;
+            continue;
+        }
+        std::string_view name{};
+        if (i + 1 < line.size() && line[i + 1] == '{') {
+            auto const close = line.find('}', i + 2);
+            if (close == std::string_view::npos) {
+                *session.err << "Missing } in " << line << '\n';
+                return std::nullopt;
             }
-            if (show_state) {
-                std::cout << "The state of this configuration is: " << state << '\n';
+            name = line.substr(i + 2, close - i - 2);
+            i = close;
+        }
+        else {
+            auto end = i + 1;
+            while (end < line.size() && is_name(line[end])) {
+                ++end;
             }
-            if (show_mag) {
-                std::cout << "The magnetization of this configuration is: " << mag << '\n';
-                std::cout << "The magnetization squared of this configuration is: " << mag * mag << '\n';
+            name = line.substr(i + 1, end - i - 1);
+            i = end - 1;
+        }
+        if (name == k_beta_name) {
+            std::ostringstream oss{};
+            oss << g_beta;
+            result += oss.str();
+        }
+        else if (auto const it = session.variables.find(name); it != session.variables.end()) {
+            result += it->second;
+        }
+        else {
+            *session.err << "The variable " << name << " isn't set." << '\n';
+            return std::nullopt;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief A session with only a copy of the current slot, its model reseeded, with the same variables and
+ * measurements so far but no histograms, writing into out and err. Its models are counted in forks_used beside
+ * those of session, against the same limit.
+ * @return nullptr if the copy doesn't fit the limit.
+ */
+inline std::unique_ptr<ReplSession> fork_session(ReplSession const& session, std::atomic<std::size_t>& forks_used,
+                                                 std::ostream& out, std::ostream& err) {
+    auto const& source = session.slot();
+    auto const bytes = source.model->valid() ? source.model->memory_bytes() : 0;
+    auto const parent_used = session.memory_used();
+    auto total = forks_used.load();
+    do {
+        if (parent_used + total > session.memory_limit || bytes > session.memory_limit - parent_used - total) {
+            return nullptr;
+        }
+    } while (!forks_used.compare_exchange_weak(total, total + bytes));
+    auto model = std::make_unique<Ising>(source.model->clone());
+    model->seed(std::random_device{}());
+    auto result = std::make_unique<ReplSession>(*model, out, err);
+    result->slots.clear();
+    auto& slot = *result->slots.emplace(session.current, std::make_unique<ModelSlot>(std::move(model))).first->second;
+    result->current = session.current;
+    slot.beta = source.beta;
+    slot.statistics = source.statistics;
+    slot.grid_shape = source.grid_shape;
+    slot.grid_periodic = source.grid_periodic;
+    slot.correlation = source.correlation;
+    result->variables = session.variables;
+    result->memory_limit = session.memory_limit;
+    result->parallel = true;
+    result->parent_used = parent_used;
+    result->forks_used = &forks_used;
+    result->forked_bytes = bytes;
+    return result;
+}
+
+/**
+ * @brief Run lines of a script: commands, and for loops
+ *     for [name] in [values...] (--parallel(=[n]))
+ *     ...
+ *     end
+ * which run their body once per value after setting the variable to it the way set does, so a loop over beta or
+ * field changes them. With --parallel at most n iterations run at once on threads of their own (by default as many
+ * as the ThreadPool has), each on a copy of the model with its own beta and measurements, the copies and what the iterations
+ * make counting against the memory limit beside the session's slots; their output is printed after the loop, in
+ * the order of the values, and the histograms they record join the session's, a later one replacing an earlier one
+ * of the same beta.
+ * @return k_failed at the first command failed, with session.error_line set; k_exit at exit.
+ */
+inline CommandStatus run_lines(ReplSession& session, std::span<ScriptLine const> lines) {
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        auto const& [number, text] = lines[i];
+        auto const first = text.find_first_not_of(" \t");
+        if (first == std::string::npos || text[first] == '#') {
+            continue;
+        }
+        auto const fail = [&session, number](std::string_view message) {
+            if (!message.empty()) {
+                *session.err << message << '\n';
             }
-            TIME_GUARD_STOP;
+            session.error_line = number;
+            return CommandStatus::k_failed;
+        };
+        auto const line = substitute(session, text);
+        if (!line) {
+            return fail("");
         }
-        // evolve [sweep_count] [options]
-        else if (command[0] == k_evolve) {
-            if (command.size() < 2) {
-                print_usage();
-                continue;
+        auto const words = split_words(*line);
+        if (words.empty()) {
+            continue;
+        }
+        if (words[0] == k_end) {
+            return fail("end without a for.");
+        }
+        if (words[0] != k_for) {
+            auto const status = execute(session, *line);
+            session.settle_memory();
+            if (status == CommandStatus::k_failed) {
+                return fail("");
             }
-            TIME_GUARD_START;
-            g_model.stablize();
+            if (status == CommandStatus::k_exit) {
+                return status;
+            }
+            continue;
+        }
 
-            bool record_energy = false;
-            bool record_state = false;
-            bool record_magnetization = false;
+        // for [name] in [values...] (--parallel(=[n]))
+        auto end = i + 1;
+        for (int depth = 1; end < lines.size(); ++end) {
+            auto const inner = split_words(lines[end].text);
+            depth += !inner.empty() && inner[0] == k_for;
+            depth -= !inner.empty() && inner[0] == k_end;
+            if (depth == 0) {
+                break;
+            }
+        }
+        if (end == lines.size()) {
+            return fail("for without an end.");
+        }
+        if (words.size() < 3 || words[2] != k_in) {
+            return fail("Usage: for [name] in [values...] (--parallel(=[n]))");
+        }
+        auto const name = std::string(words[1]);
+        bool parallel = false;
+        unsigned thread_ct{};
+        std::vector<std::string> values{};
+        for (auto const word : words | stdv::drop(3)) {
+            if (word.starts_with("--")) {
+                auto const option = word.substr(2);
+                if (!option.starts_with(k_parallel)) {
+                    return fail("Unknown option " + std::string(word) + " of for.");
+                }
+                parallel = true;
+                auto const value = option.substr(std::string_view(k_parallel).size());
+                if (value.starts_with('=')) {
+                    std::from_chars(value.data() + 1, value.data() + value.size(), thread_ct);
+                }
+            }
+            else {
+                values.emplace_back(word);
+            }
+        }
+        auto const body = lines.subspan(i + 1, end - i - 1);
+        auto const assign = std::string(k_set) + ' ' + name + ' ';
+        i = end;
 
-            for (auto const& opt : command | stdv::drop(1)) {
-                auto const opt_name = opt.substr(1);
-                if (opt_name == "e") {
-                    record_energy = true;
+        if (!parallel) {
+            for (auto const& value : values) {
+                if (execute(session, assign + value) == CommandStatus::k_failed) {
+                    return fail("");
                 }
-                else if (opt_name == "s") {
-                    record_state = true;
+                if (auto const status = run_lines(session, body); status != CommandStatus::k_ok) {
+                    return status;
                 }
-                else if (opt_name == "m") {
-                    record_magnetization = true;
+            }
+            continue;
+        }
+
+        // the copies would be taken mid-sweep, and the histograms a job records into could move.
+        if (auto const jobs = session.jobs.running(); !jobs.empty()) {
+            return fail("Job " + std::to_string(jobs.front()->id()) + " is running. Use stop or wait before a parallel for.");
+        }
+        struct Iteration {
+            std::ostringstream out;
+            std::ostringstream err;
+            CommandStatus status = CommandStatus::k_ok;
+            std::size_t error_line{};
+            int exit_code{};
+            std::vector<EnergyHistogram> histograms;
+        };
+        std::vector<Iteration> iterations(values.size());
+        // the bytes the copies and whatever the iterations make take together.
+        std::atomic<std::size_t> forks_used{};
+        auto const beta = g_beta;
+        // threads of their own rather than the pool's, as an iteration may run for hours; n of them taking the
+        // iterations in turn keep at most n running at once.
+        thread_ct = thread_ct ? thread_ct : ThreadPool::instance().concurrency();
+        run_on_threads("parallel for", values.size(), thread_ct, [&](std::size_t k) {
+            // the calling thread runs iterations too, and goes on at its own beta after.
+            ScopedBeta scoped_beta(beta);
+            auto& iteration = iterations[k];
+            auto const fork = fork_session(session, forks_used, iteration.out, iteration.err);
+            if (!fork) {
+                iteration.err << "There's no memory left for a copy of the model. Use set memory or --parallel="
+                              << "[n] with a smaller n." << '\n';
+                iteration.status = CommandStatus::k_failed;
+                return;
+            }
+            iteration.status = execute(*fork, assign + values[k]);
+            if (iteration.status == CommandStatus::k_ok) {
+                iteration.status = run_lines(*fork, body);
+            }
+            iteration.error_line = iteration.status == CommandStatus::k_failed ? fork->error_line : 0;
+            iteration.exit_code = fork->exit_code;
+            iteration.histograms = std::move(fork->slot().histograms);
+            forks_used -= fork->forked_bytes;
+        });
+
+        auto status = CommandStatus::k_ok;
+        for (std::size_t k = 0; k < values.size(); ++k) {
+            auto& iteration = iterations[k];
+            *session.out << iteration.out.str();
+            *session.err << iteration.err.str();
+            if (iteration.status == CommandStatus::k_failed) {
+                *session.err << "The iteration " << name << " = " << values[k] << " stopped at line "
+                             << (iteration.error_line ? iteration.error_line : number) << '.' << '\n';
+                status = CommandStatus::k_failed;
+            }
+            else if (iteration.status == CommandStatus::k_exit && status == CommandStatus::k_ok) {
+                status = CommandStatus::k_exit;
+                session.exit_code = iteration.exit_code;
+            }
+            auto& histograms = session.slot().histograms;
+            for (auto& histogram : iteration.histograms) {
+                auto const same = stdr::find(histograms, histogram.beta(), &EnergyHistogram::beta);
+                if (same != histograms.end()) {
+                    *same = std::move(histogram);
+                }
+                else {
+                    histograms.push_back(std::move(histogram));
                 }
             }
-            
-            if (command.size() == 2) {
-                auto const sweep_count = std::atoi(command[1].data());
-                g_model.markov_chain_monte_carlo(Ising::pass, sweep_count);
-                continue;
+        }
+        if (status == CommandStatus::k_failed) {
+            return fail("");
+        }
+        if (status == CommandStatus::k_exit) {
+            return status;
+        }
+    }
+    return CommandStatus::k_ok;
+}
+
+/**
+ * @brief Run the commands of a stream, a for loop once its end is read. Interactively every line gets a prompt and
+ * failed commands are only reported; otherwise the run stops at the first failed command.
+ * Jobs that ended are reported before the next line. At the end, the jobs still running are waited for when a
+ * script ran out, and stopped otherwise.
+ * @return The exit status: 0 when the stream ran out, 1 when a command or, in a script, a job failed, or the
+ * status given to exit.
+ */
+inline int run_script(ReplSession& session, std::istream& in, bool interactive) {
+    auto const finish = [&session, interactive](int code) {
+        if (interactive || code != EXIT_SUCCESS) {
+            session.jobs.stop_all();
+        }
+        session.jobs.wait_all();
+        auto const job_failed = session.jobs.reap(*session.out);
+        return code == EXIT_SUCCESS && job_failed && !interactive ? EXIT_FAILURE : code;
+    };
+    std::string line;
+    std::size_t number{};
+    while (true) {
+        session.jobs.reap(*session.out);
+        if (interactive) {
+            prompt();
+        }
+        if (!std::getline(in, line)) {
+            return finish(EXIT_SUCCESS);
+        }
+        std::vector<ScriptLine> block{ { ++number, line } };
+        while (open_block_count(block) > 0) {
+            if (interactive) {
+                prompt("... ");
             }
-            else {
-                g_model.markov_chain_monte_carlo(Ising::pass);
+            if (!std::getline(in, line)) {
+                break;
             }
-            TIME_GUARD_STOP;
+            block.push_back({ ++number, line });
         }
-        else {
-            print_usage();
+        auto const status = run_lines(session, block);
+        if (status == CommandStatus::k_exit) {
+            return finish(session.exit_code);
+        }
+        if (status == CommandStatus::k_failed && !interactive) {
+            *session.err << "Stopped at line " << session.error_line << '.' << '\n';
+            return finish(EXIT_FAILURE);
         }
     }
-    std::exit(EXIT_SUCCESS);
+}
 
-#   undef TIME_GUARD_START
-#   undef TIME_GUARD_STOP
+/**
+ * @brief Run a script, e.g. a file or piped standard input, on g_model without prompts.
+ * @return The exit status of run_script().
+ */
+inline int run_batch(std::istream& in) {
+    extern Ising g_model;
+    ReplSession session(g_model, std::cout, std::cerr);
+    return run_script(session, in, false);
 }
 
+[[noreturn]]
+inline void repl() {
+    extern Ising g_model;
+    // static, so whatever is still queued gets written when exit() runs.
+    static ReplSession session(g_model, std::cout, std::cerr);
 
+    println("REPL started.");
+    auto const code = run_script(session, std::cin, true);
+    std::cout << "Now exit the REPL." << std::endl;
+    std::exit(code);
+}
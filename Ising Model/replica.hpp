@@ -0,0 +1,269 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "ising_model.hpp"
+
+/**
+ * @brief K independent replicas of one Ising graph, updated together.
+ * The spins are stored replica-interleaved (spin i of every replica is adjacent in memory), so a single pass over
+ * the adjacency of node i updates all K replicas at once, and the inner loop over the lanes is vectorizable.
+ * Each replica owns its own random stream, so the chains are statistically independent.
+ *
+ * @tparam SpinT Enumeration type of spin; see spin.hpp.
+ * @tparam EnergyT Energy type; usually double.
+ * @tparam FieldT Field type; usually double.
+ * @tparam K The count of replicas, ideally a multiple of the SIMD width.
+ */
+template<typename SpinT, typename EnergyT, typename FieldT, std::size_t K>
+class BasicReplicaBatch {
+public:
+    using STraits = SpinTraits<SpinT>;
+    using Model = BasicIsing<SpinT, EnergyT, FieldT>;
+    using This = BasicReplicaBatch;
+    using Lanes = std::array<EnergyT, K>;
+
+    static constexpr std::size_t replica_count() noexcept {
+        return K;
+    }
+
+    /**
+     * @brief A read-only view of one replica; it looks like a model to the recorders in BasicIsing.
+     */
+    class Replica {
+    public:
+        Replica(This const& batch, std::size_t r) noexcept
+            : m_batch(&batch), m_r(r) {}
+
+        node_t size() const noexcept {
+            return m_batch->size();
+        }
+
+        SpinT spin(node_t n) const {
+            return STraits::from_value(m_batch->m_values[n * K + m_r]);
+        }
+
+        EnergyT energy() const noexcept {
+            return m_batch->m_energies[m_r];
+        }
+
+        double magnetization() const noexcept {
+            return m_batch->m_sums[m_r] / m_batch->size();
+        }
+
+        int64_t state() const {
+            auto const base = static_cast<int64_t>(STraits::state_count());
+            int64_t result{};
+            for (node_t n = 0; n < size(); ++n) {
+                result = result * base + STraits::index(spin(n));
+            }
+            return result;
+        }
+
+    private:
+        This const* m_batch;
+        std::size_t m_r;
+    };
+
+    /**
+     * @brief Drive one recorder per replica, e.g. ReplicaBatch::Recorder<Ising::EnergyRecorder>.
+     * Calling it without arguments returns the K recorded results, indexed by replica.
+     */
+    template<typename R>
+    struct Recorder {
+        auto operator ()(This const& self) const {
+            for (std::size_t r = 0; r < K; ++r) {
+                m_recorders[r](self.replica(r));
+            }
+        }
+        auto operator ()() const {
+            using ResultT = decltype(std::declval<R const&>()());
+            std::array<ResultT, K> result{};
+            for (std::size_t r = 0; r < K; ++r) {
+                result[r] = m_recorders[r]();
+            }
+            return result;
+        }
+
+    private:
+        std::array<R, K> m_recorders{};
+    };
+
+    BasicReplicaBatch() noexcept = default;
+
+    /**
+     * @brief Copy the graph arrays of a model and start K replicas from random configurations.
+     * @param model The model whose graph (fields and bonds) is shared by all replicas.
+     * @param seed The seed of the first replica; the other streams are jumped ahead from it.
+     */
+    explicit BasicReplicaBatch(Model const& model, uint64_t seed = std::random_device{}()) {
+        auto const n = model.size();
+        m_fields.assign(model.fields().begin(), model.fields().end());
+        m_offsets.assign(model.offsets().begin(), model.offsets().end());
+        m_targets.assign(model.targets().begin(), model.targets().end());
+        m_couplings.assign(model.couplings().begin(), model.couplings().end());
+
+        rng_t rng(seed);
+        for (auto& r : m_rngs) {
+            r = rng;
+            rng.jump();
+        }
+        m_values.resize(n * K);
+        this->randomize();
+    }
+
+    node_t size() const noexcept {
+        return static_cast<node_t>(m_fields.size());
+    }
+
+    Replica replica(std::size_t r) const noexcept {
+        return { *this, r };
+    }
+
+    EnergyT energy(std::size_t r) const noexcept {
+        return m_energies[r];
+    }
+
+    double magnetization(std::size_t r) const noexcept {
+        return m_sums[r] / size();
+    }
+
+    /**
+     * @brief Give every replica a new random configuration and recompute the energies from scratch.
+     */
+    void randomize() {
+        for (node_t i = 0; i < size(); ++i) {
+            for (std::size_t r = 0; r < K; ++r) {
+                m_values[i * K + r] = STraits::value_of(random_spin<SpinT>(m_rngs[r]));
+            }
+        }
+        this->recompute();
+    }
+
+    /**
+     * @brief Start every replica from the configuration of a model with the same graph, e.g. an ordered one.
+     */
+    void assign(Model const& model) {
+        for (node_t i = 0; i < size(); ++i) {
+            for (std::size_t r = 0; r < K; ++r) {
+                m_values[i * K + r] = STraits::value_of(model.spin(i));
+            }
+        }
+        this->recompute();
+    }
+
+    /**
+     * @brief Stablize all replicas by performing several sweeps first.
+     */
+    void stablize() {
+        auto const k_stable_sweep_ct = 10;
+        this->markov_chain_monte_carlo(Model::pass, k_stable_sweep_ct);
+    }
+
+    /**
+     * @brief Metropolis sweeps over all replicas at once.
+     * A sweep visits the nodes in order; for each node the neighbors are read once and the flip is proposed in
+     * every replica, each accepting with its own random number. The proposal does not depend on the state, so each
+     * lane is a valid Metropolis chain of the original model.
+     * @tparam F A callback type.
+     * @param callback Moniter the batch every sweep, e.g. a ReplicaBatch::Recorder. If it has stop_requested(), the
+     * run ends after the first sweep it returns true for.
+     * @param sweep_limit The count of sweeps.
+    */
+    template<typename F>
+    void markov_chain_monte_carlo(F&& callback, int sweep_limit = 1000) {
+        constexpr bool k_can_stop = requires { { callback.stop_requested() } -> std::convertible_to<bool>; };
+        auto const n = size();
+        auto const beta = static_cast<EnergyT>(g_beta);
+
+        for (int sweep = 0; sweep < sweep_limit; ++sweep) {
+            std::optional<TraceScope> trace(std::in_place, "sweep");
+            auto const mark = Telemetry::start();
+            uint64_t accepted{};
+            for (node_t i = 0; i < n; ++i) {
+                Lanes local{};
+                for (auto k = m_offsets[i]; k < m_offsets[i + 1]; ++k) {
+                    auto const e = m_couplings[k];
+                    auto const* neighbor = &m_values[m_targets[k] * K];
+                    for (std::size_t r = 0; r < K; ++r) {
+                        local[r] += e * neighbor[r];
+                    }
+                }
+
+                auto* spins = &m_values[i * K];
+                auto const h = m_fields[i];
+                for (std::size_t r = 0; r < K; ++r) {
+                    // flipping s changes it by -2s, hence dE = -2s (h - sum_j J_ij s_j).
+                    auto const delta = -2 * spins[r] * (h - local[r]);
+                    if (delta <= 0 || std::exp(-beta * delta) > m_rngs[r].uniform()) {
+                        m_energies[r] += delta;
+                        m_sums[r] -= 2 * spins[r];
+                        spins[r] = -spins[r];
+                        if constexpr (Telemetry::k_enabled) {
+                            ++accepted;
+                        }
+                    }
+                }
+            }
+            m_telemetry.end_sweep(mark, static_cast<uint64_t>(n) * K, accepted);
+            trace.emplace("callback");
+            callback(*this);
+            if constexpr (k_can_stop) {
+                if (callback.stop_requested()) {
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief The counters of the sweeps performed, over all replicas.
+     */
+    Telemetry const& telemetry() const noexcept {
+        return m_telemetry;
+    }
+
+    void reset_telemetry() noexcept {
+        m_telemetry.reset();
+    }
+
+private:
+    void recompute() {
+        m_energies.fill(EnergyT{});
+        m_sums.fill(0.0);
+        for (node_t i = 0; i < size(); ++i) {
+            auto const* spins = &m_values[i * K];
+            for (std::size_t r = 0; r < K; ++r) {
+                m_energies[r] += spins[r] * m_fields[i];
+                m_sums[r] += spins[r];
+            }
+            for (auto k = m_offsets[i]; k < m_offsets[i + 1]; ++k) {
+                auto const j = m_targets[k];
+                // every bond is stored twice, count it once.
+                if (j < i) {
+                    continue;
+                }
+                for (std::size_t r = 0; r < K; ++r) {
+                    m_energies[r] -= spins[r] * m_values[j * K + r] * m_couplings[k];
+                }
+            }
+        }
+    }
+
+    std::vector<FieldT> m_fields;
+    std::vector<uint64_t> m_offsets;
+    std::vector<node_t> m_targets;
+    std::vector<EnergyT> m_couplings;
+    std::vector<EnergyT> m_values;
+    std::array<rng_t, K> m_rngs;
+    Telemetry m_telemetry;
+    Lanes m_energies{};
+    std::array<double, K> m_sums{};
+};
+
+using ReplicaBatch = BasicReplicaBatch<spin_t, energy_t, field_t, 8>;
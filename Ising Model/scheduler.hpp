@@ -0,0 +1,214 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stop_token>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "statistics.hpp"
+
+/**
+ * @brief A callback for markov_chain_monte_carlo() running each recorder on its own schedule instead of every sweep:
+ * every k sweeps, about once per autocorrelation time, every given wall-clock period, or at points inside a sweep.
+ * Cheap observables can stay per-sweep while expensive ones, e.g. a structure factor, run rarely. A sweep on which
+ * nothing is due costs a compare, plus a clock read when there are timed recorders.
+ * It can also end the run early, on a stop request (stop_on()) or when a wall-clock budget runs out (budget()).
+ * Recorders passed as lvalues are kept by reference and must outlive the scheduler; rvalues are moved in.
+ * @tparam ModelT The model type the recorders take.
+ */
+template<typename ModelT>
+class MeasurementScheduler {
+public:
+    using Hook = std::function<void(ModelT const&)>;
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Run a recorder on every sweep whose count since the scheduler was made is a multiple of sweeps.
+     */
+    template<typename R>
+    MeasurementScheduler& every(uint64_t sweeps, R&& recorder) {
+        sweeps = std::max<uint64_t>(sweeps, 1);
+        m_periodic.push_back({ hook_of(std::forward<R>(recorder)), sweeps, m_sweep_ct + sweeps, 0.0 });
+        m_next_due = std::min(m_next_due, m_periodic.back().next);
+        return *this;
+    }
+
+    /**
+     * @brief Run a recorder every period of wall-clock time, on the first sweep ending after it elapsed.
+     */
+    template<typename R>
+    MeasurementScheduler& every(Clock::duration period, R&& recorder) {
+        m_timed.push_back({ hook_of(std::forward<R>(recorder)), period, Clock::now() + period });
+        return *this;
+    }
+
+    /**
+     * @brief Run a recorder about once per 2 tau sweeps, the spacing of statistically independent samples, with the
+     * integrated autocorrelation time tau of the energy estimated on the fly by binning. The estimate starts low and
+     * grows as the run gets long enough to resolve it, so early samples are denser than needed, never sparser.
+     * @param factor Scales the spacing, e.g. 0.5 for two samples per independent one.
+     */
+    template<typename R>
+    MeasurementScheduler& decorrelated(R&& recorder, double factor = 1.0) {
+        m_periodic.push_back({ hook_of(std::forward<R>(recorder)), 0, m_sweep_ct + 1, factor });
+        ++m_adaptive_ct;
+        m_next_due = std::min(m_next_due, m_periodic.back().next);
+        return *this;
+    }
+
+    /**
+     * @brief Run a recorder parts times per sweep: after each parts-th of the spin updates, including the last.
+     */
+    template<typename R>
+    MeasurementScheduler& within_sweep(unsigned parts, R&& recorder) {
+        parts = std::max(parts, 1u);
+        m_within.push_back({ hook_of(std::forward<R>(recorder)), parts });
+        m_substep_ct = std::lcm(m_substep_ct, parts);
+        return *this;
+    }
+
+    /**
+     * @brief The count of points a sweep is split into for the within_sweep() recorders, 1 if there are none.
+     */
+    unsigned substep_count() const noexcept {
+        return m_substep_ct;
+    }
+
+    /**
+     * @brief Called by markov_chain_monte_carlo() after the k-th of substep_count() parts of a sweep, k < substep_count().
+     */
+    void substep(ModelT const& self, unsigned k) {
+        for (auto const& entry : m_within) {
+            if (k * entry.parts % m_substep_ct == 0) {
+                entry.hook(self);
+            }
+        }
+    }
+
+    void operator ()(ModelT const& self) {
+        ++m_sweep_ct;
+        this->substep(self, m_substep_ct);
+        if (m_adaptive_ct > 0) {
+            m_energy.add(static_cast<double>(self.energy()) / static_cast<double>(self.size()));
+        }
+        if (m_sweep_ct >= m_next_due) {
+            this->run_periodic(self);
+        }
+        if (!m_timed.empty()) {
+            auto const now = Clock::now();
+            for (auto& entry : m_timed) {
+                if (now >= entry.next) {
+                    entry.hook(self);
+                    entry.next = now + entry.period;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief End the run after the sweep during which a stop is requested through the token.
+     */
+    MeasurementScheduler& stop_on(std::stop_token token) {
+        m_stop = std::move(token);
+        return *this;
+    }
+
+    /**
+     * @brief End the run after the first sweep ending once the time from now on has elapsed.
+     */
+    MeasurementScheduler& budget(Clock::duration time) {
+        m_deadline = Clock::now() + time;
+        return *this;
+    }
+
+    /**
+     * @brief Called by markov_chain_monte_carlo() after every sweep; true ends the run.
+     */
+    bool stop_requested() const noexcept {
+        return m_stop.stop_requested() || (m_deadline != Clock::time_point::max() && Clock::now() >= m_deadline);
+    }
+
+    /**
+     * @brief Whether the budget ran out, as opposed to a stop request or all sweeps done.
+     */
+    bool out_of_budget() const noexcept {
+        return m_deadline != Clock::time_point::max() && Clock::now() >= m_deadline;
+    }
+
+    /**
+     * @brief The sweeps handled so far.
+     */
+    uint64_t sweep_count() const noexcept {
+        return m_sweep_ct;
+    }
+
+    /**
+     * @brief The current estimate of the integrated autocorrelation time of the energy, in sweeps.
+     */
+    double tau() const noexcept {
+        return m_energy.tau();
+    }
+
+private:
+    struct Periodic {
+        Hook hook;
+        // 0 for a decorrelated() recorder.
+        uint64_t interval;
+        uint64_t next;
+        double factor;
+    };
+
+    struct Timed {
+        Hook hook;
+        Clock::duration period;
+        Clock::time_point next;
+    };
+
+    struct Within {
+        Hook hook;
+        unsigned parts;
+    };
+
+    template<typename R>
+    Hook hook_of(R&& recorder) {
+        if constexpr (std::is_lvalue_reference_v<R>) {
+            return std::ref(recorder);
+        }
+        else {
+            return Hook(std::move(recorder));
+        }
+    }
+
+    void run_periodic(ModelT const& self) {
+        m_next_due = std::numeric_limits<uint64_t>::max();
+        for (auto& entry : m_periodic) {
+            if (m_sweep_ct >= entry.next) {
+                entry.hook(self);
+                auto interval = entry.interval;
+                if (interval == 0) {
+                    interval = static_cast<uint64_t>(std::max(1.0, std::ceil(2 * entry.factor * m_energy.tau())));
+                }
+                entry.next = m_sweep_ct + interval;
+            }
+            m_next_due = std::min(m_next_due, entry.next);
+        }
+    }
+
+    std::vector<Periodic> m_periodic;
+    std::vector<Timed> m_timed;
+    std::vector<Within> m_within;
+    uint64_t m_sweep_ct{};
+    uint64_t m_next_due = std::numeric_limits<uint64_t>::max();
+    // the count of decorrelated() recorders; the energy is only binned if there are any.
+    std::size_t m_adaptive_ct{};
+    unsigned m_substep_ct = 1;
+    BinningAnalysis m_energy;
+    std::stop_token m_stop;
+    Clock::time_point m_deadline = Clock::time_point::max();
+};
@@ -0,0 +1,1036 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__APPLE__) || defined(__linux__)
+#   include <arpa/inet.h>
+#   include <netinet/in.h>
+#   include <poll.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#   define ISING_HAS_SOCKETS 1
+#endif
+
+#include "ising_model.hpp"
+#include "json.hpp"
+#include "model_file.hpp"
+#include "pool.hpp"
+#include "scheduler.hpp"
+#include "statistics.hpp"
+#include "trace.hpp"
+
+/**
+ * @brief A JSON-RPC 2.0 error, sent back as the error of the response.
+ */
+class RpcError : public std::runtime_error {
+public:
+    static constexpr int k_parse_error = -32700;
+    static constexpr int k_invalid_request = -32600;
+    static constexpr int k_method_not_found = -32601;
+    static constexpr int k_invalid_params = -32602;
+    static constexpr int k_server_error = -32000;
+
+    RpcError(int code, std::string const& message)
+        : std::runtime_error(message), m_code(code) {}
+
+    int code() const noexcept {
+        return m_code;
+    }
+
+private:
+    int m_code;
+};
+
+/**
+ * @brief A job of the simulation server: queued until a worker takes it, then running until it's done, failed or
+ * cancelled. Its progress is counted in sweeps and can be read any time; its result once it ended.
+ * Jobs of the same key, e.g. the model they evolve, run one at a time.
+ */
+class ServerJob {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Work = std::function<Json(ServerJob&, std::stop_token)>;
+
+    enum class State {
+        k_queued,
+        k_running,
+        k_done,
+        k_failed,
+        k_cancelled,
+    };
+
+    ServerJob(int id, std::string method, int priority, uint64_t sweep_total, Work work, void const* key = nullptr)
+        : m_id(id), m_method(std::move(method)), m_priority(priority), m_sweep_total(sweep_total), m_work(std::move(work)),
+          m_key(key), m_submitted(Clock::now()) {}
+
+    int id() const noexcept {
+        return m_id;
+    }
+
+    /**
+     * @brief What the job must have to itself, or nullptr.
+     */
+    void const* key() const noexcept {
+        return m_key;
+    }
+
+    int priority() const noexcept {
+        return m_priority;
+    }
+
+    State state() const noexcept {
+        return m_state.load(std::memory_order_acquire);
+    }
+
+    bool ended() const noexcept {
+        auto const state = this->state();
+        return state != State::k_queued && state != State::k_running;
+    }
+
+    /**
+     * @brief Called by the work as it goes, from any of the threads it runs on.
+     */
+    void advance(uint64_t sweep_ct = 1) noexcept {
+        m_sweep_ct.fetch_add(sweep_ct, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Cancel the job: a queued one won't run, a running one ends after its current sweep.
+     */
+    void cancel() {
+        m_stop.request_stop();
+        auto expected = State::k_queued;
+        if (m_state.compare_exchange_strong(expected, State::k_cancelled)) {
+            this->finish();
+        }
+    }
+
+    /**
+     * @brief Run the job on the calling thread, unless it was cancelled.
+     */
+    void run() {
+        // before the state, which publishes it to status() once it reads running.
+        m_started = Clock::now();
+        auto expected = State::k_queued;
+        if (!m_state.compare_exchange_strong(expected, State::k_running, std::memory_order_acq_rel)) {
+            return;
+        }
+        auto state = State::k_done;
+        try {
+            auto result = m_work(*this, m_stop.get_token());
+            std::scoped_lock lock(m_mutex);
+            m_result = std::move(result);
+            state = m_stop.stop_requested() ? State::k_cancelled : State::k_done;
+        }
+        catch (std::exception const& e) {
+            std::scoped_lock lock(m_mutex);
+            m_error = e.what();
+            state = State::k_failed;
+        }
+        // the work holds what it was given, e.g. the model, until then.
+        m_work = nullptr;
+        m_state.store(state, std::memory_order_release);
+        this->finish();
+    }
+
+    /**
+     * @brief Wait for the job to end, for at most the given time.
+     * @return Whether it ended.
+     */
+    bool wait_for(Clock::duration time) {
+        std::unique_lock lock(m_mutex);
+        return m_ended.wait_for(lock, time, [this] { return this->ended(); });
+    }
+
+    /**
+     * @brief The id, method, priority, state, sweeps done out of the total, and the sweeps per second while running.
+     */
+    Json status() const {
+        constexpr char const* k_state_names[] = { "queued", "running", "done", "failed", "cancelled" };
+        auto const state = this->state();
+        auto result = Json::object({
+            { "id", m_id },
+            { "method", m_method },
+            { "priority", m_priority },
+            { "state", k_state_names[static_cast<int>(state)] },
+            { "sweeps", m_sweep_ct.load(std::memory_order_relaxed) },
+            { "sweep_total", m_sweep_total },
+        });
+        if (state == State::k_running) {
+            auto const seconds = std::chrono::duration<double>(Clock::now() - m_started).count();
+            result["seconds"] = seconds;
+            result["sweeps_per_second"] = seconds > 0 ? static_cast<double>(m_sweep_ct.load()) / seconds : 0.0;
+        }
+        return result;
+    }
+
+    /**
+     * @brief The status, with the result or the error once the job ended.
+     */
+    Json outcome() const {
+        auto result = this->status();
+        if (this->ended()) {
+            std::scoped_lock lock(m_mutex);
+            if (!m_error.empty()) {
+                result["error"] = m_error;
+            }
+            else if (!m_result.is_null()) {
+                result["result"] = m_result;
+            }
+        }
+        return result;
+    }
+
+private:
+    void finish() {
+        {
+            // so a waiter that just saw the job running can't miss the notification.
+            std::scoped_lock lock(m_mutex);
+        }
+        m_ended.notify_all();
+    }
+
+    int m_id;
+    std::string m_method;
+    int m_priority;
+    uint64_t m_sweep_total;
+    Work m_work;
+    void const* m_key;
+    Clock::time_point m_submitted;
+    Clock::time_point m_started{};
+    std::stop_source m_stop;
+    std::atomic<State> m_state{ State::k_queued };
+    std::atomic<uint64_t> m_sweep_ct{};
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ended;
+    Json m_result;
+    std::string m_error;
+};
+
+/**
+ * @brief Jobs run by a fixed set of worker threads, the highest priority first and in the order submitted within a
+ * priority. The last k_kept_ct jobs that ended stay around for their results.
+ * A job whose key is taken by a running job is set aside until that one ends, rather than holding a worker while it
+ * waits, so the workers go to the jobs that can run.
+ * The workers are threads of their own rather than tasks of the ThreadPool: a job may hold its model for minutes,
+ * which would take a thread away from the pool's fork-join work; what a job does in parallel goes to the pool.
+ */
+class JobQueue {
+public:
+    static constexpr std::size_t k_kept_ct = 1024;
+
+    /**
+     * @param worker_ct The worker threads; 0 for one per core.
+     */
+    explicit JobQueue(unsigned worker_ct = 0) {
+        worker_ct = worker_ct ? worker_ct : std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned w = 0; w < worker_ct; ++w) {
+            m_workers.emplace_back([this](std::stop_token token) { this->work(token); });
+        }
+    }
+
+    JobQueue(JobQueue const&) = delete;
+    JobQueue& operator =(JobQueue const&) = delete;
+
+    ~JobQueue() {
+        this->cancel_all();
+        for (auto& worker : m_workers) {
+            worker.request_stop();
+        }
+    }
+
+    /**
+     * @param key What the job must have to itself, e.g. its model; nullptr if nothing.
+     */
+    std::shared_ptr<ServerJob> submit(std::string method, int priority, uint64_t sweep_total, ServerJob::Work work,
+                                      void const* key = nullptr) {
+        std::scoped_lock lock(m_mutex);
+        auto job = std::make_shared<ServerJob>(++m_last_id, std::move(method), priority, sweep_total, std::move(work), key);
+        m_jobs.emplace(job->id(), job);
+        m_queue.push(job);
+        this->forget_ended();
+        m_ready.notify_one();
+        return job;
+    }
+
+    std::shared_ptr<ServerJob> find(int id) const {
+        std::scoped_lock lock(m_mutex);
+        auto const it = m_jobs.find(id);
+        return it == m_jobs.end() ? nullptr : it->second;
+    }
+
+    std::vector<std::shared_ptr<ServerJob>> jobs() const {
+        std::scoped_lock lock(m_mutex);
+        std::vector<std::shared_ptr<ServerJob>> result{};
+        for (auto const& [id, job] : m_jobs) {
+            result.push_back(job);
+        }
+        return result;
+    }
+
+    void cancel_all() {
+        for (auto const& job : this->jobs()) {
+            job->cancel();
+        }
+    }
+
+    std::size_t worker_count() const noexcept {
+        return m_workers.size();
+    }
+
+    std::size_t queued_count() const {
+        std::scoped_lock lock(m_mutex);
+        auto count = m_queue.size();
+        for (auto const& [key, jobs] : m_set_aside) {
+            count += jobs.size();
+        }
+        return count;
+    }
+
+private:
+    struct Order {
+        bool operator ()(std::shared_ptr<ServerJob> const& lhs, std::shared_ptr<ServerJob> const& rhs) const noexcept {
+            return lhs->priority() != rhs->priority() ? lhs->priority() < rhs->priority() : lhs->id() > rhs->id();
+        }
+    };
+
+    void work(std::stop_token token) {
+        Tracer::instance().name_thread("server worker");
+        std::unique_lock lock(m_mutex);
+        while (m_ready.wait(lock, token, [this] { return !m_queue.empty(); })) {
+            auto const job = m_queue.top();
+            m_queue.pop();
+            // a cancelled job only has to end, so it needn't wait for its key.
+            auto const key = job->ended() ? nullptr : job->key();
+            if (key) {
+                auto const [it, taken] = m_set_aside.try_emplace(key);
+                if (!taken) {
+                    it->second.push_back(job);
+                    continue;
+                }
+            }
+            lock.unlock();
+            job->run();
+            lock.lock();
+            if (key) {
+                // the jobs that waited for the key go back in line, to be taken in order again.
+                auto const it = m_set_aside.find(key);
+                for (auto& waiting : it->second) {
+                    m_queue.push(std::move(waiting));
+                }
+                if (!it->second.empty()) {
+                    m_ready.notify_all();
+                }
+                m_set_aside.erase(it);
+            }
+        }
+    }
+
+    void forget_ended() {
+        if (m_jobs.size() <= k_kept_ct) {
+            return;
+        }
+        for (auto it = m_jobs.begin(); it != m_jobs.end() && m_jobs.size() > k_kept_ct;) {
+            it = it->second->ended() ? m_jobs.erase(it) : std::next(it);
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::condition_variable_any m_ready;
+    std::priority_queue<std::shared_ptr<ServerJob>, std::vector<std::shared_ptr<ServerJob>>, Order> m_queue;
+    std::map<int, std::shared_ptr<ServerJob>> m_jobs;
+    // key of a running job -> the jobs of the same key set aside until it ends.
+    std::map<void const*, std::vector<std::shared_ptr<ServerJob>>> m_set_aside;
+    int m_last_id{};
+    // last, so the workers stop before the rest goes.
+    std::vector<std::jthread> m_workers;
+};
+
+/**
+ * @brief Parsed models by what they were built from, so building the same model again copies it instead of parsing
+ * it: a copy shares the read-only graph and only gets spins of its own. Past the capacity the least recently used
+ * model goes.
+ */
+class ModelCache {
+public:
+    explicit ModelCache(std::size_t capacity = 16)
+        : m_capacity(std::max<std::size_t>(capacity, 1)) {}
+
+    /**
+     * @param key What the model is built from, e.g. its files and their modification times.
+     * @param build Makes the model if it isn't cached; other requests go on meanwhile.
+     * @return A copy of the model, and whether it came from the cache.
+     */
+    template<typename F>
+    std::pair<Ising, bool> get(std::string const& key, F&& build) {
+        std::shared_ptr<Ising const> prototype{};
+        {
+            std::scoped_lock lock(m_mutex);
+            if (auto const it = m_entries.find(key); it != m_entries.end()) {
+                it->second.last_use = ++m_use_ct;
+                prototype = it->second.model;
+                ++m_hit_ct;
+            }
+        }
+        auto const hit = prototype != nullptr;
+        if (!hit) {
+            prototype = std::make_shared<Ising const>(build());
+            std::scoped_lock lock(m_mutex);
+            ++m_miss_ct;
+            m_entries.insert_or_assign(key, Entry{ prototype, ++m_use_ct });
+            while (m_entries.size() > m_capacity) {
+                m_entries.erase(stdr::min_element(m_entries, {}, [](auto const& entry) { return entry.second.last_use; }));
+            }
+        }
+        return { prototype->clone(), hit };
+    }
+
+    /**
+     * @brief The hits, misses and models cached.
+     */
+    Json stats() const {
+        std::scoped_lock lock(m_mutex);
+        return Json::object({ { "hits", m_hit_ct }, { "misses", m_miss_ct }, { "models", m_entries.size() } });
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<Ising const> model;
+        uint64_t last_use;
+    };
+
+    std::size_t m_capacity;
+    mutable std::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+    uint64_t m_use_ct{};
+    uint64_t m_hit_ct{};
+    uint64_t m_miss_ct{};
+};
+
+/**
+ * @brief A local simulation server speaking JSON-RPC 2.0, one request per line, so orchestration scripts can keep
+ * one process and its parsed models across runs. Requests are handled right away, except evolve and scan, which
+ * queue a job and return its id; status, result and cancel follow it up. The methods and their params:
+ *     build   { name, grid: { rows, cols, periodic }, order, seed } or { name, model_file, verify, seed }
+ *             or { name, spins, bonds, order, seed }: make a named model, copied from the cache when it can be.
+ *     evolve  { model, sweeps, beta, field, thermalize, budget, priority }: run sweeps on the model, measuring.
+ *     scan    { model, betas or from, to, steps, sweeps, thermalize, parallel, priority }: anneal a copy of
+ *             the model through the betas, measuring at each; with parallel, every beta gets a copy of its own
+ *             and they run at once, on threads of their own.
+ *     status  { job }, result { job, wait, timeout }, cancel { job }, jobs, models, drop { name }, stats, shutdown
+ * budget and timeout are in seconds. A measurement gives the averages of StatisticsRecorder with their errors.
+ */
+class SimulationServer {
+public:
+    /**
+     * @param worker_ct The threads running the jobs; 0 for one per core.
+     */
+    explicit SimulationServer(unsigned worker_ct = 0)
+        : m_queue(worker_ct) {}
+
+    /**
+     * @brief Handle a request, or a batch of them in an array.
+     * @return The response, or an empty string for notifications.
+     */
+    std::string handle(std::string_view line) {
+        Json request{};
+        try {
+            request = Json::parse(line);
+        }
+        catch (JsonError const& e) {
+            return error_response(Json{}, RpcError(RpcError::k_parse_error, e.what())).dump();
+        }
+        if (!request.is_array()) {
+            auto response = this->respond(request);
+            return response ? response->dump() : std::string{};
+        }
+        Json::Array responses{};
+        for (auto const& element : request.as_array()) {
+            if (auto response = this->respond(element)) {
+                responses.push_back(std::move(*response));
+            }
+        }
+        if (request.as_array().empty()) {
+            return error_response(Json{}, RpcError(RpcError::k_invalid_request, "empty batch")).dump();
+        }
+        return responses.empty() ? std::string{} : Json(std::move(responses)).dump();
+    }
+
+    /**
+     * @brief Whether shutdown was requested; the transports end then.
+     */
+    bool stopped() const noexcept {
+        return m_stopped.load();
+    }
+
+private:
+    struct ServerModel {
+        // held by the job evolving the model; the queue runs the jobs of a model one at a time, so no job waits here.
+        std::mutex mutex;
+        Ising model;
+        // what it was built from.
+        std::string source;
+    };
+
+    static Json error_response(Json const& id, RpcError const& error) {
+        return Json::object({
+            { "jsonrpc", "2.0" },
+            { "id", id },
+            { "error", Json::object({ { "code", error.code() }, { "message", error.what() } }) },
+        });
+    }
+
+    std::optional<Json> respond(Json const& request) {
+        auto const* id = request.find("id");
+        try {
+            auto const* version = request.find("jsonrpc");
+            auto const* method = request.find("method");
+            if (!version || !version->is_string() || version->as_string() != "2.0" || !method || !method->is_string()) {
+                throw RpcError(RpcError::k_invalid_request, "expected jsonrpc 2.0 and a method");
+            }
+            auto const* params = request.find("params");
+            auto result = this->call(method->as_string(), params ? *params : Json::object());
+            if (!id) {
+                return std::nullopt;
+            }
+            return Json::object({ { "jsonrpc", "2.0" }, { "id", *id }, { "result", std::move(result) } });
+        }
+        catch (RpcError const& e) {
+            return id ? std::optional(error_response(*id, e)) : std::nullopt;
+        }
+        catch (JsonError const& e) {
+            return id ? std::optional(error_response(*id, RpcError(RpcError::k_invalid_params, e.what()))) : std::nullopt;
+        }
+        catch (std::string_view filename) {
+            auto const error = RpcError(RpcError::k_server_error, "Error opening file " + std::string(filename));
+            return id ? std::optional(error_response(*id, error)) : std::nullopt;
+        }
+        catch (std::exception const& e) {
+            return id ? std::optional(error_response(*id, RpcError(RpcError::k_server_error, e.what()))) : std::nullopt;
+        }
+    }
+
+    Json call(std::string_view method, Json const& params) {
+        TraceScope trace(Tracer::enabled() ? Tracer::instance().intern(method) : "rpc");
+        if (!params.is_object()) {
+            throw RpcError(RpcError::k_invalid_params, "params have to be an object");
+        }
+        if (method == "build") {
+            return this->build(params);
+        }
+        else if (method == "evolve") {
+            return this->evolve(params);
+        }
+        else if (method == "scan") {
+            return this->scan(params);
+        }
+        else if (method == "status") {
+            return this->job_of(params)->status();
+        }
+        else if (method == "result") {
+            auto const job = this->job_of(params);
+            if (auto const* wait = params.find("wait"); wait && wait->as_bool()) {
+                auto const timeout = number_of(params, "timeout", 3600.0);
+                job->wait_for(std::chrono::duration_cast<ServerJob::Clock::duration>(std::chrono::duration<double>(timeout)));
+            }
+            return job->outcome();
+        }
+        else if (method == "cancel") {
+            auto const job = this->job_of(params);
+            job->cancel();
+            return job->status();
+        }
+        else if (method == "jobs") {
+            Json::Array result{};
+            for (auto const& job : m_queue.jobs()) {
+                result.push_back(job->status());
+            }
+            return result;
+        }
+        else if (method == "models") {
+            return this->models();
+        }
+        else if (method == "drop") {
+            std::scoped_lock lock(m_models_mutex);
+            return m_models.erase(string_of(params, "name")) > 0;
+        }
+        else if (method == "stats") {
+            return Json::object({
+                { "workers", m_queue.worker_count() },
+                { "queued", m_queue.queued_count() },
+                { "cache", m_cache.stats() },
+            });
+        }
+        else if (method == "shutdown") {
+            m_stopped = true;
+            m_queue.cancel_all();
+            return true;
+        }
+        throw RpcError(RpcError::k_method_not_found, "no method " + std::string(method));
+    }
+
+    static Json const& param_of(Json const& params, std::string_view key) {
+        auto const* value = params.find(key);
+        if (!value) {
+            throw RpcError(RpcError::k_invalid_params, "missing " + std::string(key));
+        }
+        return *value;
+    }
+
+    static double number_of(Json const& params, std::string_view key, std::optional<double> fallback = std::nullopt) {
+        auto const* value = params.find(key);
+        if (!value && fallback) {
+            return *fallback;
+        }
+        return param_of(params, key).as_number();
+    }
+
+    static int64_t integer_of(Json const& params, std::string_view key, std::optional<int64_t> fallback = std::nullopt) {
+        auto const* value = params.find(key);
+        if (!value && fallback) {
+            return *fallback;
+        }
+        auto const result = param_of(params, key).as_integer();
+        if (result < 0) {
+            throw RpcError(RpcError::k_invalid_params, std::string(key) + " can't be negative");
+        }
+        return result;
+    }
+
+    /**
+     * @brief A count of sweeps, which the engine takes as an int.
+     */
+    static uint64_t sweeps_of(Json const& params, std::string_view key, std::optional<int64_t> fallback = std::nullopt) {
+        auto const result = integer_of(params, key, fallback);
+        if (result > std::numeric_limits<int>::max()) {
+            throw RpcError(RpcError::k_invalid_params,
+                           std::string(key) + " can't be more than " + std::to_string(std::numeric_limits<int>::max()));
+        }
+        return static_cast<uint64_t>(result);
+    }
+
+    static std::string const& string_of(Json const& params, std::string_view key) {
+        return param_of(params, key).as_string();
+    }
+
+    static Ordering ordering_param(Json const& params) {
+        auto const* value = params.find("order");
+        if (!value) {
+            return Ordering::k_none;
+        }
+        auto const ordering = ordering_of(value->as_string());
+        if (!ordering) {
+            throw RpcError(RpcError::k_invalid_params, "unknown order " + value->as_string());
+        }
+        return *ordering;
+    }
+
+    /**
+     * @brief A file's path and modification time, which a cached model of it has to match.
+     */
+    static std::string file_key(std::string const& file) {
+        std::error_code ec{};
+        auto const time = std::filesystem::last_write_time(file, ec);
+        if (ec) {
+            throw std::string_view(file);
+        }
+        return file + '@' + std::to_string(time.time_since_epoch().count());
+    }
+
+    Json build(Json const& params) {
+        auto const& name = string_of(params, "name");
+        auto const ordering = ordering_param(params);
+        std::string key{};
+        std::function<Ising()> make{};
+        if (auto const* grid = params.find("grid")) {
+            auto const rows = static_cast<node_t>(integer_of(*grid, "rows"));
+            auto const cols = static_cast<node_t>(integer_of(*grid, "cols", rows));
+            auto const* periodic_value = grid->find("periodic");
+            auto const periodic = periodic_value && periodic_value->as_bool();
+            if (rows == 0 || cols == 0) {
+                throw RpcError(RpcError::k_invalid_params, "a grid needs rows and cols");
+            }
+            key = "grid " + std::to_string(rows) + 'x' + std::to_string(cols) + (periodic ? " periodic" : "")
+                + " order " + std::to_string(static_cast<int>(ordering));
+            make = [=] { return Ising::from_grid(rows, cols, g_bond_energy, ordering, periodic); };
+        }
+        else if (auto const* file = params.find("model_file")) {
+            auto const& path = file->as_string();
+            auto const* verify_value = params.find("verify");
+            auto const verify = verify_value && verify_value->as_bool();
+            key = "model " + file_key(path) + (verify ? " verified" : "");
+            make = [path, verify] { return load_ising(path, verify); };
+        }
+        else {
+            auto const& spins = string_of(params, "spins");
+            auto const& bonds = string_of(params, "bonds");
+            if (ordering == Ordering::k_hilbert) {
+                throw RpcError(RpcError::k_invalid_params, "a bond file carries no coordinates, use rcm or bfs");
+            }
+            key = "text " + file_key(spins) + ' ' + file_key(bonds) + " order " + std::to_string(static_cast<int>(ordering));
+            make = [spins, bonds, ordering] { return make_ising(spins, bonds, ordering); };
+        }
+        auto entry = std::make_shared<ServerModel>();
+        auto [model, cached] = m_cache.get(key, make);
+        entry->model = std::move(model);
+        entry->model.seed(params.find("seed") ? static_cast<uint64_t>(integer_of(params, "seed")) : std::random_device{}());
+        entry->source = key;
+        auto const node_ct = entry->model.size();
+        auto const bytes = entry->model.memory_bytes();
+        {
+            std::scoped_lock lock(m_models_mutex);
+            m_models.insert_or_assign(name, std::move(entry));
+        }
+        return Json::object({ { "name", name }, { "nodes", node_ct }, { "bytes", bytes }, { "cached", cached } });
+    }
+
+    std::shared_ptr<ServerModel> model_of(Json const& params) {
+        auto const& name = string_of(params, "model");
+        std::scoped_lock lock(m_models_mutex);
+        auto const it = m_models.find(name);
+        if (it == m_models.end()) {
+            throw RpcError(RpcError::k_invalid_params, "no model " + name + ", build it first");
+        }
+        return it->second;
+    }
+
+    std::shared_ptr<ServerJob> job_of(Json const& params) {
+        auto const id = integer_of(params, "job");
+        auto job = m_queue.find(static_cast<int>(id));
+        if (!job) {
+            throw RpcError(RpcError::k_invalid_params, "no job " + std::to_string(id));
+        }
+        return job;
+    }
+
+    /**
+     * @brief Run sweeps on a model at g_beta, with the averages of every sweep as the result.
+     */
+    static Json measure(Ising& model, uint64_t sweep_ct, uint64_t thermalize_ct, std::optional<double> budget,
+                        ServerJob& job, std::stop_token const& token) {
+        auto const start = std::chrono::steady_clock::now();
+        MeasurementScheduler<Ising> thermalizer{};
+        thermalizer.stop_on(token);
+        model.markov_chain_monte_carlo(thermalizer, static_cast<int>(thermalize_ct));
+        StatisticsRecorder statistics{};
+        MeasurementScheduler<Ising> scheduler{};
+        scheduler.every(1, statistics).every(1, [&job](Ising const&) { job.advance(); });
+        scheduler.stop_on(token);
+        if (budget) {
+            scheduler.budget(std::chrono::duration_cast<MeasurementScheduler<Ising>::Clock::duration>(
+                std::chrono::duration<double>(*budget)));
+        }
+        model.markov_chain_monte_carlo(scheduler, static_cast<int>(sweep_ct));
+        auto const binned = [](BinningAnalysis const& b) {
+            return Json::object({ { "mean", b.mean() }, { "error", b.error() }, { "tau", b.tau() } });
+        };
+        auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return Json::object({
+            { "beta", g_beta },
+            { "sweeps", statistics.count() },
+            { "energy", binned(statistics.energy()) },
+            { "abs_magnetization", binned(statistics.abs_magnetization()) },
+            { "specific_heat", statistics.specific_heat() },
+            { "susceptibility", statistics.susceptibility() },
+            { "binder_cumulant", statistics.binder_cumulant() },
+            { "final_energy", static_cast<double>(model.energy()) / static_cast<double>(model.size()) },
+            { "final_magnetization", model.magnetization() },
+            { "seconds", seconds },
+        });
+    }
+
+    Json evolve(Json const& params) {
+        auto model = this->model_of(params);
+        auto const sweep_ct = sweeps_of(params, "sweeps");
+        auto const thermalize_ct = sweeps_of(params, "thermalize", 0);
+        auto const beta = number_of(params, "beta", g_beta);
+        std::optional<double> field{};
+        if (params.find("field")) {
+            field = number_of(params, "field");
+        }
+        std::optional<double> budget{};
+        if (params.find("budget")) {
+            budget = number_of(params, "budget");
+        }
+        auto const priority = static_cast<int>(number_of(params, "priority", 0.0));
+        auto const job = m_queue.submit("evolve", priority, sweep_ct,
+            [=](ServerJob& job, std::stop_token token) {
+                std::scoped_lock lock(model->mutex);
+                g_beta = beta;
+                if (field) {
+                    model->model.set_field(static_cast<field_t>(*field));
+                }
+                return measure(model->model, sweep_ct, thermalize_ct, budget, job, token);
+            }, model.get());
+        return Json::object({ { "job", job->id() } });
+    }
+
+    Json scan(Json const& params) {
+        auto model = this->model_of(params);
+        std::vector<double> betas{};
+        if (auto const* list = params.find("betas")) {
+            for (auto const& beta : list->as_array()) {
+                betas.push_back(beta.as_number());
+            }
+        }
+        else {
+            auto const from = number_of(params, "from");
+            auto const to = number_of(params, "to");
+            auto const steps = std::max<int64_t>(integer_of(params, "steps", 11), 1);
+            for (int64_t k = 0; k < steps; ++k) {
+                betas.push_back(steps > 1 ? from + (to - from) * static_cast<double>(k) / static_cast<double>(steps - 1) : from);
+            }
+        }
+        if (betas.empty()) {
+            throw RpcError(RpcError::k_invalid_params, "no betas to scan");
+        }
+        auto const sweep_ct = sweeps_of(params, "sweeps");
+        auto const thermalize_ct = sweeps_of(params, "thermalize", 100);
+        auto const* parallel_value = params.find("parallel");
+        auto const parallel = parallel_value && parallel_value->as_bool();
+        auto const priority = static_cast<int>(number_of(params, "priority", 0.0));
+        auto const job = m_queue.submit("scan", priority, sweep_ct * betas.size(),
+            [=](ServerJob& job, std::stop_token token) {
+                Ising copy{};
+                {
+                    std::scoped_lock lock(model->mutex);
+                    copy = model->model.clone();
+                }
+                if (parallel) {
+                    Json::Array points(betas.size());
+                    // threads of their own rather than the pool's, as a point may run for minutes.
+                    run_on_threads("scan point", betas.size(), ThreadPool::instance().concurrency(), [&](std::size_t k) {
+                        if (token.stop_requested()) {
+                            return;
+                        }
+                        ScopedBeta beta(betas[k]);
+                        auto point = copy.clone();
+                        point.seed(std::random_device{}());
+                        points[k] = measure(point, sweep_ct, thermalize_ct, std::nullopt, job, token);
+                    });
+                    return Json(std::move(points));
+                }
+                copy.seed(std::random_device{}());
+                Json::Array points{};
+                for (std::size_t k = 0; k < betas.size() && !token.stop_requested(); ++k) {
+                    g_beta = betas[k];
+                    points.push_back(measure(copy, sweep_ct, thermalize_ct, std::nullopt, job, token));
+                }
+                return Json(std::move(points));
+            }, model.get());
+        return Json::object({ { "job", job->id() } });
+    }
+
+    Json models() {
+        std::vector<std::pair<std::string, std::shared_ptr<ServerModel>>> entries{};
+        {
+            std::scoped_lock lock(m_models_mutex);
+            entries.assign(m_models.begin(), m_models.end());
+        }
+        Json::Array result{};
+        for (auto const& [name, entry] : entries) {
+            auto item = Json::object({ { "name", name }, { "source", entry->source } });
+            // a model being evolved is only listed as busy, rather than waiting for its job.
+            std::unique_lock lock(entry->mutex, std::try_to_lock);
+            item["busy"] = !lock.owns_lock();
+            if (lock.owns_lock()) {
+                auto const& model = entry->model;
+                item["nodes"] = model.size();
+                item["bytes"] = model.memory_bytes();
+                item["sweeps"] = model.sweep_count();
+                item["energy"] = static_cast<double>(model.energy()) / static_cast<double>(model.size());
+                item["magnetization"] = model.magnetization();
+            }
+            result.push_back(std::move(item));
+        }
+        return result;
+    }
+
+    ModelCache m_cache;
+    std::mutex m_models_mutex;
+    std::map<std::string, std::shared_ptr<ServerModel>, std::less<>> m_models;
+    std::atomic<bool> m_stopped{};
+    // last, so its workers stop before the rest goes.
+    JobQueue m_queue;
+};
+
+/**
+ * @brief Serve the requests of a stream, one per line, e.g. standard input, until it ends or shutdown.
+ */
+inline void serve_stream(SimulationServer& server, std::istream& in, std::ostream& out) {
+    std::string line;
+    while (!server.stopped() && std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        if (auto const response = server.handle(line); !response.empty()) {
+            out << response << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Serve connections on a Unix domain socket, or on localhost TCP for tcp:[port], until shutdown. Every
+ * connection gets a thread, sending requests one per line and reading the responses the same way; it only serves
+ * this machine.
+ * @return The exit status.
+ */
+inline int serve_socket(SimulationServer& server, std::string const& endpoint) {
+#ifdef ISING_HAS_SOCKETS
+    auto const tcp = endpoint.starts_with("tcp:");
+    auto const listener = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    int bound = -1;
+    if (tcp) {
+        int const reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(static_cast<uint16_t>(std::atoi(endpoint.c_str() + 4)));
+        bound = bind(listener, reinterpret_cast<sockaddr const*>(&address), sizeof(address));
+    }
+    else {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (endpoint.size() >= sizeof(address.sun_path)) {
+            std::cerr << "The socket path " << endpoint << " is too long." << '\n';
+            close(listener);
+            return EXIT_FAILURE;
+        }
+        // a socket left over by a server that didn't shut down.
+        struct stat info{};
+        if (stat(endpoint.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(endpoint.c_str());
+        }
+        endpoint.copy(address.sun_path, endpoint.size());
+        bound = bind(listener, reinterpret_cast<sockaddr const*>(&address), sizeof(address));
+    }
+    if (bound < 0 || listen(listener, 16) < 0) {
+        perror(endpoint.c_str());
+        close(listener);
+        return EXIT_FAILURE;
+    }
+    std::cerr << "Serving JSON-RPC on " << endpoint << '\n';
+
+    std::mutex clients_mutex;
+    std::set<int> clients{};
+    struct Connection {
+        std::atomic<bool> done{};
+        std::jthread thread{};
+    };
+    // a list, so the done flag a thread sets stays put; the ones done are joined at the next accept.
+    std::list<Connection> connections{};
+    auto const serve_client = [&server, &clients_mutex, &clients](int client, std::atomic<bool>& done) {
+        Tracer::instance().name_thread("server connection");
+        std::string buffer{};
+        char chunk[4096];
+        // a line longer than this isn't a request we could handle anyway.
+        constexpr std::size_t k_max_line = std::size_t{ 16 } << 20;
+        auto const send_line = [client](std::string line) {
+            line += '\n';
+            for (std::size_t sent = 0; sent < line.size();) {
+#ifdef MSG_NOSIGNAL
+                auto const n = send(client, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+#else
+                auto const n = send(client, line.data() + sent, line.size() - sent, 0);
+#endif
+                if (n <= 0) {
+                    return false;
+                }
+                sent += static_cast<std::size_t>(n);
+            }
+            return true;
+        };
+        for (bool open = true; open && !server.stopped();) {
+            auto const n = recv(client, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                break;
+            }
+            buffer.append(chunk, static_cast<std::size_t>(n));
+            for (std::size_t end; open && (end = buffer.find('\n')) != std::string::npos;) {
+                auto const line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                    continue;
+                }
+                if (auto const response = server.handle(line); !response.empty()) {
+                    open = send_line(response);
+                }
+            }
+            if (buffer.size() > k_max_line) {
+                break;
+            }
+        }
+        {
+            std::scoped_lock lock(clients_mutex);
+            clients.erase(client);
+            close(client);
+        }
+        done.store(true, std::memory_order_release);
+    };
+
+    while (!server.stopped()) {
+        pollfd ready{ listener, POLLIN, 0 };
+        if (poll(&ready, 1, 200) <= 0 || !(ready.revents & POLLIN)) {
+            continue;
+        }
+        auto const client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+        {
+            std::scoped_lock lock(clients_mutex);
+            clients.insert(client);
+        }
+        std::erase_if(connections, [](Connection const& connection) {
+            return connection.done.load(std::memory_order_acquire);
+        });
+        auto& connection = connections.emplace_back();
+        connection.thread = std::jthread(serve_client, client, std::ref(connection.done));
+    }
+    close(listener);
+    if (!tcp) {
+        unlink(endpoint.c_str());
+    }
+    {
+        // wakes the connections blocked reading.
+        std::scoped_lock lock(clients_mutex);
+        for (auto const client : clients) {
+            shutdown(client, SHUT_RDWR);
+        }
+    }
+    connections.clear();
+    return EXIT_SUCCESS;
+#else
+    std::cerr << "Serving on " << endpoint << " needs POSIX sockets; use --serve=- for standard input." << '\n';
+    return EXIT_FAILURE;
+#endif
+}
@@ -53,7 +53,7 @@ struct SpinTraits<spin_t> {
         return spin == k_up ? 1.0 : spin == k_down ? -1.0 : 0.0;
     }
     static constexpr char const* name_of(spin_t spin) noexcept {
-        return name[index(spin)];
+        return name[static_cast<int>(spin)];
     }
     static constexpr spin_t from_value(double val) {
         if (val == 1.0) {
@@ -76,6 +76,13 @@ SpinT random_spin() {
     return STraits::from_value(STraits::values[index]);
 }
 
+template<typename SpinT, typename Engine>
+SpinT random_spin(Engine& eng) {
+    using STraits = SpinTraits<SpinT>;
+    auto const index = randnum(0, STraits::state_count(), eng);
+    return STraits::from_value(STraits::values[index]);
+}
+
 using node_t = int;
 using energy_t = double;
 using field_t = double;
\ No newline at end of file
@@ -0,0 +1,257 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "utility.hpp"
+
+extern thread_local double g_beta;
+
+/**
+ * @brief Mean and variance of a stream of values in O(1) memory, with Welford's update.
+ */
+class RunningStat {
+public:
+    void add(double x) noexcept {
+        ++m_count;
+        auto const delta = x - m_mean;
+        m_mean += delta / static_cast<double>(m_count);
+        m_m2 += delta * (x - m_mean);
+    }
+
+    uint64_t count() const noexcept {
+        return m_count;
+    }
+
+    double mean() const noexcept {
+        return m_mean;
+    }
+
+    /**
+     * @brief The sample variance; 0 for fewer than two values.
+     */
+    double variance() const noexcept {
+        return m_count > 1 ? m_m2 / static_cast<double>(m_count - 1) : 0.0;
+    }
+
+    /**
+     * @brief The standard error of the mean, assuming independent values.
+     */
+    double error() const noexcept {
+        return m_count > 0 ? std::sqrt(this->variance() / static_cast<double>(m_count)) : 0.0;
+    }
+
+private:
+    uint64_t m_count{};
+    double m_mean{};
+    double m_m2{};
+};
+
+/**
+ * @brief Logarithmic binning of a correlated series: level k holds the statistics of the means of consecutive
+ * blocks of 2^k values, so N values take O(log N) memory.
+ * The naive error of level 0 is too small for correlated samples; it grows with the level until the blocks are
+ * longer than the correlation time, and the plateau is the honest error bar. The ratio of the two variances gives
+ * the integrated autocorrelation time.
+ */
+class BinningAnalysis {
+public:
+    // the highest level used for the error keeps at least this many bins.
+    static constexpr uint64_t k_min_bins = 32;
+
+    void add(double x) {
+        for (std::size_t level = 0;; ++level) {
+            if (level == m_levels.size()) {
+                m_levels.emplace_back();
+            }
+            auto& current = m_levels[level];
+            current.stat.add(x);
+            if (!current.has_pending) {
+                current.pending = x;
+                current.has_pending = true;
+                return;
+            }
+            // a pair is complete, and its mean is the next level's value.
+            x = (current.pending + x) / 2;
+            current.has_pending = false;
+        }
+    }
+
+    std::size_t level_count() const noexcept {
+        return m_levels.size();
+    }
+
+    double mean() const noexcept {
+        return m_levels.empty() ? 0.0 : m_levels[0].stat.mean();
+    }
+
+    /**
+     * @brief The error of the mean estimated from the bins of a level.
+     */
+    double error(std::size_t level) const noexcept {
+        return level < m_levels.size() ? m_levels[level].stat.error() : 0.0;
+    }
+
+    /**
+     * @brief The error of the mean from the highest level having enough bins.
+     */
+    double error() const noexcept {
+        return this->error(this->plateau());
+    }
+
+    /**
+     * @brief The integrated autocorrelation time in samples, tau = (binned error / naive error)^2 / 2.
+     * It is 1/2 for uncorrelated samples.
+     */
+    double tau() const noexcept {
+        auto const naive = this->error(0);
+        if (naive == 0.0) {
+            return 0.5;
+        }
+        auto const ratio = this->error() / naive;
+        return 0.5 * ratio * ratio;
+    }
+
+    void save(std::ostream& os) const {
+        write_vector(os, m_levels);
+    }
+
+    void load(std::istream& is) {
+        read_vector(is, m_levels);
+    }
+
+private:
+    struct Level {
+        RunningStat stat;
+        double pending{};
+        bool has_pending{};
+    };
+
+    std::size_t plateau() const noexcept {
+        std::size_t level{};
+        while (level + 1 < m_levels.size() && m_levels[level + 1].stat.count() >= k_min_bins) {
+            ++level;
+        }
+        return level;
+    }
+
+    std::vector<Level> m_levels;
+};
+
+/**
+ * @brief A recorder accumulating the thermodynamic averages of a run in constant memory instead of keeping the
+ * samples: <E>, <E^2>, <|M|>, <M^2>, <M^4>, and from them the specific heat, the susceptibility and the Binder
+ * cumulant, with binning error bars and autocorrelation times for the energy and |M|.
+ * Energies are per spin and M is the magnetization per spin. Like the other recorders it takes any model with
+ * energy(), magnetization() and size(), and composes with Recorder<Rs...>.
+ */
+class StatisticsRecorder {
+public:
+    template<typename ModelT>
+    void operator ()(ModelT const& self) const {
+        auto const n = static_cast<double>(self.size());
+        auto const e = self.energy() / n;
+        auto const m = self.magnetization();
+        auto const m2 = m * m;
+        m_size = n;
+        m_beta = g_beta;
+        m_energy.add(e);
+        m_energy_sq.add(e * e);
+        m_abs_mag.add(std::abs(m));
+        m_mag_sq.add(m2);
+        m_mag_4.add(m2 * m2);
+    }
+
+    uint64_t count() const noexcept {
+        return m_energy_sq.count();
+    }
+
+    BinningAnalysis const& energy() const noexcept {
+        return m_energy;
+    }
+
+    BinningAnalysis const& abs_magnetization() const noexcept {
+        return m_abs_mag;
+    }
+
+    /**
+     * @brief C = beta^2 N (<e^2> - <e>^2), with e the energy per spin.
+     */
+    double specific_heat() const noexcept {
+        auto const mean = m_energy.mean();
+        return m_beta * m_beta * m_size * (m_energy_sq.mean() - mean * mean);
+    }
+
+    /**
+     * @brief chi = beta N (<m^2> - <|m|>^2), with m the magnetization per spin.
+     */
+    double susceptibility() const noexcept {
+        auto const mean = m_abs_mag.mean();
+        return m_beta * m_size * (m_mag_sq.mean() - mean * mean);
+    }
+
+    /**
+     * @brief U = 1 - <m^4> / (3 <m^2>^2); 2/3 deep in the ordered phase and 0 in the disordered phase.
+     */
+    double binder_cumulant() const noexcept {
+        auto const m2 = m_mag_sq.mean();
+        return m2 > 0.0 ? 1.0 - m_mag_4.mean() / (3.0 * m2 * m2) : 0.0;
+    }
+
+    void reset() noexcept {
+        *this = StatisticsRecorder{};
+    }
+
+    void report(std::ostream& os) const {
+        auto const row = [&os](char const* name, double value, double error, double tau) {
+            os << "  " << std::setw(8) << std::left << name << std::setw(14) << value
+               << " +- " << std::setw(12) << error << " tau: " << tau << '\n';
+        };
+        os << "Samples: " << this->count() << ", beta: " << m_beta << '\n';
+        row("<E>/N", m_energy.mean(), m_energy.error(), m_energy.tau());
+        row("<|M|>", m_abs_mag.mean(), m_abs_mag.error(), m_abs_mag.tau());
+        os << "  " << std::setw(8) << std::left << "<E^2>" << m_energy_sq.mean() << '\n'
+           << "  " << std::setw(8) << std::left << "<M^2>" << m_mag_sq.mean() << '\n'
+           << "  " << std::setw(8) << std::left << "<M^4>" << m_mag_4.mean() << '\n'
+           << "  " << std::setw(8) << std::left << "C" << this->specific_heat() << '\n'
+           << "  " << std::setw(8) << std::left << "chi" << this->susceptibility() << '\n'
+           << "  " << std::setw(8) << std::left << "U" << this->binder_cumulant() << '\n';
+    }
+
+    void save(std::ostream& os) const {
+        m_energy.save(os);
+        m_abs_mag.save(os);
+        write_vector(os, std::vector{ m_energy_sq, m_mag_sq, m_mag_4 });
+        write_vector(os, std::vector{ m_size, m_beta });
+    }
+
+    void load(std::istream& is) {
+        m_energy.load(is);
+        m_abs_mag.load(is);
+        std::vector<RunningStat> stats{};
+        std::vector<double> scalars{};
+        read_vector(is, stats);
+        read_vector(is, scalars);
+        if (stats.size() != 3 || scalars.size() != 2) {
+            is.setstate(std::ios::failbit);
+            return;
+        }
+        m_energy_sq = stats[0];
+        m_mag_sq = stats[1];
+        m_mag_4 = stats[2];
+        m_size = scalars[0];
+        m_beta = scalars[1];
+    }
+
+private:
+    mutable BinningAnalysis m_energy;
+    mutable BinningAnalysis m_abs_mag;
+    mutable RunningStat m_energy_sq;
+    mutable RunningStat m_mag_sq;
+    mutable RunningStat m_mag_4;
+    mutable double m_size{};
+    mutable double m_beta{};
+};
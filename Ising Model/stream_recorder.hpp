@@ -0,0 +1,292 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "trace.hpp"
+
+/**
+ * @brief A bounded lock-free queue between exactly one producer thread and one consumer thread.
+ * Each side's counter shares a cache line only with that side's cached copy of the other's counter, so a push or
+ * pop that doesn't find the queue full or empty writes only its own line and reads no line the other side writes.
+ * @tparam T A trivially copyable element type.
+ */
+template<typename T>
+class SpscRing {
+public:
+    /**
+     * @param capacity Rounded up to a power of two.
+     */
+    explicit SpscRing(std::size_t capacity)
+        : m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1), m_slots(std::make_unique<T[]>(m_mask + 1)) {}
+
+    std::size_t capacity() const noexcept {
+        return m_mask + 1;
+    }
+
+    /**
+     * @brief Producer side: append a value unless the queue is full.
+     */
+    bool try_push(T const& value) noexcept {
+        auto const tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache > m_mask) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache > m_mask) {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Producer side: append a value, waiting for the consumer while the queue is full.
+     */
+    void push(T const& value) noexcept {
+        while (!this->try_push(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Consumer side: move up to out.size() values into out.
+     * @return The count of values taken.
+     */
+    std::size_t pop(std::span<T> out) noexcept {
+        auto const head = m_head.load(std::memory_order_relaxed);
+        if (m_tail_cache == head) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+        }
+        auto const count = std::min<std::size_t>(m_tail_cache - head, out.size());
+        for (std::size_t k = 0; k < count; ++k) {
+            out[k] = m_slots[(head + k) & m_mask];
+        }
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    static constexpr std::size_t k_line = 64;
+
+    std::size_t m_mask;
+    std::unique_ptr<T[]> m_slots;
+    // the producer's line: its counter and its last look at the consumer's.
+    alignas(k_line) std::atomic<std::size_t> m_tail{};
+    std::size_t m_head_cache{};
+    // the consumer's line: its counter and its last look at the producer's.
+    alignas(k_line) std::atomic<std::size_t> m_head{};
+    std::size_t m_tail_cache{};
+};
+
+/**
+ * @brief The header of a binary sample file: the magic, the fields present, then one record per sample holding
+ * the sweep count and the present fields in the order of StreamRecorder::Field, 8 bytes each, in native byte order.
+ */
+struct SampleFileHeader {
+    static constexpr char k_magic[8] = { 'I', 'S', 'I', 'N', 'G', 'S', 'M', 'P' };
+    static constexpr uint32_t k_version = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t fields;
+};
+
+/**
+ * @brief A recorder streaming every sample to a file instead of keeping it.
+ * The sweep loop only copies the sample into a lock-free ring; a writer thread drains the ring in batches and
+ * writes them out, either as binary records (see SampleFileHeader) or as CSV. Memory stays bounded by the ring
+ * however long the run: if the disk can't keep up, the sweep loop waits for room rather than dropping samples.
+ * Like the other recorders it takes any model with energy(), magnetization(), state() and sweep_count().
+ */
+class StreamRecorder {
+public:
+    enum Field : unsigned {
+        k_energy = 1,
+        k_magnetization = 2,
+        // state() costs a pass over the spins, so it is only recorded on request.
+        k_state = 4,
+    };
+
+    enum struct Format { k_binary, k_csv };
+
+    /**
+     * @brief Format::k_csv for a ".csv" file, Format::k_binary otherwise.
+     */
+    static Format format_of(std::string_view file) noexcept {
+        return file.ends_with(".csv") ? Format::k_csv : Format::k_binary;
+    }
+
+    /**
+     * @param file The output file; it is replaced.
+     * @param fields The fields to record, an or of Field.
+     * @param capacity The count of samples the ring holds.
+     * @throw The file name if it can't be opened.
+     */
+    StreamRecorder(std::string_view file, unsigned fields, Format format, std::size_t capacity = 1 << 16)
+        : m_ofs(std::string(file), std::ios::binary | std::ios::trunc), m_fields(fields), m_format(format),
+          m_ring(std::make_unique<SpscRing<Sample>>(capacity)) {
+        if (!m_ofs) {
+            throw file;
+        }
+        if (format == Format::k_binary) {
+            SampleFileHeader header{};
+            std::memcpy(header.magic, SampleFileHeader::k_magic, sizeof(header.magic));
+            header.version = SampleFileHeader::k_version;
+            header.fields = fields;
+            m_ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        }
+        else {
+            m_ofs << "sweep";
+            for (auto const& [field, name] : k_names) {
+                if (fields & field) {
+                    m_ofs << ',' << name;
+                }
+            }
+            m_ofs << '\n';
+        }
+        m_writer = std::jthread([this](std::stop_token token) { this->drain(token); });
+    }
+
+    StreamRecorder(StreamRecorder const&) = delete;
+    StreamRecorder& operator =(StreamRecorder const&) = delete;
+
+    ~StreamRecorder() {
+        try {
+            this->close();
+        }
+        catch (...) {
+            // nothing to report to from a destructor.
+        }
+    }
+
+    template<typename ModelT>
+    void operator ()(ModelT const& self) const {
+        Sample sample{ self.sweep_count(), 0.0, 0.0, 0 };
+        if (m_fields & k_energy) {
+            sample.energy = self.energy();
+        }
+        if (m_fields & k_magnetization) {
+            sample.magnetization = self.magnetization();
+        }
+        if (m_fields & k_state) {
+            sample.state = self.state();
+        }
+        m_ring->push(sample);
+        ++m_sample_ct;
+    }
+
+    /**
+     * @brief Write out every sample recorded so far and close the file; no sample may be recorded after.
+     * @throw std::runtime_error if writing failed.
+     */
+    void close() {
+        if (m_writer.joinable()) {
+            m_writer.request_stop();
+            m_writer.join();
+            m_ofs.close();
+            if (m_ofs.fail()) {
+                throw std::runtime_error("Writing the samples failed.");
+            }
+        }
+    }
+
+    uint64_t sample_count() const noexcept {
+        return m_sample_ct;
+    }
+
+private:
+    struct Sample {
+        uint64_t sweep;
+        double energy;
+        double magnetization;
+        int64_t state;
+    };
+
+    static constexpr std::pair<Field, char const*> k_names[] = {
+        { k_energy, "energy" }, { k_magnetization, "magnetization" }, { k_state, "state" },
+    };
+
+    void drain(std::stop_token token) {
+        Tracer::instance().name_thread("stream writer");
+        constexpr std::size_t k_flush_size = 1 << 20;
+        std::vector<Sample> batch(4096);
+        std::string buffer{};
+        buffer.reserve(k_flush_size + 4096 * 96);
+        while (true) {
+            // read the flag before popping, so the samples pushed before a stop are all taken on the last round.
+            auto const stopping = token.stop_requested();
+            auto const count = m_ring->pop(batch);
+            for (auto const& sample : std::span(batch).first(count)) {
+                this->format(sample, buffer);
+            }
+            if (buffer.size() >= k_flush_size || (stopping && count == 0)) {
+                TraceScope trace("stream flush");
+                m_ofs.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+            if (stopping && count == 0) {
+                return;
+            }
+            if (count == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    void format(Sample const& sample, std::string& out) const {
+        if (m_format == Format::k_binary) {
+            auto const put = [&out](auto const value) {
+                out.append(reinterpret_cast<char const*>(&value), sizeof(value));
+            };
+            put(sample.sweep);
+            if (m_fields & k_energy) {
+                put(sample.energy);
+            }
+            if (m_fields & k_magnetization) {
+                put(sample.magnetization);
+            }
+            if (m_fields & k_state) {
+                put(sample.state);
+            }
+            return;
+        }
+        char line[96];
+        auto* it = std::to_chars(line, line + sizeof(line), sample.sweep).ptr;
+        if (m_fields & k_energy) {
+            *it++ = ',';
+            it = std::to_chars(it, line + sizeof(line), sample.energy).ptr;
+        }
+        if (m_fields & k_magnetization) {
+            *it++ = ',';
+            it = std::to_chars(it, line + sizeof(line), sample.magnetization).ptr;
+        }
+        if (m_fields & k_state) {
+            *it++ = ',';
+            it = std::to_chars(it, line + sizeof(line), sample.state).ptr;
+        }
+        *it++ = '\n';
+        out.append(line, it);
+    }
+
+    std::ofstream m_ofs;
+    unsigned m_fields;
+    Format m_format;
+    // the recorders are called through const references, like the in-memory ones.
+    std::unique_ptr<SpscRing<Sample>> m_ring;
+    mutable uint64_t m_sample_ct{};
+    std::jthread m_writer;
+};
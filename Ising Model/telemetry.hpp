@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "utility.hpp"
+
+// build with -DISING_TELEMETRY=0 to compile the engine counters out.
+#ifndef ISING_TELEMETRY
+#   define ISING_TELEMETRY 1
+#endif
+
+/**
+ * @brief Counters an engine keeps about its own work: proposals, acceptances, cluster sizes, sweeps, and the wall
+ * and CPU time spent sweeping. The CPU time is that of the threads doing the sweeps, so models sweeping at the same
+ * time don't count each other's work. Engines count into locals in the hot loop and add them up once per sweep, so the
+ * cost is a few adds and two clock reads per sweep. With ISING_TELEMETRY 0 every member is a no-op and the
+ * instrumented loops compile to the uninstrumented ones.
+ */
+class Telemetry {
+public:
+    static constexpr bool k_enabled = ISING_TELEMETRY;
+
+    /**
+     * @brief The clocks at the start of a sweep, for end_sweep().
+     */
+    struct Mark {
+        std::chrono::steady_clock::time_point wall{};
+        uint64_t cpu_ns{};
+    };
+
+    static Mark start() noexcept {
+        if constexpr (k_enabled) {
+            return { std::chrono::steady_clock::now(), thread_cpu_ns() };
+        }
+        else {
+            return {};
+        }
+    }
+
+    /**
+     * @brief The CPU nanoseconds of the calling thread so far; of the whole process where there is no thread clock.
+     */
+    static uint64_t thread_cpu_ns() noexcept {
+#if defined(__APPLE__) || defined(__linux__)
+        timespec time{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return static_cast<uint64_t>(time.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(time.tv_nsec);
+#else
+        return static_cast<uint64_t>(static_cast<double>(std::clock()) * 1e9 / CLOCKS_PER_SEC);
+#endif
+    }
+
+    /**
+     * @brief Count a sweep started at mark, with its proposals and acceptances.
+     * @param other_cpu_ns CPU time the sweep took on threads other than the calling one, e.g. pool workers.
+     */
+    void end_sweep(Mark const& mark, uint64_t proposal_ct, uint64_t acceptance_ct, uint64_t other_cpu_ns = 0) noexcept {
+        if constexpr (k_enabled) {
+            m_wall_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - mark.wall).count());
+            m_cpu_ns += thread_cpu_ns() - mark.cpu_ns + other_cpu_ns;
+            m_proposal_ct += proposal_ct;
+            m_acceptance_ct += acceptance_ct;
+            ++m_sweep_ct;
+        }
+    }
+
+    /**
+     * @brief Count a cluster flipped by a cluster engine.
+     */
+    void add_cluster(uint64_t size) noexcept {
+        if constexpr (k_enabled) {
+            ++m_cluster_ct;
+            m_cluster_size_sum += size;
+            m_max_cluster_size = std::max(m_max_cluster_size, size);
+        }
+    }
+
+    uint64_t sweep_count() const noexcept {
+        return m_sweep_ct;
+    }
+
+    uint64_t proposal_count() const noexcept {
+        return m_proposal_ct;
+    }
+
+    uint64_t acceptance_count() const noexcept {
+        return m_acceptance_ct;
+    }
+
+    uint64_t cluster_count() const noexcept {
+        return m_cluster_ct;
+    }
+
+    uint64_t max_cluster_size() const noexcept {
+        return m_max_cluster_size;
+    }
+
+    double mean_cluster_size() const noexcept {
+        return m_cluster_ct ? static_cast<double>(m_cluster_size_sum) / static_cast<double>(m_cluster_ct) : 0.0;
+    }
+
+    double acceptance_rate() const noexcept {
+        return m_proposal_ct ? static_cast<double>(m_acceptance_ct) / static_cast<double>(m_proposal_ct) : 0.0;
+    }
+
+    /**
+     * @brief Wall-clock seconds spent sweeping.
+     */
+    double wall_seconds() const noexcept {
+        return static_cast<double>(m_wall_ns) * 1e-9;
+    }
+
+    /**
+     * @brief CPU seconds spent sweeping, over the threads the sweeps ran on.
+     */
+    double cpu_seconds() const noexcept {
+        return static_cast<double>(m_cpu_ns) * 1e-9;
+    }
+
+    double flips_per_second() const noexcept {
+        return m_wall_ns ? static_cast<double>(m_acceptance_ct) * 1e9 / static_cast<double>(m_wall_ns) : 0.0;
+    }
+
+    /**
+     * @brief Wall-clock nanoseconds per proposed update.
+     */
+    double ns_per_update() const noexcept {
+        return m_proposal_ct ? static_cast<double>(m_wall_ns) / static_cast<double>(m_proposal_ct) : 0.0;
+    }
+
+    void reset() noexcept {
+        *this = Telemetry{};
+    }
+
+    void report(std::ostream& os) const {
+        if constexpr (!k_enabled) {
+            os << "Telemetry is compiled out; build with -DISING_TELEMETRY=1." << '\n';
+            return;
+        }
+        auto const row = [&os](char const* name, auto value) {
+            os << "  " << std::setw(18) << std::left << name << value << '\n';
+        };
+        row("sweeps", m_sweep_ct);
+        row("proposals", m_proposal_ct);
+        row("acceptances", m_acceptance_ct);
+        row("acceptance rate", this->acceptance_rate());
+        if (m_cluster_ct > 0) {
+            row("clusters", m_cluster_ct);
+            row("mean cluster size", this->mean_cluster_size());
+            row("max cluster size", m_max_cluster_size);
+        }
+        row("wall time (s)", this->wall_seconds());
+        row("CPU time (s)", this->cpu_seconds());
+        row("flips/s", this->flips_per_second());
+        row("ns/update", this->ns_per_update());
+        if (m_sweep_ct > 0) {
+            row("us/sweep", static_cast<double>(m_wall_ns) * 1e-3 / static_cast<double>(m_sweep_ct));
+        }
+    }
+
+private:
+    uint64_t m_sweep_ct{};
+    uint64_t m_proposal_ct{};
+    uint64_t m_acceptance_ct{};
+    uint64_t m_cluster_ct{};
+    uint64_t m_cluster_size_sum{};
+    uint64_t m_max_cluster_size{};
+    uint64_t m_wall_ns{};
+    uint64_t m_cpu_ns{};
+};
+
+/**
+ * @brief The telemetry of one sweep, as recorded by TelemetryRecorder.
+ */
+struct TelemetrySample {
+    double acceptance_rate;
+    double ns_per_update;
+};
+
+/**
+ * @brief A recorder keeping the acceptance rate and the time per update of every sweep, from the difference of
+ * the engine's telemetry() between calls. It composes with Recorder<Rs...> as a column of TelemetrySample.
+ */
+class TelemetryRecorder {
+public:
+    using value_type = TelemetrySample;
+
+    template<typename ModelT>
+    void operator ()(ModelT const& self) const {
+        auto const& now = self.telemetry();
+        if (now.proposal_count() < m_last.proposal_count() || now.sweep_count() < m_last.sweep_count()) {
+            // the telemetry was reset since the last sample (stats -r), so count from zero.
+            m_last.reset();
+        }
+        auto const proposals = now.proposal_count() - m_last.proposal_count();
+        auto const acceptances = now.acceptance_count() - m_last.acceptance_count();
+        auto const wall_ns = (now.wall_seconds() - m_last.wall_seconds()) * 1e9;
+        m_samples.push_back({
+            proposals ? static_cast<double>(acceptances) / static_cast<double>(proposals) : 0.0,
+            proposals ? wall_ns / static_cast<double>(proposals) : 0.0,
+        });
+        m_last = now;
+    }
+
+    auto operator ()() const {
+        auto result = std::move(m_samples);
+        m_samples.clear();
+        return result;
+    }
+
+    std::span<TelemetrySample const> column() const noexcept {
+        return m_samples;
+    }
+
+    void clear() noexcept {
+        m_samples.clear();
+    }
+
+    void save(std::ostream& os) const {
+        write_vector(os, m_samples);
+    }
+
+    void load(std::istream& is) {
+        read_vector(is, m_samples);
+    }
+
+private:
+    mutable Telemetry m_last;
+    mutable std::vector<TelemetrySample> m_samples;
+};
@@ -0,0 +1,296 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A scope timed by a TraceScope, as its thread recorded it.
+ */
+struct TraceEvent {
+    // a string literal or a Tracer::intern()ed name.
+    char const* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    // the count of scopes of the thread it's nested in.
+    uint32_t depth;
+};
+
+/**
+ * @brief Collects the scopes timed by TraceScope from every thread, for a hierarchical breakdown (report()) or a
+ * Chrome trace-event file (write_chrome_trace()), which chrome://tracing and ui.perfetto.dev open.
+ * Every thread appends to a buffer of its own, taking only its own uncontended lock, so threads don't serialize
+ * on the tracer; the buffers outlive their threads, so short-lived workers still show. Tracing is off until
+ * enable(); a scope then costs one relaxed atomic load.
+ */
+class Tracer {
+public:
+    // the events kept per thread; later ones are counted as dropped.
+    static constexpr std::size_t k_max_events = std::size_t{ 1 } << 20;
+
+    static Tracer& instance() {
+        static Tracer tracer{};
+        return tracer;
+    }
+
+    static bool enabled() noexcept {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool on) noexcept {
+        s_enabled.store(on, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Drop the events recorded so far, and the buffers of the threads that ended.
+     */
+    void clear() {
+        std::scoped_lock lock(m_mutex);
+        std::erase_if(m_buffers, [](auto const& buffer) { return buffer.use_count() == 1; });
+        for (auto const& buffer : m_buffers) {
+            std::scoped_lock buffer_lock(buffer->mutex);
+            buffer->events.clear();
+            buffer->dropped_ct = 0;
+        }
+    }
+
+    /**
+     * @brief A copy of a name that lives as long as the tracer, for names that aren't literals.
+     */
+    char const* intern(std::string_view name) {
+        std::scoped_lock lock(m_mutex);
+        return m_names.emplace(name).first->c_str();
+    }
+
+    /**
+     * @brief Name the calling thread in the trace, e.g. "colored worker"; threads of the same name are summed up
+     * together by report().
+     */
+    void name_thread(std::string_view name) {
+        thread_name() = name;
+        if (enabled()) {
+            auto& buffer = this->local();
+            std::scoped_lock lock(buffer.mutex);
+            buffer.name = name;
+        }
+    }
+
+    /**
+     * @brief The nanoseconds since the tracer was made.
+     */
+    uint64_t now_ns() const noexcept {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_epoch).count());
+    }
+
+    /**
+     * @brief The count of events recorded, and dropped for a full buffer, over all threads.
+     */
+    std::pair<uint64_t, uint64_t> event_count() const {
+        std::scoped_lock lock(m_mutex);
+        uint64_t event_ct{}, dropped_ct{};
+        for (auto const& buffer : m_buffers) {
+            std::scoped_lock buffer_lock(buffer->mutex);
+            event_ct += buffer->events.size();
+            dropped_ct += buffer->dropped_ct;
+        }
+        return { event_ct, dropped_ct };
+    }
+
+    /**
+     * @brief The scopes as a tree per thread name: the count, the total and the self time of every path of nested
+     * scopes, over all threads of a name. Time a worker waits, e.g. in a "barrier" scope, shows as its own node.
+     */
+    void report(std::ostream& os) const {
+        struct Node {
+            uint64_t count{};
+            uint64_t total_ns{};
+            uint64_t child_ns{};
+            std::size_t depth{};
+            char const* name{};
+        };
+        // the path's names joined by \1, which sorts a node right before its children.
+        std::map<std::string, Node> nodes{};
+        for (auto const& [thread, events] : this->collect()) {
+            std::vector<std::string> paths{ thread };
+            nodes[thread].name = nullptr;
+            for (auto const& event : events) {
+                paths.resize(event.depth + 1);
+                auto path = paths.back() + '\1' + event.name;
+                auto& node = nodes[path];
+                node.name = event.name;
+                node.depth = event.depth + 1;
+                ++node.count;
+                node.total_ns += event.end_ns - event.begin_ns;
+                nodes[paths.back()].child_ns += event.end_ns - event.begin_ns;
+                paths.push_back(std::move(path));
+            }
+        }
+        auto const [event_ct, dropped_ct] = this->event_count();
+        os << event_ct << " events";
+        if (dropped_ct > 0) {
+            os << ", " << dropped_ct << " dropped for full buffers";
+        }
+        os << '\n' << std::setw(48) << std::left << "scope" << std::setw(10) << "count" << std::setw(14) << "total (ms)"
+           << "self (ms)" << '\n';
+        for (auto const& [path, node] : nodes) {
+            if (!node.name) {
+                os << "[" << path << "]" << '\n';
+                continue;
+            }
+            auto const label = std::string(2 * node.depth, ' ') + node.name;
+            os << std::setw(48) << std::left << label << std::setw(10) << node.count
+               << std::setw(14) << static_cast<double>(node.total_ns) * 1e-6
+               << static_cast<double>(node.total_ns - std::min(node.child_ns, node.total_ns)) * 1e-6 << '\n';
+        }
+    }
+
+    /**
+     * @brief Write the events as Chrome trace-event JSON: a complete ("X") event per scope, one track per thread.
+     */
+    void write_chrome_trace(std::ostream& os) const {
+        auto const quoted = [](std::string_view text) {
+            std::string result{ '"' };
+            for (auto const ch : text) {
+                if (ch == '"' || ch == '\\') {
+                    result += '\\';
+                }
+                result += static_cast<unsigned char>(ch) < 0x20 ? ' ' : ch;
+            }
+            return result + '"';
+        };
+        os << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [" << '\n' << std::fixed << std::setprecision(3);
+        bool first = true;
+        uint32_t tid{};
+        for (auto const& [thread, events] : this->collect()) {
+            ++tid;
+            os << (first ? "" : ",\n") << "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+               << ", \"args\": { \"name\": " << quoted(thread) << " } }";
+            first = false;
+            for (auto const& event : events) {
+                os << ",\n{ \"name\": " << quoted(event.name) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+                   << ", \"ts\": " << static_cast<double>(event.begin_ns) * 1e-3
+                   << ", \"dur\": " << static_cast<double>(event.end_ns - event.begin_ns) * 1e-3 << " }";
+            }
+        }
+        os << '\n' << "] }" << '\n' << std::defaultfloat;
+    }
+
+private:
+    friend class TraceScope;
+
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+        std::string name;
+        uint64_t dropped_ct{};
+        // only touched by the thread itself.
+        uint32_t depth{};
+    };
+
+    Tracer()
+        : m_epoch(std::chrono::steady_clock::now()) {}
+
+    ThreadBuffer& local() {
+        thread_local std::shared_ptr<ThreadBuffer> const buffer = [this] {
+            auto result = std::make_shared<ThreadBuffer>();
+            std::scoped_lock lock(m_mutex);
+            result->name = thread_name().empty() ? "thread " + std::to_string(m_buffers.size()) : thread_name();
+            m_buffers.push_back(result);
+            return result;
+        }();
+        return *buffer;
+    }
+
+    /**
+     * @brief The name given to the calling thread, kept until it first records an event.
+     */
+    static std::string& thread_name() {
+        thread_local std::string name{};
+        return name;
+    }
+
+    void record(ThreadBuffer& buffer, TraceEvent const& event) noexcept {
+        std::scoped_lock lock(buffer.mutex);
+        try {
+            if (buffer.events.size() < k_max_events) {
+                buffer.events.push_back(event);
+                return;
+            }
+        }
+        catch (std::bad_alloc const&) {
+            // counted as dropped.
+        }
+        ++buffer.dropped_ct;
+    }
+
+    /**
+     * @brief A copy of every thread's events, sorted so every scope comes right before the scopes nested in it.
+     */
+    std::vector<std::pair<std::string, std::vector<TraceEvent>>> collect() const {
+        std::vector<std::pair<std::string, std::vector<TraceEvent>>> result{};
+        std::scoped_lock lock(m_mutex);
+        for (auto const& buffer : m_buffers) {
+            std::scoped_lock buffer_lock(buffer->mutex);
+            if (buffer->events.empty()) {
+                continue;
+            }
+            auto& [name, events] = result.emplace_back(buffer->name, buffer->events);
+            std::ranges::sort(events, [](TraceEvent const& lhs, TraceEvent const& rhs) {
+                return lhs.begin_ns != rhs.begin_ns ? lhs.begin_ns < rhs.begin_ns : lhs.depth < rhs.depth;
+            });
+        }
+        return result;
+    }
+
+    static inline std::atomic<bool> s_enabled{};
+
+    mutable std::mutex m_mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+    std::set<std::string, std::less<>> m_names;
+    std::chrono::steady_clock::time_point m_epoch;
+};
+
+/**
+ * @brief Time a scope into the Tracer, if tracing is enabled when it starts.
+ * @param name A string literal or an interned name.
+ */
+class TraceScope {
+public:
+    explicit TraceScope(char const* name) {
+        if (Tracer::enabled()) {
+            auto& tracer = Tracer::instance();
+            m_buffer = &tracer.local();
+            m_name = name;
+            m_depth = m_buffer->depth++;
+            m_begin_ns = tracer.now_ns();
+        }
+    }
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator =(TraceScope const&) = delete;
+
+    ~TraceScope() {
+        if (m_buffer) {
+            auto& tracer = Tracer::instance();
+            --m_buffer->depth;
+            tracer.record(*m_buffer, { m_name, m_begin_ns, tracer.now_ns(), m_depth });
+        }
+    }
+
+private:
+    Tracer::ThreadBuffer* m_buffer = nullptr;
+    char const* m_name{};
+    uint64_t m_begin_ns{};
+    uint32_t m_depth{};
+};
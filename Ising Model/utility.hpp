@@ -1,6 +1,104 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
 #include <random>
+#include <ranges>
+#include <span>
+#include <tuple>
 #include <type_traits>
+#include <vector>
+
+/**
+ * @brief The xoshiro256** pseudo random number generator.
+ * It is much cheaper than std::random_device-per-call and its state is tiny, so every model (or every replica)
+ * can own one. jump() advances the stream by 2^128 steps, which gives independent streams from a single seed.
+ */
+class Xoshiro256 {
+public:
+    using result_type = uint64_t;
+
+    static constexpr result_type min() noexcept {
+        return 0;
+    }
+    static constexpr result_type max() noexcept {
+        return ~result_type{};
+    }
+
+    explicit Xoshiro256(uint64_t seed = 0x853c49e6748fea9bull) noexcept {
+        this->seed(seed);
+    }
+
+    /**
+     * @brief Reset the state from a single 64-bit seed, expanded with splitmix64.
+     */
+    void seed(uint64_t seed) noexcept {
+        for (auto& s : m_state) {
+            seed += 0x9e3779b97f4a7c15ull;
+            auto z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            s = z ^ (z >> 31);
+        }
+    }
+
+    result_type operator ()() noexcept {
+        auto const result = rotl(m_state[1] * 5, 7) * 9;
+        auto const t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = rotl(m_state[3], 45);
+        return result;
+    }
+
+    /**
+     * @brief A uniformly distributed double in [0, 1).
+     */
+    double uniform() noexcept {
+        return static_cast<double>((*this)() >> 11) * 0x1.0p-53;
+    }
+
+    /**
+     * @brief Advance the generator by 2^128 calls.
+     */
+    void jump() noexcept {
+        constexpr uint64_t k_jump[] = { 0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull };
+        std::array<uint64_t, 4> s{};
+        for (auto const j : k_jump) {
+            for (int b = 0; b < 64; ++b) {
+                if (j & (uint64_t{ 1 } << b)) {
+                    for (int k = 0; k < 4; ++k) {
+                        s[k] ^= m_state[k];
+                    }
+                }
+                (*this)();
+            }
+        }
+        m_state = s;
+    }
+
+    std::array<uint64_t, 4> const& state() const noexcept {
+        return m_state;
+    }
+
+    void state(std::array<uint64_t, 4> const& state) noexcept {
+        m_state = state;
+    }
+
+private:
+    static constexpr uint64_t rotl(uint64_t x, int k) noexcept {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    std::array<uint64_t, 4> m_state;
+};
+
+using rng_t = Xoshiro256;
 
 /**
  * @brief Generate a random number within a give range.
@@ -31,6 +129,31 @@ R randnum(T left, U right) {
     return result;
 }
 
+/**
+ * @brief Generate a random number within a give range, drawing from the given engine.
+ *
+ * @param left The left bound of the range, inclusive.
+ * @param right The right bound of the range, exclusive.
+ * @param eng The random engine to use.
+ * @return R A random number.
+ */
+template<typename T, typename U, typename Engine, typename R = std::common_type_t<T, U>>
+R randnum(T left, U right, Engine& eng) {
+    using distribution_t = std::conditional_t<std::is_integral_v<R>,
+                                              std::uniform_int_distribution<R>, std::uniform_real_distribution<R>>;
+    if constexpr (std::is_integral_v<R>) {
+        return distribution_t(left, right - 1)(eng);
+    }
+    else {
+        distribution_t d(left, right);
+        R result{};
+        do {
+            result = d(eng);
+        } while (result == static_cast<R>(right));
+        return result;
+    }
+}
+
 //template<typename T, typename U>
 //struct cons;
 //
@@ -108,50 +231,77 @@ R randnum(T left, U right) {
 //template<template<typename...> class C, typename D>
 //using rebind_t = typename rebind<C, D>::type;
 
+/**
+ * @brief Write a vector of trivially copyable values as its size followed by the raw values.
+ */
 template<typename T>
-struct transpose {};
-
-template <typename... Ts>
-struct transpose<std::tuple<std::vector<Ts>...>> {
-    using type = std::vector<std::tuple<Ts...>>;
-};
-
-template <typename... Ts>
-struct transpose<std::vector<std::tuple<Ts...>>> {
-    using type = std::tuple<std::vector<Ts>...>;
-};
-
-template<typename... Ts>
-using transpose_t = typename transpose<Ts...>::type;
+void write_vector(std::ostream& os, std::vector<T> const& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto const size = static_cast<uint64_t>(values.size());
+    os.write(reinterpret_cast<char const*>(&size), sizeof(size));
+    os.write(reinterpret_cast<char const*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
 
-template<typename... Ts>
-static inline std::tuple<Ts&...> ith(size_t i, std::vector<Ts>&... vs) {
-    return std::tie(vs[i]...);
+/**
+ * @brief Read a vector written by write_vector(); the stream's failbit is set if it is cut short.
+ */
+template<typename T>
+void read_vector(std::istream& is, std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    uint64_t size{};
+    if (!is.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+        return;
+    }
+    values.resize(size);
+    is.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(size * sizeof(T)));
 }
 
+/**
+ * @brief A read-only view of equally long columns, e.g. the samples of several recorders, read by column or by row.
+ * Nothing is copied: the columns are spans over their owners' storage, and a row is a tuple of the values at one
+ * index, made when it is read.
+ */
 template<typename... Ts>
-class Builder {
+class ColumnView {
 public:
-    Builder(std::tuple<Ts const&...> const& args)
-        : m_tuple(args) {}
+    using row_type = std::tuple<Ts...>;
+
+    ColumnView() noexcept requires (sizeof...(Ts) > 0) = default;
+
+    explicit ColumnView(std::span<Ts const>... columns) noexcept
+        : m_columns(columns...) {}
 
-    std::tuple<Ts const&...>&& tuple() const {
-        return std::move(m_tuple);
+    std::size_t size() const noexcept {
+        return std::apply([](auto const&... columns) { return std::min({ columns.size()..., ~std::size_t{} }); }, m_columns)
+             * (sizeof...(Ts) > 0);
     }
 
-    template<typename T>
-    auto operator ,(Builder const& other) {
-        return Builder(std::tuple_cat(m_tuple, other.m_tuple));
+    bool empty() const noexcept {
+        return this->size() == 0;
+    }
+
+    template<std::size_t I>
+    auto column() const noexcept {
+        return std::get<I>(m_columns);
+    }
+
+    row_type operator [](std::size_t i) const {
+        return std::apply([i](auto const&... columns) { return row_type(columns[i]...); }, m_columns);
+    }
+
+    /**
+     * @brief The rows as a lazy range, e.g. for (auto [energy, magnetization] : view.rows()).
+     */
+    auto rows() const {
+        return std::views::iota(std::size_t{}, this->size())
+             | std::views::transform([columns = m_columns](std::size_t i) {
+                   return std::apply([i](auto const&... cs) { return row_type(cs[i]...); }, columns);
+               });
     }
 
 private:
-    std::tuple<Ts const&...> m_tuple;
+    std::tuple<std::span<Ts const>...> m_columns;
 };
 
 template<typename... Ts>
-Builder(std::tuple<Ts&...> const&) -> Builder<Ts...>;
-
-template<typename... T>
-std::tuple<T const&...> ctie(T const&... args) {
-    return std::tie(args...);
-}
+ColumnView(std::span<Ts const>...) -> ColumnView<Ts...>;